@@ -0,0 +1,911 @@
+/*
+ * Block buffer cache.
+ */
+
+#include "drivers/bcache.h"
+#include "drivers/bootargs.h"
+#include "kernel/config.h"
+#include "kernel/interrupt.h"
+#include "kernel/spinlock.h"
+#include "kernel/sleepq.h"
+#include "kernel/thread.h"
+#include "kernel/semaphore.h"
+#include "kernel/panic.h"
+#include "vm/memory.h"
+#include "lib/libc.h"
+#include "lib/debug.h"
+
+/** @name Block buffer cache
+ *
+ * The buffer cache keeps recently used blocks of generic block
+ * devices in memory, keyed by device and block number, so that
+ * filesystems read a hot block from the disk only once. Filesystems
+ * take a block with bcache_read(), or with bcache_get() when they
+ * are about to overwrite all of it. Either way the buffer is pinned,
+ * and it stays in the cache until bcache_release() unpins it.
+ *
+ * Writes only change the cached copy and mark it dirty with
+ * bcache_dirty(). Dirty blocks are written to the disk when they are
+ * evicted, and by bcache_sync(), which filesystems call when they are
+ * unmounted.
+ *
+ * When a new block needs a buffer, a clock sweep picks an unpinned
+ * buffer that has not been used since the hand last passed it. A
+ * buffer that is being read or written is busy, and anyone wanting
+ * it sleeps until the I/O is done. The I/O itself is done without
+ * holding the cache lock.
+ *
+ * Runs of consecutive blocks are moved with one multi-block request
+ * where the device has them: bcache_prefetch() reads the missing
+ * blocks of a run, and write-back takes the dirty neighbours of a
+ * block along.
+ *
+ * bcache_readahead() starts the read of a run without waiting for
+ * it. The buffers stay busy until the first thread that needs one of
+ * them, or needs the slot of the read, waits for the request to
+ * complete and finishes it.
+ *
+ * The cache does not order changes to the contents of a buffer; its
+ * users serialize those with their own locks.
+ *
+ * The number of buffers is CONFIG_BCACHE_BLOCKS, or the value of the
+ * "bcacheblocks" boot argument.
+ *
+ * @{
+ */
+
+#define BCACHE_BUCKETS 64
+
+/* Most blocks moved in one disk request */
+#define BCACHE_MAX_RUN 32
+
+#define BCACHE_MIN_BLOCKS 16
+#define BCACHE_MAX_BLOCKS 65536
+
+#define BCACHE_VALID      0x1  /* data holds the block */
+#define BCACHE_DIRTY      0x2  /* data is newer than the disk */
+#define BCACHE_BUSY       0x4  /* being read or written */
+#define BCACHE_REFERENCED 0x8  /* used since the clock hand passed */
+
+/* Most asynchronous reads in flight */
+#define BCACHE_ASYNC_SLOTS 4
+
+#define BCACHE_ASYNC_FREE    0
+#define BCACHE_ASYNC_PENDING 1  /* submitted, nobody waits for it */
+#define BCACHE_ASYNC_WAITED  2  /* a thread waits for it to complete */
+
+/* An asynchronous read of a run of buffers */
+typedef struct bcache_async {
+  int state;
+  gbd_request_t req;
+  gbd_segment_t segments[BCACHE_MAX_RUN];
+  bcache_buf_t *run[BCACHE_MAX_RUN];
+  int n;
+} bcache_async_t;
+
+static bcache_buf_t *bcache_bufs;
+static int bcache_count;
+
+/* First buffer of each hash chain */
+static bcache_buf_t *bcache_buckets[BCACHE_BUCKETS];
+
+/* Clock hand for eviction */
+static int bcache_hand;
+
+/* Set when someone waits for a buffer to be unpinned */
+static int bcache_starved;
+
+static spinlock_t bcache_slock;
+
+static bcache_async_t bcache_asyncs[BCACHE_ASYNC_SLOTS];
+
+/* Counters */
+static uint32_t bcache_hits;
+static uint32_t bcache_misses;
+static uint32_t bcache_writebacks;
+static uint32_t bcache_readaheads;
+
+static int bcache_bucket(gbd_t *disk, uint32_t block)
+{
+  uint64_t h = (uint64_t)(uintptr_t)disk;
+
+  h = h * 31 + block;
+  return h % BCACHE_BUCKETS;
+}
+
+/* Returns the buffer of the block, NULL if it is not cached. The
+   caller holds bcache_slock. */
+static bcache_buf_t *bcache_find(gbd_t *disk, uint32_t block)
+{
+  bcache_buf_t *buf = bcache_buckets[bcache_bucket(disk, block)];
+
+  while (buf != NULL && (buf->disk != disk || buf->block != block))
+    buf = buf->next;
+
+  return buf;
+}
+
+/* Takes a buffer off its hash chain. The caller holds bcache_slock. */
+static void bcache_unhash(bcache_buf_t *buf)
+{
+  bcache_buf_t **link = &bcache_buckets[bcache_bucket(buf->disk,
+                                                      buf->block)];
+
+  while (*link != buf)
+    link = &(*link)->next;
+  *link = buf->next;
+
+  buf->disk = NULL;
+}
+
+/* Gives a buffer to a block. The caller holds bcache_slock. */
+static void bcache_hash(bcache_buf_t *buf, gbd_t *disk, uint32_t block)
+{
+  int bucket = bcache_bucket(disk, block);
+
+  buf->disk = disk;
+  buf->block = block;
+  buf->next = bcache_buckets[bucket];
+  bcache_buckets[bucket] = buf;
+}
+
+/* Picks a buffer for a new block: an unused one, or one that is not
+   pinned, busy or recently used. NULL if every buffer is pinned or
+   busy. The caller holds bcache_slock. */
+static bcache_buf_t *bcache_victim(void)
+{
+  bcache_buf_t *buf;
+  int step;
+
+  /* Two rounds: the first may only clear referenced bits */
+  for (step = 0; step < 2 * bcache_count; step++) {
+    buf = &bcache_bufs[bcache_hand];
+    bcache_hand = (bcache_hand + 1) % bcache_count;
+
+    if (buf->disk == NULL)
+      return buf;
+
+    if (buf->pins > 0 || (buf->flags & BCACHE_BUSY))
+      continue;
+
+    if (buf->flags & BCACHE_REFERENCED) {
+      buf->flags &= ~BCACHE_REFERENCED;
+      continue;
+    }
+
+    return buf;
+  }
+
+  return NULL;
+}
+
+/* Sleeps on the resource. Called with bcache_slock held and
+   interrupts disabled; returns without the lock. */
+static void bcache_wait(void *resource)
+{
+  sleepq_add(resource);
+  spinlock_release(&bcache_slock);
+  thread_switch();
+}
+
+/* Wakes the threads waiting for a victim if the buffer can be one
+   again: neither pinned nor busy. The caller holds bcache_slock. */
+static void bcache_unstarve(bcache_buf_t *buf)
+{
+  if (bcache_starved && buf->pins == 0 && !(buf->flags & BCACHE_BUSY)) {
+    bcache_starved = 0;
+    sleepq_wake_all(&bcache_bufs);
+  }
+}
+
+/* Reads or writes a busy buffer. Returns 0 on success. */
+static int bcache_io(bcache_buf_t *buf, int write)
+{
+  gbd_request_t req;
+  int r;
+
+  req.block = buf->block;
+  req.buf = ADDR_KERNEL_TO_PHYS((uintptr_t)buf->data);
+  req.sem = NULL;
+
+  if (write)
+    r = buf->disk->write_block(buf->disk, &req);
+  else
+    r = buf->disk->read_block(buf->disk, &req);
+
+  return r > 0 ? 0 : -1;
+}
+
+/* Reads or writes busy buffers of consecutive blocks of one device,
+   in block order, with one request if the device can do it. Returns
+   0 on success, -1 if any block failed. */
+static int bcache_io_run(bcache_buf_t **run, int n, int write)
+{
+  gbd_t *disk = run[0]->disk;
+  gbd_segment_t segments[BCACHE_MAX_RUN];
+  gbd_request_t req;
+  int i, r;
+
+  if (n == 1 || (write ? disk->write_blocks : disk->read_blocks) == NULL) {
+    r = 0;
+    for (i = 0; i < n; i++)
+      if (bcache_io(run[i], write) != 0)
+        r = -1;
+    return r;
+  }
+
+  for (i = 0; i < n; i++) {
+    segments[i].buf = ADDR_KERNEL_TO_PHYS((uintptr_t)run[i]->data);
+    segments[i].size = run[i]->size;
+  }
+
+  req.block = run[0]->block;
+  req.count = n;
+  req.segments = segments;
+  req.nsegments = n;
+  req.sem = NULL;
+
+  if (write)
+    r = disk->write_blocks(disk, &req);
+  else
+    r = disk->read_blocks(disk, &req);
+
+  return r > 0 ? 0 : -1;
+}
+
+/* True if the buffer can join a write-back run of size byte blocks.
+   The caller holds bcache_slock. */
+static int bcache_writable(bcache_buf_t *buf, uint32_t size)
+{
+  return buf != NULL && buf->size == size
+    && (buf->flags & (BCACHE_DIRTY | BCACHE_BUSY)) == BCACHE_DIRTY;
+}
+
+/* Collects the run of consecutive dirty blocks around a dirty buffer
+   that is not busy, in block order, and makes them busy and clean.
+   Returns the length of the run. The caller holds bcache_slock. */
+static int bcache_dirty_run(bcache_buf_t *buf, bcache_buf_t **run)
+{
+  uint32_t first = buf->block;
+  uint32_t last = buf->block;
+  uint32_t block;
+  int n = 0;
+
+  while (first > 0 && last - first + 1 < BCACHE_MAX_RUN
+         && bcache_writable(bcache_find(buf->disk, first - 1), buf->size))
+    first--;
+  while (last - first + 1 < BCACHE_MAX_RUN
+         && bcache_writable(bcache_find(buf->disk, last + 1), buf->size))
+    last++;
+
+  for (block = first; block <= last; block++) {
+    run[n] = bcache_find(buf->disk, block);
+    run[n]->flags = (run[n]->flags & ~BCACHE_DIRTY) | BCACHE_BUSY;
+    n++;
+  }
+
+  return n;
+}
+
+/* Writes a run of dirty buffers that this thread has made busy, and
+   makes them not busy again. The buffers are clean while they are
+   written, so that changes made meanwhile mark them dirty again.
+   Returns 0 on success. */
+static int bcache_writeback(bcache_buf_t **run, int n)
+{
+  interrupt_status_t intr_status;
+  int i, r;
+
+  r = bcache_io_run(run, n, 1);
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&bcache_slock);
+
+  for (i = 0; i < n; i++) {
+    run[i]->flags &= ~BCACHE_BUSY;
+    if (r == 0)
+      bcache_writebacks++;
+    else
+      run[i]->flags |= BCACHE_DIRTY;
+    sleepq_wake_all(run[i]);
+    bcache_unstarve(run[i]);
+  }
+
+  spinlock_release(&bcache_slock);
+  _interrupt_set_state(intr_status);
+
+  return r;
+}
+
+/* Gives busy buffers that this thread has just hashed data of the
+   device's block size, reads them from the disk if read is set, and
+   makes them not busy again. Returns 0 on success; on failure the
+   buffers are left invalid. */
+static int bcache_fill(bcache_buf_t **run, int n, int read)
+{
+  interrupt_status_t intr_status;
+  uint32_t size = run[0]->disk->block_size(run[0]->disk);
+  int i, r;
+
+  /* The buffers are busy, so they are ours until the I/O is done */
+  for (i = 0; i < n; i++) {
+    if (run[i]->size != size) {
+      kfree(run[i]->data);
+      run[i]->data = kmalloc(size);
+      run[i]->size = size;
+    }
+  }
+
+  r = 0;
+  if (read)
+    r = bcache_io_run(run, n, 0);
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&bcache_slock);
+
+  for (i = 0; i < n; i++) {
+    run[i]->flags &= ~BCACHE_BUSY;
+    if (r == 0)
+      run[i]->flags |= BCACHE_VALID;
+    else
+      run[i]->flags &= ~BCACHE_VALID;
+    sleepq_wake_all(run[i]);
+    bcache_unstarve(run[i]);
+  }
+
+  spinlock_release(&bcache_slock);
+  _interrupt_set_state(intr_status);
+
+  return r;
+}
+
+/* Waits for an asynchronous read that this thread has marked waited
+   to complete, and makes its buffers not busy again. */
+static void bcache_async_finish(bcache_async_t *async)
+{
+  interrupt_status_t intr_status;
+  bcache_buf_t *buf;
+  int i;
+
+  semaphore_P(async->req.sem);
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&bcache_slock);
+
+  for (i = 0; i < async->n; i++) {
+    buf = async->run[i];
+    buf->async = NULL;
+    buf->flags &= ~BCACHE_BUSY;
+    if (async->req.return_value == 0)
+      buf->flags |= BCACHE_VALID;
+    else
+      buf->flags &= ~BCACHE_VALID;
+    sleepq_wake_all(buf);
+    bcache_unstarve(buf);
+  }
+  async->state = BCACHE_ASYNC_FREE;
+
+  spinlock_release(&bcache_slock);
+  _interrupt_set_state(intr_status);
+}
+
+/* Picks a pending asynchronous read, of the device or of any device
+   if disk is NULL, and marks it waited. NULL if there is none. The
+   caller holds bcache_slock. */
+static bcache_async_t *bcache_async_pending(gbd_t *disk)
+{
+  int i;
+
+  for (i = 0; i < BCACHE_ASYNC_SLOTS; i++) {
+    if (bcache_asyncs[i].state == BCACHE_ASYNC_PENDING
+        && (disk == NULL || bcache_asyncs[i].run[0]->disk == disk)) {
+      bcache_asyncs[i].state = BCACHE_ASYNC_WAITED;
+      return &bcache_asyncs[i];
+    }
+  }
+
+  return NULL;
+}
+
+/* Finishes every asynchronous read of the device that nobody is
+   waiting for yet. */
+static void bcache_async_drain(gbd_t *disk)
+{
+  interrupt_status_t intr_status;
+  bcache_async_t *async;
+
+  for (;;) {
+    intr_status = _interrupt_disable();
+    spinlock_acquire(&bcache_slock);
+    async = bcache_async_pending(disk);
+    spinlock_release(&bcache_slock);
+    _interrupt_set_state(intr_status);
+
+    if (async == NULL)
+      return;
+    bcache_async_finish(async);
+  }
+}
+
+/* Returns the pinned buffer of a block, reading the block from the
+   disk if read is set and the block is not cached. NULL if the read
+   failed. */
+static bcache_buf_t *bcache_lookup(gbd_t *disk, uint32_t block, int read)
+{
+  interrupt_status_t intr_status;
+  bcache_buf_t *buf;
+  bcache_buf_t *run[BCACHE_MAX_RUN];
+  bcache_async_t *async;
+  int n;
+
+  for (;;) {
+    intr_status = _interrupt_disable();
+    spinlock_acquire(&bcache_slock);
+
+    buf = bcache_find(disk, block);
+    if (buf != NULL) {
+      if (buf->async != NULL
+          && buf->async->state == BCACHE_ASYNC_PENDING) {
+        /* Read ahead, wait for the read to complete */
+        async = buf->async;
+        async->state = BCACHE_ASYNC_WAITED;
+        spinlock_release(&bcache_slock);
+        _interrupt_set_state(intr_status);
+        bcache_async_finish(async);
+        continue;
+      }
+
+      if (buf->flags & BCACHE_BUSY) {
+        bcache_wait(buf);
+        _interrupt_set_state(intr_status);
+        continue;
+      }
+
+      buf->pins++;
+      buf->flags |= BCACHE_REFERENCED;
+
+      if ((buf->flags & BCACHE_VALID) || !read) {
+        buf->flags |= BCACHE_VALID;
+        bcache_hits++;
+        spinlock_release(&bcache_slock);
+        _interrupt_set_state(intr_status);
+        return buf;
+      }
+
+      /* An earlier read of the block failed, try again */
+      buf->flags |= BCACHE_BUSY;
+      break;
+    }
+
+    buf = bcache_victim();
+    if (buf == NULL) {
+      /* Reads ahead hold buffers busy until they are finished */
+      async = bcache_async_pending(NULL);
+      if (async != NULL) {
+        spinlock_release(&bcache_slock);
+        _interrupt_set_state(intr_status);
+        bcache_async_finish(async);
+        continue;
+      }
+
+      bcache_starved = 1;
+      bcache_wait(&bcache_bufs);
+      _interrupt_set_state(intr_status);
+      continue;
+    }
+
+    if (buf->flags & BCACHE_DIRTY) {
+      /* Write it back along with its dirty neighbours, then look
+         again, since the block may have been cached meanwhile */
+      n = bcache_dirty_run(buf, run);
+      spinlock_release(&bcache_slock);
+      _interrupt_set_state(intr_status);
+
+      if (bcache_writeback(run, n) != 0) {
+        kprintf("bcache: lost a write of block %d\n", buf->block);
+        intr_status = _interrupt_disable();
+        spinlock_acquire(&bcache_slock);
+        buf->flags &= ~BCACHE_DIRTY;
+        spinlock_release(&bcache_slock);
+        _interrupt_set_state(intr_status);
+      }
+      continue;
+    }
+
+    if (buf->disk != NULL)
+      bcache_unhash(buf);
+    bcache_hash(buf, disk, block);
+    buf->pins = 1;
+    buf->flags = BCACHE_BUSY | BCACHE_REFERENCED;
+    bcache_misses++;
+    break;
+  }
+
+  spinlock_release(&bcache_slock);
+  _interrupt_set_state(intr_status);
+
+  if (bcache_fill(&buf, 1, read) != 0) {
+    bcache_release(buf);
+    return NULL;
+  }
+
+  return buf;
+}
+
+/**
+ * Initializes the buffer cache. Called once during boot, before any
+ * filesystem is mounted.
+ */
+void bcache_init(void)
+{
+  char *arg = bootargs_get("bcacheblocks");
+  int i;
+
+  spinlock_reset(&bcache_slock);
+  spinlock_register(&bcache_slock, "bcache_slock");
+
+  bcache_count = CONFIG_BCACHE_BLOCKS;
+  if (arg != NULL)
+    bcache_count = atoi(arg);
+  if (bcache_count < BCACHE_MIN_BLOCKS)
+    bcache_count = BCACHE_MIN_BLOCKS;
+  if (bcache_count > BCACHE_MAX_BLOCKS)
+    bcache_count = BCACHE_MAX_BLOCKS;
+
+  bcache_bufs = kmalloc(bcache_count * sizeof(bcache_buf_t));
+  if (bcache_bufs == NULL)
+    KERNEL_PANIC("bcache_init: could not allocate buffers");
+
+  /* The data of a buffer is allocated when it is first used */
+  memoryset(bcache_bufs, 0, bcache_count * sizeof(bcache_buf_t));
+  for (i = 0; i < BCACHE_BUCKETS; i++)
+    bcache_buckets[i] = NULL;
+
+  for (i = 0; i < BCACHE_ASYNC_SLOTS; i++) {
+    bcache_asyncs[i].state = BCACHE_ASYNC_FREE;
+    bcache_asyncs[i].req.sem = semaphore_create(0);
+    if (bcache_asyncs[i].req.sem == NULL)
+      KERNEL_PANIC("bcache_init: could not create semaphores");
+  }
+
+  bcache_hand = 0;
+  bcache_starved = 0;
+
+  kprintf("Buffer cache: %d blocks\n", bcache_count);
+}
+
+/**
+ * Takes a block from the cache, reading it from the disk if it is not
+ * cached. The buffer stays pinned until bcache_release().
+ *
+ * @param disk Device of the block.
+ * @param block Block number on the device.
+ *
+ * @return The buffer, NULL if the block could not be read.
+ */
+bcache_buf_t *bcache_read(gbd_t *disk, uint32_t block)
+{
+  return bcache_lookup(disk, block, 1);
+}
+
+/**
+ * Takes a block from the cache without reading it from the disk. If
+ * the block is not cached, the contents of the buffer are undefined
+ * and the caller must fill all of it. The buffer stays pinned until
+ * bcache_release().
+ *
+ * @param disk Device of the block.
+ * @param block Block number on the device.
+ *
+ * @return The buffer.
+ */
+bcache_buf_t *bcache_get(gbd_t *disk, uint32_t block)
+{
+  return bcache_lookup(disk, block, 0);
+}
+
+/**
+ * Reads the blocks of a run that are not cached into the cache, with
+ * one disk request for each stretch of missing blocks. Blocks that
+ * are cached or being read are skipped. The rest of the run is
+ * skipped if no clean buffer is free, since prefetching never waits
+ * for one. The blocks are not pinned; take them with bcache_read().
+ *
+ * @param disk Device of the blocks.
+ * @param block First block of the run.
+ * @param count Number of blocks in the run.
+ *
+ * @return 0 on success, -1 if a read failed.
+ */
+int bcache_prefetch(gbd_t *disk, uint32_t block, uint32_t count)
+{
+  interrupt_status_t intr_status;
+  bcache_buf_t *buf;
+  bcache_buf_t *run[BCACHE_MAX_RUN];
+  uint32_t i;
+  int n = 0;
+  int full = 0;
+  int retval = 0;
+
+  for (i = 0; i <= count && !full; i++) {
+    buf = NULL;
+
+    if (i < count) {
+      intr_status = _interrupt_disable();
+      spinlock_acquire(&bcache_slock);
+
+      if (bcache_find(disk, block + i) == NULL) {
+        buf = bcache_victim();
+        if (buf == NULL || (buf->flags & BCACHE_DIRTY)) {
+          buf = NULL;
+          full = 1;
+        } else {
+          if (buf->disk != NULL)
+            bcache_unhash(buf);
+          bcache_hash(buf, disk, block + i);
+          buf->flags = BCACHE_BUSY | BCACHE_REFERENCED;
+          bcache_misses++;
+        }
+      }
+
+      spinlock_release(&bcache_slock);
+      _interrupt_set_state(intr_status);
+    }
+
+    /* Extend the stretch of missing blocks, or read it once it ends */
+    if (buf != NULL) {
+      run[n++] = buf;
+      if (n < BCACHE_MAX_RUN)
+        continue;
+    }
+    if (n > 0 && bcache_fill(run, n, 1) != 0)
+      retval = -1;
+    n = 0;
+  }
+
+  return retval;
+}
+
+/**
+ * Starts reading the blocks of a run that are not cached into the
+ * cache, and returns without waiting for the reads. Each stretch of
+ * missing blocks is read with one asynchronous disk request. Like
+ * bcache_prefetch(), skips cached blocks and gives up when no clean
+ * buffer is free. Also gives up when every read slot is taken and
+ * the reads in them are already being waited for. A run takes at
+ * most a quarter of the cache.
+ *
+ * A device without multi-block requests gets bcache_prefetch()
+ * instead, since its single-block requests may not complete
+ * asynchronously.
+ *
+ * @param disk Device of the blocks.
+ * @param block First block of the run.
+ * @param count Number of blocks in the run.
+ *
+ * @return 0 on success, -1 if a read could not be started.
+ */
+int bcache_readahead(gbd_t *disk, uint32_t block, uint32_t count)
+{
+  interrupt_status_t intr_status;
+  bcache_async_t *async;
+  bcache_buf_t *buf;
+  uint32_t size;
+  uint32_t i = 0;
+  int full = 0;
+  int n;
+
+  if (disk->read_blocks == NULL)
+    return bcache_prefetch(disk, block, count);
+
+  if (count > (uint32_t)bcache_count / 4)
+    count = bcache_count / 4;
+
+  size = disk->block_size(disk);
+
+  while (i < count && !full) {
+    intr_status = _interrupt_disable();
+    spinlock_acquire(&bcache_slock);
+
+    /* Take a free slot, or finish the read in a pending one */
+    for (n = 0; n < BCACHE_ASYNC_SLOTS; n++)
+      if (bcache_asyncs[n].state == BCACHE_ASYNC_FREE)
+        break;
+    if (n == BCACHE_ASYNC_SLOTS) {
+      async = bcache_async_pending(NULL);
+      spinlock_release(&bcache_slock);
+      _interrupt_set_state(intr_status);
+
+      if (async == NULL)
+        return 0;
+      bcache_async_finish(async);
+      continue;
+    }
+    async = &bcache_asyncs[n];
+
+    /* Skip cached blocks, then claim the stretch of missing ones */
+    n = 0;
+    while (i < count && n < BCACHE_MAX_RUN) {
+      if (bcache_find(disk, block + i) != NULL) {
+        if (n > 0)
+          break;
+        i++;
+        continue;
+      }
+
+      buf = bcache_victim();
+      if (buf == NULL || (buf->flags & BCACHE_DIRTY)) {
+        full = 1;
+        break;
+      }
+
+      if (buf->disk != NULL)
+        bcache_unhash(buf);
+      bcache_hash(buf, disk, block + i);
+      buf->flags = BCACHE_BUSY | BCACHE_REFERENCED;
+      buf->async = async;
+      async->run[n++] = buf;
+      bcache_misses++;
+      i++;
+    }
+
+    if (n > 0) {
+      async->state = BCACHE_ASYNC_PENDING;
+      async->n = n;
+      bcache_readaheads += n;
+    }
+
+    spinlock_release(&bcache_slock);
+    _interrupt_set_state(intr_status);
+
+    if (n == 0)
+      break;
+
+    /* The buffers are busy, so they are ours until the read is
+       finished */
+    for (n = 0; n < async->n; n++) {
+      buf = async->run[n];
+      if (buf->size != size) {
+        kfree(buf->data);
+        buf->data = kmalloc(size);
+        buf->size = size;
+      }
+      async->segments[n].buf = ADDR_KERNEL_TO_PHYS((uintptr_t)buf->data);
+      async->segments[n].size = size;
+    }
+
+    async->req.block = async->run[0]->block;
+    async->req.count = async->n;
+    async->req.segments = async->segments;
+    async->req.nsegments = async->n;
+
+    /* The driver raises the semaphore even if the read fails */
+    if (disk->read_blocks(disk, &async->req) <= 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Marks a pinned buffer as changed. It is written to the disk when it
+ * is evicted or synced.
+ */
+void bcache_dirty(bcache_buf_t *buf)
+{
+  interrupt_status_t intr_status = _interrupt_disable();
+  spinlock_acquire(&bcache_slock);
+
+  buf->flags |= BCACHE_DIRTY;
+
+  spinlock_release(&bcache_slock);
+  _interrupt_set_state(intr_status);
+}
+
+/**
+ * Unpins a buffer taken with bcache_read() or bcache_get(). The
+ * buffer must not be used afterwards. Does nothing for NULL.
+ */
+void bcache_release(bcache_buf_t *buf)
+{
+  interrupt_status_t intr_status;
+
+  if (buf == NULL)
+    return;
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&bcache_slock);
+
+  buf->pins--;
+  bcache_unstarve(buf);
+
+  spinlock_release(&bcache_slock);
+  _interrupt_set_state(intr_status);
+}
+
+/**
+ * Writes the dirty blocks of a device to the disk.
+ *
+ * @param disk The device, NULL for every device.
+ *
+ * @return 0 if every write succeeded, -1 otherwise.
+ */
+int bcache_sync(gbd_t *disk)
+{
+  interrupt_status_t intr_status;
+  bcache_buf_t *buf;
+  bcache_buf_t *run[BCACHE_MAX_RUN];
+  int i, n;
+  int retval = 0;
+
+  bcache_async_drain(disk);
+
+  for (i = 0; i < bcache_count; i++) {
+    buf = &bcache_bufs[i];
+
+    intr_status = _interrupt_disable();
+    spinlock_acquire(&bcache_slock);
+
+    n = 0;
+    if (buf->disk != NULL && (disk == NULL || buf->disk == disk)
+        && bcache_writable(buf, buf->size))
+      n = bcache_dirty_run(buf, run);
+
+    spinlock_release(&bcache_slock);
+    _interrupt_set_state(intr_status);
+
+    if (n > 0 && bcache_writeback(run, n) != 0)
+      retval = -1;
+  }
+
+  return retval;
+}
+
+/**
+ * Writes the dirty blocks of a device to the disk and drops all of
+ * its blocks from the cache. Used when a filesystem is unmounted.
+ * Blocks that are still pinned stay cached.
+ *
+ * @param disk The device.
+ *
+ * @return 0 if every write succeeded, -1 otherwise.
+ */
+int bcache_invalidate(gbd_t *disk)
+{
+  interrupt_status_t intr_status;
+  bcache_buf_t *buf;
+  int retval;
+  int i;
+
+  retval = bcache_sync(disk);
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&bcache_slock);
+
+  for (i = 0; i < bcache_count; i++) {
+    buf = &bcache_bufs[i];
+    if (buf->disk == disk && buf->pins == 0
+        && !(buf->flags & (BCACHE_BUSY | BCACHE_DIRTY))) {
+      bcache_unhash(buf);
+      buf->flags = 0;
+    }
+  }
+
+  spinlock_release(&bcache_slock);
+  _interrupt_set_state(intr_status);
+
+  return retval;
+}
+
+/**
+ * Prints the counters of the cache if the "debugbcache" boot argument
+ * was given.
+ */
+void bcache_print_stats(void)
+{
+  DEBUG("debugbcache", "Buffer cache: %d blocks, %u hits, %u misses, "
+        "%u read ahead, %u writebacks\n", bcache_count, bcache_hits,
+        bcache_misses, bcache_readaheads, bcache_writebacks);
+}
+
+/** @} */
@@ -0,0 +1,44 @@
+/*
+ * Block buffer cache.
+ */
+
+#ifndef KUDOS_DRIVERS_BCACHE_H
+#define KUDOS_DRIVERS_BCACHE_H
+
+#include "lib/types.h"
+#include "drivers/gbd.h"
+
+/* A cached block. Only data is meant for the users of the cache. */
+typedef struct bcache_buf {
+  /* Device and block number, disk is NULL if the buffer is unused */
+  gbd_t *disk;
+  uint32_t block;
+
+  /* Contents of the block, block_size() bytes */
+  void *data;
+  uint32_t size;
+
+  /* Number of users holding the buffer, see bcache_release() */
+  int pins;
+  /* BCACHE_* flags, internal to the cache */
+  int flags;
+
+  /* Asynchronous read filling the buffer, internal to the cache */
+  struct bcache_async *async;
+
+  /* Next buffer in the same hash chain */
+  struct bcache_buf *next;
+} bcache_buf_t;
+
+void bcache_init(void);
+bcache_buf_t *bcache_read(gbd_t *disk, uint32_t block);
+bcache_buf_t *bcache_get(gbd_t *disk, uint32_t block);
+int bcache_prefetch(gbd_t *disk, uint32_t block, uint32_t count);
+int bcache_readahead(gbd_t *disk, uint32_t block, uint32_t count);
+void bcache_dirty(bcache_buf_t *buf);
+void bcache_release(bcache_buf_t *buf);
+int bcache_sync(gbd_t *disk);
+int bcache_invalidate(gbd_t *disk);
+void bcache_print_stats(void);
+
+#endif // KUDOS_DRIVERS_BCACHE_H
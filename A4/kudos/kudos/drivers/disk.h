@@ -24,6 +24,10 @@ typedef struct {
 
     /* Request currently served by the driver. If NULL device is idle. */
     volatile gbd_request_t     *request_served;
+
+    /* Block size of the disk in bytes, read when the driver is
+       initialized. */
+    uint32_t                   block_size;
 } disk_real_device_t;
 
 
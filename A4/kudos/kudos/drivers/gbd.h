@@ -16,6 +16,20 @@ typedef enum {
     GBD_OPERATION_WRITE
 } gbd_operation_t;
 
+/**
+ * One piece of the buffer of a multi-block request (see read_blocks
+ * and write_blocks in gbd_t). The piece is physically contiguous and
+ * its size is a multiple of the block size of the device.
+ */
+
+typedef struct {
+    /* PHYSICAL address of the piece. */
+    physaddr_t      buf;
+
+    /* Size of the piece in bytes. */
+    uint32_t        size;
+} gbd_segment_t;
+
 /**
  * Block Device Request Descriptor. When using generic block device
  * read or write functions a pointer to this structure is given as
@@ -40,6 +54,19 @@ typedef struct gbd_request_struct {
     */
     uint32_t       buf;
 
+    /* Number of blocks to operate on, starting from block. Used only
+       by read_blocks and write_blocks. */
+    uint32_t        count;
+
+    /* Scatter/gather list used instead of buf by read_blocks and
+       write_blocks. The blocks are transferred to or from the
+       segments in order, and the sizes of the segments add up to
+       count blocks. */
+    gbd_segment_t  *segments;
+
+    /* Number of entries in segments. */
+    uint32_t        nsegments;
+
     /* Semaphore which is signaled (increased by one) when the operation
        is complete. If this is set to NULL in call of read or write,
        the call will block until the request is complete.
@@ -86,6 +113,25 @@ typedef struct gbd_struct {
     */
     int (*write_block)(struct gbd_struct *gbd, gbd_request_t *request);
 
+    /* A pointer to a function which reads count consecutive blocks
+       from the device as one request.
+
+       Before calling, fill fields block, count, segments, nsegments
+       and sem in request. The blocks are read into the segments in
+       order. Synchronous and asynchronous calls work like in
+       read_block. NULL if the driver has no multi-block transfers;
+       then read the blocks one by one with read_block.
+    */
+    int (*read_blocks)(struct gbd_struct *gbd, gbd_request_t *request);
+
+    /* A pointer to a function which writes count consecutive blocks
+       to the device as one request.
+
+       Before calling, fill fields block, count, segments, nsegments
+       and sem in request. Otherwise like read_blocks.
+    */
+    int (*write_blocks)(struct gbd_struct *gbd, gbd_request_t *request);
+
     /* A pointer to a function which returns the block size of the device
        in bytes. */
     uint32_t (*block_size)(struct gbd_struct *gbd);
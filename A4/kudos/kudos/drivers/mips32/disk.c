@@ -27,8 +27,11 @@
 static void disk_interrupt_handle(device_t *device);
 static int disk_read_block(gbd_t *gbd, gbd_request_t *request);
 static int disk_write_block(gbd_t *gbd, gbd_request_t *request);
+static int disk_read_blocks(gbd_t *gbd, gbd_request_t *request);
+static int disk_write_blocks(gbd_t *gbd, gbd_request_t *request);
 static int disk_submit_request(gbd_t *gbd, gbd_request_t *request);
 static void disk_next_request(gbd_t *gbd);
+static void disk_start_block(gbd_t *gbd, volatile gbd_request_t *req);
 static uint32_t disk_block_size(gbd_t *gbd);
 static uint32_t disk_total_blocks(gbd_t *gbd);
 
@@ -62,6 +65,8 @@ device_t *disk_init(io_descriptor_t *desc) {
   gbd->device = dev;
   gbd->read_block = disk_read_block;
   gbd->write_block = disk_write_block;
+  gbd->read_blocks = disk_read_blocks;
+  gbd->write_blocks = disk_write_blocks;
   gbd->block_size = disk_block_size;
   gbd->total_blocks = disk_total_blocks;
 
@@ -69,6 +74,9 @@ device_t *disk_init(io_descriptor_t *desc) {
   real_dev->request_queue = NULL;
   real_dev->request_served = NULL;
 
+  ((disk_io_area_t *)dev->io_address)->command = DISK_COMMAND_BLOCKSIZE;
+  real_dev->block_size = ((disk_io_area_t *)dev->io_address)->data;
+
   irq_mask = 1 << (desc->irq + 10);
   interrupt_register(irq_mask, disk_interrupt_handle, dev);
 
@@ -76,16 +84,19 @@ device_t *disk_init(io_descriptor_t *desc) {
 }
 
 /**
- * Disk interrupt handler. Interrupt is raised so request is handled
- * by the disk. Sets return value of current request to zero, wakes up
- * function that is waiting this request and puts next request in work
- * by calling disk_next_request().
+ * Disk interrupt handler. Interrupt is raised so one block of the
+ * current request is handled by the disk. If the request has more
+ * blocks, puts the disk to work on the next one. Otherwise sets
+ * return value of current request to zero, wakes up function that is
+ * waiting this request and puts next request in work by calling
+ * disk_next_request().
  *
  * @param device Pointer to the device data structure
  */
 static void disk_interrupt_handle(device_t *device) {
   disk_real_device_t *real_dev = device->real_device;
   disk_io_area_t *io = (disk_io_area_t *)device->io_address;
+  volatile gbd_request_t *req;
 
   spinlock_acquire(&real_dev->slock);
 
@@ -103,6 +114,17 @@ static void disk_interrupt_handle(device_t *device) {
      service request. */
   KERNEL_ASSERT(real_dev->request_served != NULL);
 
+  /* The disk transfers one block at a time, so a multi-block request
+     stays in service until its last block is done. The number of
+     blocks done is kept in the internal field. */
+  req = real_dev->request_served;
+  req->internal = (void *)((uint32_t)req->internal + 1);
+  if ((uint32_t)req->internal < req->count) {
+    disk_start_block(device->generic_device, req);
+    spinlock_release(&real_dev->slock);
+    return;
+  }
+
   real_dev->request_served->return_value = 0;
 
   /* Wake up the function that is waiting this request to be
@@ -131,6 +153,8 @@ static void disk_interrupt_handle(device_t *device) {
  */
 static int disk_read_block(gbd_t *gbd, gbd_request_t *request) {
   request->operation = GBD_OPERATION_READ;
+  request->count = 1;
+  request->segments = NULL;
   return disk_submit_request(gbd, request);
 }
 
@@ -149,6 +173,50 @@ static int disk_read_block(gbd_t *gbd, gbd_request_t *request) {
  */
 static int disk_write_block(gbd_t *gbd, gbd_request_t *request)
 {
+  request->operation = GBD_OPERATION_WRITE;
+  request->count = 1;
+  request->segments = NULL;
+  return disk_submit_request(gbd, request);
+}
+
+
+/**
+ * Reads count consecutive blocks into the segments of request as one
+ * request of the disk scheduler. Implements gbd's read_blocks()
+ * function.
+ *
+ * @param gbd Pointer to the gbd data structure.
+ *
+ * @param request Pointer to the request data structure containing
+ * information about blocks to be read.
+ *
+ * @return Returns 1 if success, 0 otherwise
+ */
+static int disk_read_blocks(gbd_t *gbd, gbd_request_t *request) {
+  if (request->count == 0 || request->segments == NULL)
+    return 0;
+
+  request->operation = GBD_OPERATION_READ;
+  return disk_submit_request(gbd, request);
+}
+
+
+/**
+ * Writes count consecutive blocks from the segments of request as one
+ * request of the disk scheduler. Implements gbd's write_blocks()
+ * function.
+ *
+ * @param gbd Pointer to the gbd data structure.
+ *
+ * @param request Pointer to the request data structure containing
+ * information about blocks to be written.
+ *
+ * @return Returns 1 if success, 0 otherwise
+ */
+static int disk_write_blocks(gbd_t *gbd, gbd_request_t *request) {
+  if (request->count == 0 || request->segments == NULL)
+    return 0;
+
   request->operation = GBD_OPERATION_WRITE;
   return disk_submit_request(gbd, request);
 }
@@ -253,9 +321,39 @@ static void disk_next_request(gbd_t *gbd) {
 
   real_dev->request_served = req;
 
+  disk_start_block(gbd, req);
+}
+
+
+/**
+ * Puts the disk in work on the next block of the request being
+ * served. The number of blocks already done is in the internal field
+ * of the request. Assumes that interrupts are disabled and device
+ * spinlock is held.
+ *
+ * @param gbd pointer to the general block device.
+ *
+ * @param req The request being served.
+ */
+static void disk_start_block(gbd_t *gbd, volatile gbd_request_t *req) {
+  disk_real_device_t *real_dev = gbd->device->real_device;
+  disk_io_area_t *io = (disk_io_area_t *)gbd->device->io_address;
+  uint32_t done = (uint32_t)req->internal;
+  uint32_t offset, i;
+
+  io->tsector = req->block + done;
+
+  if (req->segments == NULL) {
+    io->dmaaddr = (uint32_t)req->buf;
+  } else {
+    /* Find the segment holding the block */
+    offset = done * real_dev->block_size;
+    for (i = 0; i < req->nsegments && offset >= req->segments[i].size; i++)
+      offset -= req->segments[i].size;
+    KERNEL_ASSERT(i < req->nsegments);
+    io->dmaaddr = (uint32_t)req->segments[i].buf + offset;
+  }
 
-  io->tsector = req->block;
-  io->dmaaddr = (uint32_t)req->buf;
   if(req->operation == GBD_OPERATION_READ) {
     io->command = DISK_COMMAND_READ;
   } else if(req->operation == GBD_OPERATION_WRITE) {
@@ -4,6 +4,7 @@
 
 #include "lib/types.h"
 #include "kernel/interrupt.h"
+#include "drivers/metadev.h"
 
 /**
  * This module implements Co-processor 0 timer driver.
@@ -30,4 +31,26 @@ void timer_set_ticks(uint32_t ticks)
     _interrupt_set_state(intr_status);
 }
 
+/**
+ * Converts milliseconds to timer ticks, the unit of
+ * timer_set_ticks(). The result is at least one tick.
+ *
+ * @param msec Time in milliseconds.
+ *
+ * @return The same time in timer ticks.
+ */
+
+uint32_t timer_ms_to_ticks(uint32_t msec)
+{
+    uint64_t ticks;
+
+    ticks = (uint64_t)msec * rtc_get_clockspeed() / 1000;
+    if (ticks == 0)
+        ticks = 1;
+    if (ticks > 0xFFFFFFFF)
+        ticks = 0xFFFFFFFF;
+
+    return (uint32_t)ticks;
+}
+
 /** @} */
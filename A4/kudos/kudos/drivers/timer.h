@@ -8,5 +8,6 @@
 #include "lib/types.h"
 
 void timer_set_ticks(uint32_t ticks);
+uint32_t timer_ms_to_ticks(uint32_t msec);
 
 #endif // KUDOS_DRIVERS_TIMER_H
@@ -6,6 +6,7 @@
 #define KUDOS_DRIVERS_X86_64__DISK_H
 
 /* Includes */
+#include "kernel/spinlock.h"
 
 /* Defines */
 #define IDE_CHANNELS_PER_CTRL   0x2     /* 2 Channels per Controller */
@@ -80,6 +81,11 @@ typedef struct ide_channel_t
   uint32_t dma_buf_phys;
   uint32_t dma_buf_virt;
 
+  /* Set while a thread owns the channel for a command, protected by
+     slock. Threads waiting for the channel sleep on it. */
+  spinlock_t slock;
+  int busy;
+
 } ide_channel_t;
 
 /* Ide Device */
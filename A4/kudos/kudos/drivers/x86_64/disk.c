@@ -11,6 +11,8 @@
 #include "kernel/semaphore.h"
 #include "kernel/spinlock.h"
 #include "kernel/interrupt.h"
+#include "kernel/sleepq.h"
+#include "kernel/thread.h"
 #include "lib/libc.h"
 #include "drivers/device.h"
 #include "drivers/gbd.h"
@@ -41,6 +43,8 @@ uint32_t ide_get_sectorsize(gbd_t *disk);
 uint32_t ide_get_sectorcount(gbd_t *disk);
 int ide_read_block(gbd_t *gbd, gbd_request_t *request);
 int ide_write_block(gbd_t *gbd, gbd_request_t *request);
+int ide_read_blocks(gbd_t *gbd, gbd_request_t *request);
+int ide_write_blocks(gbd_t *gbd, gbd_request_t *request);
 
 /**
  * Initialize disk device driver. Reserves memory for data structures
@@ -164,6 +168,8 @@ int disk_init(io_descriptor_t *desc)
   ide_channels[IDE_PRIMARY].dma_virt = 0;
   ide_channels[IDE_PRIMARY].dma_buf_phys = 0;
   ide_channels[IDE_PRIMARY].dma_buf_virt = 0;
+  spinlock_reset(&ide_channels[IDE_PRIMARY].slock);
+  ide_channels[IDE_PRIMARY].busy = 0;
 
   ide_channels[IDE_SECONDARY].busm = busmaster;
   ide_channels[IDE_SECONDARY].base = iobase2;
@@ -174,6 +180,8 @@ int disk_init(io_descriptor_t *desc)
   ide_channels[IDE_SECONDARY].dma_virt = 0;
   ide_channels[IDE_SECONDARY].dma_buf_phys = 0;
   ide_channels[IDE_SECONDARY].dma_buf_virt = 0;
+  spinlock_reset(&ide_channels[IDE_SECONDARY].slock);
+  ide_channels[IDE_SECONDARY].busy = 0;
 
   /* Install interrupts */
   interrupt_register(IDE_PRIMARY_IRQ, (int_handler_t)ide_irq_handler0, 0);
@@ -306,6 +314,8 @@ int disk_init(io_descriptor_t *desc)
           ide_gbd[count].device = &ide_dev[count];
           ide_gbd[count].write_block  = ide_write_block;
           ide_gbd[count].read_block   = ide_read_block;
+          ide_gbd[count].write_blocks = ide_write_blocks;
+          ide_gbd[count].read_blocks  = ide_read_blocks;
           ide_gbd[count].block_size     = ide_get_sectorsize;
           ide_gbd[count].total_blocks = ide_get_sectorcount;
 
@@ -386,27 +396,77 @@ int32_t ide_wait(uint8_t channel, int advanced)
   return 0;
 }
 
-int32_t ide_pio_readwrite(uint8_t rw, uint8_t drive, uint64_t lba, 
-                          uint8_t *buf, uint32_t numsectors)
+/* Largest number of sectors sent to the drive in one command */
+#define IDE_PIO_MAX_SECTORS 128
+
+/* Takes the channel for one command, sleeping while another thread
+   has it. The registers and the data port are shared by both drives
+   of the channel, so commands on it must not overlap. */
+static void ide_channel_lock(uint8_t channel)
 {
-  /* Sanity */
-  if(rw > 1 || buf == 0)
-    return 0;
+  interrupt_status_t intr_status;
+  ide_channel_t *chan = &ide_channels[channel];
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&chan->slock);
 
+  while(chan->busy)
+    {
+      sleepq_add(chan);
+      spinlock_release(&chan->slock);
+      thread_switch();
+      spinlock_acquire(&chan->slock);
+    }
+  chan->busy = 1;
+
+  spinlock_release(&chan->slock);
+  _interrupt_set_state(intr_status);
+}
+
+/* Gives the channel taken with ide_channel_lock() to the next
+   waiting command. */
+static void ide_channel_unlock(uint8_t channel)
+{
+  interrupt_status_t intr_status;
+  ide_channel_t *chan = &ide_channels[channel];
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&chan->slock);
+
+  chan->busy = 0;
+  sleepq_wake(chan);
+
+  spinlock_release(&chan->slock);
+  _interrupt_set_state(intr_status);
+}
+
+int32_t ide_pio_transfer(uint8_t rw, uint8_t drive, uint64_t lba,
+                         gbd_segment_t *segments, uint32_t nsegments,
+                         uint32_t numsectors)
+{
   /* Vars */
-  uint64_t addr = lba;
+  uint64_t addr;
   uint8_t lba_mode = 1; /* 1 - 28, 2 - 48 */
   uint8_t cmd = 0;
   uint8_t channel = ide_devices[drive].channel;
   uint32_t slave = ide_devices[drive].drive;
   uint32_t bus = ide_channels[channel].base;
-  uint32_t words = (numsectors * 512) / 2;
-
-  /* Make sure IRQs are disabled */
-  _outb(bus + IDE_REGISTER_CTRL, 0x02);
+  uint32_t seg = 0, offset = 0;
+  uint32_t done = 0, chunk, i;
+  uint64_t space = 0;
+  uint8_t *buf;
 
-  /* Wait for it to acknowledge */
-  ide_wait(channel, 0);
+  /* Sanity, every sector needs room in the segments */
+  if(rw > 1 || segments == NULL || numsectors == 0)
+    return 0;
+  for(i = 0; i < nsegments; i++)
+    {
+      if(segments[i].buf == 0 || segments[i].size % 512 != 0)
+        return 0;
+      space += segments[i].size;
+    }
+  if(space < (uint64_t)numsectors * 512)
+    return 0;
 
   /* Determine LBA mode */
   if(ide_devices[drive].flags & 0x1)
@@ -418,67 +478,108 @@ int32_t ide_pio_readwrite(uint8_t rw, uint8_t drive, uint64_t lba,
   else
     cmd = IDE_COMMAND_PIO_WRITE;
 
-  /* Reset IRQ counter */
-  ide_channels[channel].irq_wait = 0;
-
-  /* Now, send the command */
   if(lba_mode == 2)
-    {
-      /* LBA48 */
-      cmd += 0x04;
+    cmd += 0x04;
 
-      /* Send it */
-      ide_write(channel, IDE_REGISTER_HDDSEL, (0x40 | (slave << 4)));
-      ide_wait(channel, 0);
-      ide_write(channel, IDE_REGISTER_SECCOUNT0, 0x00);
-      ide_write(channel, IDE_REGISTER_LBA0, (uint8_t)((addr >> 24) & 0xFF));
-      ide_write(channel, IDE_REGISTER_LBA1, (uint8_t)((addr >> 32) & 0xFF));
-      ide_write(channel, IDE_REGISTER_LBA2, (uint8_t)((addr >> 40) & 0xFF));
-    }
-  else if(lba_mode == 1)
+  /* One command per IDE_PIO_MAX_SECTORS sectors, each holding the
+     channel from drive select to the last sector */
+  while(done < numsectors)
     {
-      /* LBA28 */
-      ide_write(channel, IDE_REGISTER_HDDSEL, 
-                0xE0 | (slave << 4) | ((addr & 0x0F000000) >> 24));
+      addr = lba + done;
+      chunk = numsectors - done;
+      if(chunk > IDE_PIO_MAX_SECTORS)
+        chunk = IDE_PIO_MAX_SECTORS;
+
+      ide_channel_lock(channel);
+
+      /* Make sure IRQs are disabled */
+      _outb(bus + IDE_REGISTER_CTRL, 0x02);
+
+      /* Wait for it to acknowledge */
       ide_wait(channel, 0);
-      ide_write(channel, IDE_REGISTER_FEATURES, 0x00);
-    }
 
-  /* Send (rest) of command */
-  ide_write(channel, IDE_REGISTER_SECCOUNT0, (uint8_t)numsectors);
-  ide_write(channel, IDE_REGISTER_LBA0, (uint8_t)(addr & 0xFF));
-  ide_write(channel, IDE_REGISTER_LBA1, (uint8_t)((addr >> 8) & 0xFF));
-  ide_write(channel, IDE_REGISTER_LBA2, (uint8_t)((addr >> 16) & 0xFF));
+      /* Reset IRQ counter */
+      ide_channels[channel].irq_wait = 0;
 
-  /* Command time */
-  ide_write(channel, IDE_REGISTER_COMMAND, cmd);
+      /* Now, send the command */
+      if(lba_mode == 2)
+        {
+          /* LBA48 */
+          ide_write(channel, IDE_REGISTER_HDDSEL, (0x40 | (slave << 4)));
+          ide_wait(channel, 0);
+          ide_write(channel, IDE_REGISTER_SECCOUNT0, 0x00);
+          ide_write(channel, IDE_REGISTER_LBA0, (uint8_t)((addr >> 24) & 0xFF));
+          ide_write(channel, IDE_REGISTER_LBA1, (uint8_t)((addr >> 32) & 0xFF));
+          ide_write(channel, IDE_REGISTER_LBA2, (uint8_t)((addr >> 40) & 0xFF));
+        }
+      else if(lba_mode == 1)
+        {
+          /* LBA28 */
+          ide_write(channel, IDE_REGISTER_HDDSEL, 
+                    0xE0 | (slave << 4) | ((addr & 0x0F000000) >> 24));
+          ide_wait(channel, 0);
+          ide_write(channel, IDE_REGISTER_FEATURES, 0x00);
+        }
 
-  /* Make sure command finished */
-  if(ide_wait(channel, 1) != 0)
-    {
-      kprintf("ide_read_write: Error!");
-      return 0;
-    }
+      /* Send (rest) of command */
+      ide_write(channel, IDE_REGISTER_SECCOUNT0, (uint8_t)chunk);
+      ide_write(channel, IDE_REGISTER_LBA0, (uint8_t)(addr & 0xFF));
+      ide_write(channel, IDE_REGISTER_LBA1, (uint8_t)((addr >> 8) & 0xFF));
+      ide_write(channel, IDE_REGISTER_LBA2, (uint8_t)((addr >> 16) & 0xFF));
 
-  /* Ok all is fine, now its time to read! */
-  if(rw == IDE_READ)
-    {
-      /* Read */
-      _insw(bus + IDE_REGISTER_DATA, (256 * numsectors), buf);
-    }
-  else
-    {
-      /* Write it */
-      _outsw(bus + IDE_REGISTER_DATA, (256 * numsectors), buf);
+      /* Command time */
+      ide_write(channel, IDE_REGISTER_COMMAND, cmd);
+
+      /* The drive asks for each sector separately */
+      for(i = 0; i < chunk; i++)
+        {
+          /* Make sure the drive is ready for the sector */
+          if(ide_wait(channel, 1) != 0)
+            {
+              kprintf("ide_pio_transfer: Error!\n");
+              ide_channel_unlock(channel);
+              return 0;
+            }
+
+          buf = (uint8_t*)(uint64_t)(segments[seg].buf + offset);
+          if(rw == IDE_READ)
+            _insw(bus + IDE_REGISTER_DATA, 256, buf);
+          else
+            _outsw(bus + IDE_REGISTER_DATA, 256, buf);
+
+          /* Move to the next segment when this one is full */
+          offset += 512;
+          if(offset == segments[seg].size)
+            {
+              seg++;
+              offset = 0;
+            }
+        }
 
       /* Flush */
-      _outb(bus + IDE_REGISTER_COMMAND, IDE_COMMAND_FLUSH);
+      if(rw == IDE_WRITE)
+        _outb(bus + IDE_REGISTER_COMMAND, IDE_COMMAND_FLUSH);
+
+      /* Delay, wait for drive to finish */
+      ide_wait(channel, 0);
+
+      ide_channel_unlock(channel);
+
+      done += chunk;
     }
 
-  /* Delay, wait for drive to finish */
-  ide_wait(channel, 0);
+  return (numsectors * 512);
+}
+
+int32_t ide_pio_readwrite(uint8_t rw, uint8_t drive, uint64_t lba, 
+                          uint8_t *buf, uint32_t numsectors)
+{
+  gbd_segment_t segment;
 
-  return (words * 2);
+  segment.buf = (physaddr_t)buf;
+  segment.size = numsectors * 512;
+
+  return ide_pio_transfer(rw, drive, lba, &segment, 1, numsectors);
 }
 
 int ide_read_block(gbd_t *gbd, gbd_request_t *request)
@@ -519,4 +620,45 @@ int ide_write_block(gbd_t *gbd, gbd_request_t *request)
   return ide_pio_readwrite(IDE_WRITE, drive, sector, buf, 1);
 }
 
+/* Checks a multi-block request and transfers it. The transfer is
+   done before returning, so an asynchronous request is completed
+   right away. */
+static int ide_readwrite_blocks(gbd_t *gbd, gbd_request_t *request,
+                                uint8_t rw)
+{
+  /* Get disk */
+  device_t *disk = (device_t*)gbd->device;
+  uint8_t drive = (uint8_t)disk->io_address;
+  uint64_t sector = (uint64_t)request->block;
+  int r;
+
+  /* Sanity checks */
+  if(drive > 3 || ide_devices[drive].present == 0)
+    r = -1;
+  else if(sector + request->count > ide_devices[drive].totalsectors ||
+          ide_devices[drive].type != 0)
+    r = -2;
+  else
+    r = ide_pio_transfer(rw, drive, sector, request->segments,
+                         request->nsegments, request->count);
+
+  if(request->sem != NULL)
+    {
+      request->return_value = (r > 0) ? 0 : -1;
+      semaphore_V(request->sem);
+    }
+
+  return r;
+}
+
+int ide_read_blocks(gbd_t *gbd, gbd_request_t *request)
+{
+  return ide_readwrite_blocks(gbd, request, IDE_READ);
+}
+
+int ide_write_blocks(gbd_t *gbd, gbd_request_t *request)
+{
+  return ide_readwrite_blocks(gbd, request, IDE_WRITE);
+}
+
 /** @} */
@@ -20,12 +20,23 @@
  * @{
  */
 
-/** Get number of timer ticks elapsed since system startup from the
- * system RTC. Returns the number of timer ticks since system startup
+/** Get number of milliseconds elapsed since system startup. There
+ * is no RTC device, the time is kept by the PIT driver.
  *
- * @return Number of timer ticks elapsed
+ * @return Number of milliseconds elapsed
  */
 uint32_t rtc_get_msec()
 {
-    return get_clock(); /* MSEC @0x00 */
+    return pit_get_msec();
+}
+
+/** Get the rate at which timer_set_ticks() counts, in hertz. On MIPS
+ * this is the clock speed of the machine; here it is the rate of the
+ * one-shot PIT timer.
+ *
+ * @return Timer tick rate in Hz
+ */
+uint32_t rtc_get_clockspeed()
+{
+    return PIT_BASE_FREQUENCY >> PIT_ONESHOT_SHIFT;
 }
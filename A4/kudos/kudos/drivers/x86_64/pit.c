@@ -5,13 +5,23 @@
 #include <pit.h>
 #include <asm.h>
 #include <idt.h>
+#include <lapic.h>
 #include "kernel/interrupt.h"
 #include "lib/types.h"
 #include "lib/libc.h"
 #include "drivers/modules.h"
 
 /* Globals */
-volatile uint32_t pit_counter = 0;
+
+/* The PIT only interrupts when a timeslice ends, so it cannot count
+ * time. The time stamp counter is used instead, calibrated against
+ * the PIT at boot. */
+static uint64_t pit_tsc_boot = 0;
+static uint64_t pit_tsc_per_tick = 1; /* TSC cycles per get_clock() tick */
+
+/* PIT clocks of the last timer_set_ticks() request still to go after
+ * the current shot */
+static uint64_t pit_oneshot_left = 0;
 
 /* extern */
 extern void pit_irq_handler(void);
@@ -57,19 +67,136 @@ void pit_start_counter(uint32_t frequency, uint8_t counter, uint8_t mode)
   pit_send_data((uint8_t)((divisor >> 8) & 0xFF), counter);
 }
 
+/* Reads the current count of counter 0 */
+static uint16_t pit_read_counter0(void)
+{
+  uint16_t lo, hi;
+
+  pit_send_command(PIT_CW_MASK_COUNTER0 | PIT_CW_MASK_LATCH);
+  lo = _inb(PIT_COUNTER0_REG);
+  hi = _inb(PIT_COUNTER0_REG);
+
+  return (uint16_t)(lo | (hi << 8));
+}
+
+/* Starts counter 0 counting down from clocks, raising IRQ 0 once
+   when it reaches zero */
+static void pit_start_oneshot(uint16_t clocks)
+{
+  pit_send_command(PIT_CW_MASK_COUNTER0 | PIT_CW_MASK_DATA |
+                   PIT_CW_MASK_COUNTDOWN);
+  pit_send_data((uint8_t)(clocks & 0xFF), PIT_CW_MASK_COUNTER0);
+  pit_send_data((uint8_t)((clocks >> 8) & 0xFF), PIT_CW_MASK_COUNTER0);
+}
+
+/* Measures the TSC rate by letting counter 0 run freely for 50 ms.
+   Interrupts must be disabled. */
+static void pit_calibrate_tsc(void)
+{
+  uint32_t target = (PIT_BASE_FREQUENCY / PIT_FREQUENCY) * 5;
+  uint32_t elapsed = 0;
+  uint16_t prev, cur;
+  uint64_t start;
+
+  /* Rate generator with the longest period, 0 means 65536 */
+  pit_send_command(PIT_CW_MASK_COUNTER0 | PIT_CW_MASK_DATA |
+                   PIT_CW_MASK_RATEGEN);
+  pit_send_data(0, PIT_CW_MASK_COUNTER0);
+  pit_send_data(0, PIT_CW_MASK_COUNTER0);
+
+  prev = pit_read_counter0();
+  start = _rdtsc();
+  while (elapsed < target) {
+    cur = pit_read_counter0();
+    /* Counts down, so this also handles the wrap around */
+    elapsed += (uint16_t)(prev - cur);
+    prev = cur;
+  }
+
+  pit_tsc_per_tick = (_rdtsc() - start) * (PIT_BASE_FREQUENCY / PIT_FREQUENCY)
+                     / elapsed;
+  if (pit_tsc_per_tick == 0)
+    pit_tsc_per_tick = 1;
+  pit_tsc_boot = _rdtsc();
+
+  /* Stop the counter until the first timer_set_ticks() */
+  pit_send_command(PIT_CW_MASK_COUNTER0 | PIT_CW_MASK_DATA |
+                   PIT_CW_MASK_COUNTDOWN);
+}
+
 /* Initialises the PIT */
 void pit_init()
 {
   /* Install interrupt */
   interrupt_register(0, (int_handler_t)pit_irq_handler, 0);
 
-  /* Start counter 0 */
-  pit_start_counter(PIT_FREQUENCY, PIT_CW_MASK_COUNTER0, PIT_CW_MASK_RATEGEN);
+  pit_calibrate_tsc();
+}
+
+/* Backend of timer_set_ticks(): arms counter 0 to interrupt once
+   after the given number of ticks. The PIT only interrupts the first
+   CPU; the others use the timer of their local APIC. */
+void _timer_set_ticks(uint32_t ticks)
+{
+  uint64_t clocks = (uint64_t)ticks << PIT_ONESHOT_SHIFT;
+
+  if (_interrupt_getcpu() != 0) {
+    lapic_timer_set_ticks(ticks);
+    return;
+  }
+
+  if (clocks == 0)
+    clocks = 1;
+
+  pit_oneshot_left = 0;
+  if (clocks > PIT_ONESHOT_MAX) {
+    pit_oneshot_left = clocks - PIT_ONESHOT_MAX;
+    clocks = PIT_ONESHOT_MAX;
+  }
+
+  pit_start_oneshot((uint16_t)clocks);
+}
+
+/* Called by the PIT interrupt handler. If the shot that fired covered
+   only part of the last request, arms the next one and returns 1: the
+   interrupt came early and the scheduler must not see it. Otherwise
+   returns 0. */
+int pit_oneshot_continue(void)
+{
+  uint64_t clocks = pit_oneshot_left;
+
+  if (clocks == 0)
+    return 0;
+
+  if (clocks > PIT_ONESHOT_MAX)
+    clocks = PIT_ONESHOT_MAX;
+  pit_oneshot_left -= clocks;
+
+  pit_start_oneshot((uint16_t)clocks);
+  return 1;
+}
+
+/* Busy-waits for the given number of microseconds. Works with
+   interrupts disabled and before the timer is armed. */
+void pit_delay_us(uint32_t usec)
+{
+  uint64_t start = _rdtsc();
+  uint64_t cycles = (uint64_t)usec * pit_tsc_per_tick * PIT_FREQUENCY / 1000000;
+
+  while (_rdtsc() - start < cycles)
+    asm volatile("pause");
 }
 
 uint32_t get_clock(void)
 {
-  return pit_counter;
+  return (uint32_t)((_rdtsc() - pit_tsc_boot) / pit_tsc_per_tick);
+}
+
+/* Milliseconds since boot */
+uint32_t pit_get_msec(void)
+{
+  return (uint32_t)((_rdtsc() - pit_tsc_boot) * PIT_FREQUENCY / 1000
+                    / pit_tsc_per_tick);
 }
 
 void __attribute__((noinline)) pit_sleepms(uint64_t ms)
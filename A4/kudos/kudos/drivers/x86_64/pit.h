@@ -47,12 +47,23 @@
 #define PIT_CW_MASK_COUNTERINV  0x90
 
 #define PIT_BASE_FREQUENCY      1193181 /* Divide this with the wished frequency */
-#define PIT_FREQUENCY           100 /* 100 Interrupts a second */
+#define PIT_FREQUENCY           100 /* Rate of get_clock() ticks */
+
+/* Counter 0 runs in one-shot mode, armed by timer_set_ticks(). One
+ * timer tick is 2^PIT_ONESHOT_SHIFT PIT clocks (about 13.4 us), so the
+ * default timeslice of 750 ticks is about 10 ms. A single shot lasts
+ * at most 0xFFFF PIT clocks (about 55 ms); longer requests are split
+ * into several shots, see pit_oneshot_continue(). */
+#define PIT_ONESHOT_SHIFT       4
+#define PIT_ONESHOT_MAX         0xFFFF
 
 /* Prototypes */
 void pit_init();
 uint32_t get_clock(void);
+uint32_t pit_get_msec(void);
 void pit_sleepms(uint64_t ms);
+void pit_delay_us(uint32_t usec);
+int pit_oneshot_continue(void);
 
 
 #endif // KUDOS_DRIVERS_X86_64_PIT_H
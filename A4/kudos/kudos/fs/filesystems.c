@@ -150,7 +150,7 @@ fs_t *filesystems_try_all(gbd_t *disk)
   uint8_t i;
 
   /* Go through partitions on disk if any avail */
-  physaddr_t addr = kmalloc(4096);
+  physaddr_t addr = (physaddr_t)kmalloc(4096);
   gbd_request_t req;
 
   /* Setup disk request */
@@ -217,6 +217,6 @@ fs_t *filesystems_try_all(gbd_t *disk)
   /* No match. */
 
  end:
-  physmem_freeblock((void*)addr);
+  kfree((void*)addr);
   return fs;
 }
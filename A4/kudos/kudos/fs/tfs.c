@@ -4,8 +4,13 @@
 
 #include "kernel/stalloc.h"
 #include "kernel/assert.h"
+#include "kernel/interrupt.h"
+#include "kernel/spinlock.h"
+#include "kernel/sleepq.h"
+#include "kernel/thread.h"
 #include "vm/memory.h"
 #include "drivers/gbd.h"
+#include "drivers/bcache.h"
 #include "fs/vfs.h"
 #include "fs/tfs.h"
 #include "lib/libc.h"
@@ -20,11 +25,19 @@
 
 
 /* Data structure used internally by TFS filesystem. This data structure
-   is used by tfs-functions. it is initialized during tfs_init(). Also
-   memory for the buffers is reserved _dynamically_ during init.
+   is used by tfs-functions. it is initialized during tfs_init().
 
-   Buffers are used when reading/writing system or data blocks from/to
-   disk.
+   System and data blocks are read and written through the buffer
+   cache, see drivers/bcache.c.
+
+   Operations on different files run concurrently. The allocation
+   block and the master directory are guarded by lock. Reads and
+   writes take only the data lock of their file, which lets reads of
+   a file share it and gives a write the file alone.
+
+   The disk requests of concurrent operations may reach the driver
+   together; the driver keeps its own commands apart (the IDE driver
+   holds a lock per channel for each command).
 */
 typedef struct {
   /* Total number of blocks of the disk */
@@ -34,21 +47,226 @@ typedef struct {
   /* Pointer to gbd device performing tfs */
   gbd_t          *disk;
 
-  /* lock for mutual exclusion of fs-operations (we support only
-     one operation at a time in any case) */
+  /* lock for the allocation block and the master directory, held by
+     open, create, remove, getfree, filecount and file */
   semaphore_t    *lock;
 
-  /* Buffers for read/write operations on disk. */
-  tfs_inode_t    *buffer_inode;   /* buffer for inode blocks */
-  bitmap_t       *buffer_bat;     /* buffer for allocation block */
-  tfs_direntry_t *buffer_md;      /* buffer for directory block */
+  /* Inodes of the open files, and the spinlock protecting the list
+     and the use counts and data locks of its inodes */
+  struct tfs_open_inode *inodes;
+  spinlock_t     inode_slock;
 } tfs_t;
 
+/* Decoded inode of an open file. TFS gives a file its size and blocks
+   in tfs_create(), and never changes them afterwards, so an open
+   inode is only ever read. */
+typedef struct tfs_open_inode {
+  /* Inode block number */
+  int fileid;
+  /* Number of users: opens of the file and running operations */
+  int refs;
+  /* Set if the file was removed while open */
+  int removed;
+
+  /* Data lock: number of reads of the file going on, and whether a
+     write is. Threads waiting for it sleep on the inode. */
+  int readers;
+  int writer;
+
+  /* Inode contents in host byte order */
+  uint32_t filesize;
+  uint32_t block[TFS_BLOCKS_MAX];
+
+  struct tfs_open_inode *next;
+} tfs_open_inode_t;
+
+/* Size of the memory allocated for one mounted filesystem */
+#define TFS_ALLOC_SIZE (sizeof(fs_t) + sizeof(tfs_t))
+
+/* Cache of the memory of mounted filesystems, created on first mount */
+static kmem_cache_t *tfs_cache = NULL;
+
+/* Returns the open inode of a file with one more user, NULL if the
+   file is not open. The caller holds tfs->inode_slock. */
+static tfs_open_inode_t *tfs_inode_find(tfs_t *tfs, int fileid)
+{
+  tfs_open_inode_t *inode;
+
+  for(inode = tfs->inodes; inode != NULL; inode = inode->next) {
+    if(inode->fileid == fileid && !inode->removed) {
+      inode->refs++;
+      return inode;
+    }
+  }
+
+  return NULL;
+}
+
+/* Drops a user of an open inode, and takes the inode off the list
+   after the last one. Returns 1 if the caller must free the inode.
+   The caller holds tfs->inode_slock. */
+static int tfs_inode_drop(tfs_t *tfs, tfs_open_inode_t *inode)
+{
+  tfs_open_inode_t **link;
+
+  if(--inode->refs > 0)
+    return 0;
+
+  for(link = &tfs->inodes; *link != inode; link = &(*link)->next)
+    ;
+  *link = inode->next;
+  return 1;
+}
+
+/* Returns the decoded inode of a file with one more user, reading it
+   if the file is not open. NULL if the inode could not be read. */
+static tfs_open_inode_t *tfs_inode_get(tfs_t *tfs, int fileid)
+{
+  interrupt_status_t intr_status;
+  tfs_open_inode_t *inode, *found;
+  tfs_inode_t *disk_inode;
+  bcache_buf_t *buf;
+  uint32_t i;
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&tfs->inode_slock);
+  inode = tfs_inode_find(tfs, fileid);
+  spinlock_release(&tfs->inode_slock);
+  _interrupt_set_state(intr_status);
+
+  if(inode != NULL)
+    return inode;
+
+  /* Reading may sleep, so decode the inode without the spinlock */
+  buf = bcache_read(tfs->disk, tfs->startblock + fileid);
+  if(buf == NULL)
+    return NULL;
+  disk_inode = (tfs_inode_t *)buf->data;
+
+  inode = kmalloc(sizeof(tfs_open_inode_t));
+  if(inode == NULL) {
+    bcache_release(buf);
+    return NULL;
+  }
+  inode->fileid = fileid;
+  inode->refs = 1;
+  inode->removed = 0;
+  inode->readers = 0;
+  inode->writer = 0;
+  inode->filesize = from_big_endian32(disk_inode->filesize);
+  for(i = 0; i < TFS_BLOCKS_MAX; i++)
+    inode->block[i] = from_big_endian32(disk_inode->block[i]);
+  bcache_release(buf);
+
+  /* Another thread may have decoded it meanwhile */
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&tfs->inode_slock);
+  found = tfs_inode_find(tfs, fileid);
+  if(found == NULL) {
+    inode->next = tfs->inodes;
+    tfs->inodes = inode;
+  }
+  spinlock_release(&tfs->inode_slock);
+  _interrupt_set_state(intr_status);
+
+  if(found != NULL) {
+    kfree(inode);
+    inode = found;
+  }
+  return inode;
+}
+
+/* Drops a user of a decoded inode, freeing it after the last one. */
+static void tfs_inode_put(tfs_t *tfs, tfs_open_inode_t *inode)
+{
+  interrupt_status_t intr_status;
+  int last;
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&tfs->inode_slock);
+  last = tfs_inode_drop(tfs, inode);
+  spinlock_release(&tfs->inode_slock);
+  _interrupt_set_state(intr_status);
+
+  if(last)
+    kfree(inode);
+}
+
+/* Takes the data lock of a file, shared with other reads unless
+   write is set. */
+static void tfs_inode_lock(tfs_t *tfs, tfs_open_inode_t *inode, int write)
+{
+  interrupt_status_t intr_status;
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&tfs->inode_slock);
+
+  while(inode->writer || (write && inode->readers > 0)) {
+    sleepq_add(inode);
+    spinlock_release(&tfs->inode_slock);
+    thread_switch();
+    spinlock_acquire(&tfs->inode_slock);
+  }
+
+  if(write)
+    inode->writer = 1;
+  else
+    inode->readers++;
+
+  spinlock_release(&tfs->inode_slock);
+  _interrupt_set_state(intr_status);
+}
+
+/* Releases the data lock of a file taken by tfs_inode_lock(). */
+static void tfs_inode_unlock(tfs_t *tfs, tfs_open_inode_t *inode)
+{
+  interrupt_status_t intr_status;
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&tfs->inode_slock);
+
+  if(inode->writer)
+    inode->writer = 0;
+  else
+    inode->readers--;
+
+  if(inode->readers == 0)
+    sleepq_wake_all(inode);
+
+  spinlock_release(&tfs->inode_slock);
+  _interrupt_set_state(intr_status);
+}
+
+/* Reads blocks first to last of an open file into the buffer cache,
+   with one disk request for each run of blocks that lie one after
+   another on the disk. If async is set, only starts the reads.
+   Failures are left for bcache_read() to see. */
+static void tfs_prefetch(tfs_t *tfs, tfs_open_inode_t *inode,
+                         int first, int last, int async)
+{
+  int run;
+
+  while(first <= last) {
+    run = 1;
+    while(first + run <= last &&
+          inode->block[first + run] == inode->block[first] + run)
+      run++;
+
+    if(async)
+      bcache_readahead(tfs->disk, tfs->startblock + inode->block[first],
+                       run);
+    else if(run > 1)
+      bcache_prefetch(tfs->disk, tfs->startblock + inode->block[first],
+                      run);
+    first += run;
+  }
+}
+
 /**
- * Initialize trivial filesystem. Allocates 1 page of memory dynamically for
- * filesystem data structure, tfs data structure and buffers needed.
- * Sets fs_t and tfs_t fields. If initialization is succesful, returns
- * pointer to fs_t data structure. Else NULL pointer is returned.
+ * Initialize trivial filesystem. Allocates memory dynamically for
+ * filesystem data structure and tfs data structure. Sets fs_t and
+ * tfs_t fields. If initialization is succesful, returns pointer to
+ * fs_t data structure. Else NULL pointer is returned.
  *
  * @param Pointer to gbd-device performing tfs.
  *
@@ -58,73 +276,57 @@ typedef struct {
 fs_t * tfs_init(gbd_t *disk, uint32_t sector)
 {
   physaddr_t addr;
-  gbd_request_t req;
-  uint16_t magic;
+  bcache_buf_t *header;
+  uint32_t magic;
   char name[TFS_VOLNAME_MAX];
   fs_t *fs;
   tfs_t *tfs;
-  int r;
   semaphore_t *sem;
 
   if(disk->block_size(disk) != TFS_BLOCK_SIZE)
     return NULL;
 
-  /* check semaphore availability before memory allocation */
-  sem = semaphore_create(1);
-  if (sem == NULL) {
-    kprintf("tfs_init: could not create a new semaphore.\n");
+  /* Read header block, and make sure this is tfs drive */
+  header = bcache_read(disk, sector + TFS_HEADER_BLOCK);
+  if(header == NULL) {
+    kprintf("tfs_init: Error during disk read. Initialization failed.\n");
     return NULL;
   }
 
-  addr = kmalloc(4096);
+  /* Get magic */
+  magic = from_big_endian32(*(uint32_t *)header->data);
 
-  if(addr == 0) {
-    semaphore_destroy(sem);
-    kprintf("tfs_init: could not allocate memory.\n");
+  if(magic != TFS_MAGIC) {
+    bcache_release(header);
     return NULL;
   }
-  addr = ADDR_PHYS_TO_KERNEL(addr);      /* transform to vm address */
 
-  /* Assert that one page is enough */
-  KERNEL_ASSERT(PAGE_SIZE >= (3*TFS_BLOCK_SIZE+sizeof(tfs_t)+sizeof(fs_t)));
-
-  /* Read header block, and make sure this is tfs drive */
-  req.block = sector + TFS_HEADER_BLOCK;
-  req.sem = NULL;
-  req.buf = ADDR_KERNEL_TO_PHYS(addr);   /* disk needs physical addr */
+  /* Copy volume name from header block. */
+  stringcopy(name, (char *)header->data + 4, TFS_VOLNAME_MAX);
+  bcache_release(header);
 
-  r = disk->read_block(disk, &req);
-  if(r == 0) {
-    semaphore_destroy(sem);
-    //NEED kfree function here
-    //physmem_freeblock((physaddr_t*)ADDR_KERNEL_TO_PHYS(addr));
-    kprintf("tfs_init: Error during disk read. Initialization failed.\n");
+  /* check semaphore availability before memory allocation */
+  sem = semaphore_create(1);
+  if (sem == NULL) {
+    kprintf("tfs_init: could not create a new semaphore.\n");
     return NULL;
   }
 
-  /* Get magic */
-  magic = from_big_endian32((*(uintptr_t*)addr));
+  if (tfs_cache == NULL)
+    tfs_cache = kmem_cache_create("tfs", TFS_ALLOC_SIZE);
+  addr = (physaddr_t)kmem_cache_alloc(tfs_cache);
 
-  if(magic != TFS_MAGIC) {
+  if(addr == 0) {
     semaphore_destroy(sem);
-    //NEED kfree function here
-    //physmem_freeblock((physaddr_t*)ADDR_KERNEL_TO_PHYS(addr));
+    kprintf("tfs_init: could not allocate memory.\n");
     return NULL;
   }
+  addr = ADDR_PHYS_TO_KERNEL(addr);      /* transform to vm address */
 
-  /* Copy volume name from header block. */
-  stringcopy(name, (char *)(addr+4), TFS_VOLNAME_MAX);
-
-  /* fs_t, tfs_t and all buffers in tfs_t fit in one page, so obtain
-     addresses for each structure and buffer inside the allocated
-     memory page. */
+  /* fs_t and tfs_t are allocated together, so obtain addresses for
+     each structure inside the allocated memory. */
   fs  = (fs_t *)addr;
   tfs = (tfs_t *)(addr + sizeof(fs_t));
-  tfs->buffer_inode = (tfs_inode_t *)(uintptr_t)((uintptr_t)tfs + sizeof(tfs_t));
-  tfs->buffer_bat  = (bitmap_t *)(uintptr_t)((uintptr_t)tfs->buffer_inode +
-                                          TFS_BLOCK_SIZE);
-  tfs->buffer_md   = (tfs_direntry_t *)((uintptr_t)tfs->buffer_bat +
-                                        TFS_BLOCK_SIZE);
 
   tfs->startblock  = sector;
   tfs->totalblocks = MIN(disk->total_blocks(disk), 8*TFS_BLOCK_SIZE);
@@ -132,6 +334,8 @@ fs_t * tfs_init(gbd_t *disk, uint32_t sector)
 
   /* save the semaphore to the tfs_t */
   tfs->lock = sem;
+  tfs->inodes = NULL;
+  spinlock_reset(&tfs->inode_slock);
 
   fs->internal = (void *)tfs;
   stringcopy(fs->volume_name, name, VFS_NAME_LENGTH);
@@ -146,6 +350,7 @@ fs_t * tfs_init(gbd_t *disk, uint32_t sector)
   fs->getfree  = tfs_getfree;
   fs->filecount = tfs_filecount;
   fs->file      = tfs_file;
+  fs->readahead = tfs_readahead;
 
   return fs;
 }
@@ -154,33 +359,44 @@ fs_t * tfs_init(gbd_t *disk, uint32_t sector)
 /**
  * Unmounts tfs filesystem from gbd device. After this TFS-driver and
  * gbd-device are no longer linked together. Implements
- * fs.unmount(). Waits for the current operation(s) to finish, frees
- * reserved memory and returns OK.
+ * fs.unmount(). Waits for the current operation(s) to finish, writes
+ * the changed blocks of the filesystem to the disk, frees reserved
+ * memory and returns OK.
  *
  * @param fs Pointer to fs data structure of the device.
  *
- * @return VFS_OK
+ * @return VFS_OK, or VFS_ERROR if writing changed blocks failed.
  */
 int tfs_unmount(fs_t *fs)
 {
   tfs_t *tfs;
+  int r;
 
   tfs = (tfs_t *)fs->internal;
 
   semaphore_P(tfs->lock); /* The semaphore should be free at this
                              point, we get it just in case something has gone wrong. */
 
+  r = bcache_invalidate(tfs->disk);
+
+  /* Files still open are closed by force */
+  while(tfs->inodes != NULL) {
+    tfs_open_inode_t *inode = tfs->inodes;
+    tfs->inodes = inode->next;
+    kfree(inode);
+  }
+
   /* free semaphore and allocated memory */
   semaphore_destroy(tfs->lock);
-  //NEED kfree function here
-  //physmem_freeblock((void*)(uintptr_t)ADDR_KERNEL_TO_PHYS((uintptr_t)fs));
-  return VFS_OK;
+  kmem_cache_free(tfs_cache, fs);
+  return r == 0 ? VFS_OK : VFS_ERROR;
 }
 
 
 /**
  * Opens file. Implements fs.open(). Reads directory block of tfs
- * device and finds given file. Returns file's inode block number or
+ * device and finds given file, and keeps its inode in memory until
+ * the file is closed. Returns file's inode block number or
  * VFS_NOT_FOUND, if file not found.
  *
  * @param fs Pointer to fs data structure of the device.
@@ -192,31 +408,35 @@ int tfs_unmount(fs_t *fs)
 int tfs_open(fs_t *fs, char *filename)
 {
   tfs_t *tfs;
-  gbd_request_t req;
+  bcache_buf_t *buf;
+  tfs_direntry_t *md;
   uint32_t i;
-  int r;
+  int fileid;
 
   tfs = (tfs_t *)fs->internal;
 
   semaphore_P(tfs->lock);
 
-  req.block     = tfs->startblock + TFS_DIRECTORY_BLOCK;
-  req.buf       = ADDR_KERNEL_TO_PHYS((uintptr_t)tfs->buffer_md);
-  req.sem       = NULL;
-  r = tfs->disk->read_block(tfs->disk,&req);
-  if(r == 0) {
+  buf = bcache_read(tfs->disk, tfs->startblock + TFS_DIRECTORY_BLOCK);
+  if(buf == NULL) {
     /* An error occured during read. */
     kprintf("tfs_open: read error at block 0x%x\n", TFS_DIRECTORY_BLOCK);
     semaphore_V(tfs->lock);
     return VFS_ERROR;
   }
+  md = (tfs_direntry_t *)buf->data;
 
   for(i=0;i < TFS_MAX_FILES;i++) {
-    if(stringcmp(tfs->buffer_md[i].name, filename) == 0) {
+    if(stringcmp(md[i].name, filename) == 0) {
+      fileid = from_big_endian32(md[i].inode);
+      bcache_release(buf);
+      if(tfs_inode_get(tfs, fileid) == NULL)
+        fileid = VFS_ERROR;
       semaphore_V(tfs->lock);
-      return from_big_endian32(tfs->buffer_md[i].inode);
+      return fileid;
     }
   }
+  bcache_release(buf);
   kprintf("tfs_open: file not found\n");
   semaphore_V(tfs->lock);
   return VFS_NOT_FOUND;
@@ -224,8 +444,8 @@ int tfs_open(fs_t *fs, char *filename)
 
 
 /**
- * Closes file. Implements fs.close(). There is nothing to be done, no
- * data strucutures or similar are reserved for file. Returns VFS_OK.
+ * Closes file. Implements fs.close(). Drops the inode kept in memory
+ * by tfs_open() after the last close of the file. Returns VFS_OK.
  *
  * @param fs Pointer to fs data structure of the device.
  * @param fileid File id (inode block number) of the file.
@@ -234,9 +454,28 @@ int tfs_open(fs_t *fs, char *filename)
  */
 int tfs_close(fs_t *fs, int fileid)
 {
-  fs = fs;
-  fileid = fileid;
+  tfs_t *tfs = (tfs_t *)fs->internal;
+  tfs_open_inode_t *inode, *found = NULL;
+  interrupt_status_t intr_status;
+  int last = 0;
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&tfs->inode_slock);
+
+  /* A file removed while open may share its fileid with a newer file;
+     let its inode go first */
+  for(inode = tfs->inodes; inode != NULL; inode = inode->next) {
+    if(inode->fileid == fileid && (found == NULL || inode->removed))
+      found = inode;
+  }
+  if(found != NULL)
+    last = tfs_inode_drop(tfs, found);
 
+  spinlock_release(&tfs->inode_slock);
+  _interrupt_set_state(intr_status);
+
+  if(last)
+    kfree(found);
   return VFS_OK;
 }
 
@@ -257,11 +496,14 @@ int tfs_close(fs_t *fs, int fileid)
 int tfs_create(fs_t *fs, char *filename, int size)
 {
   tfs_t *tfs = (tfs_t *)fs->internal;
-  gbd_request_t req;
-  uint32_t i;
+  bcache_buf_t *buf_md, *buf_bat, *buf_inode, *buf;
+  tfs_direntry_t *md;
+  bitmap_t *bat;
+  tfs_inode_t *inode;
+  uint32_t i, j;
   uint32_t numblocks = (size + TFS_BLOCK_SIZE - 1)/TFS_BLOCK_SIZE;
   int index = -1;
-  int r;
+  int inode_block, block;
 
   semaphore_P(tfs->lock);
 
@@ -272,23 +514,22 @@ int tfs_create(fs_t *fs, char *filename, int size)
 
   /* Read directory block. Check that file doesn't allready exist and
      there is space left for the file in directory block. */
-  req.block = tfs->startblock + TFS_DIRECTORY_BLOCK;
-  req.buf = ADDR_KERNEL_TO_PHYS((uintptr_t)tfs->buffer_md);
-  req.sem = NULL;
-  r = tfs->disk->read_block(tfs->disk, &req);
-  if(r == 0) {
+  buf_md = bcache_read(tfs->disk, tfs->startblock + TFS_DIRECTORY_BLOCK);
+  if(buf_md == NULL) {
     /* An error occured. */
     semaphore_V(tfs->lock);
     return VFS_ERROR;
   }
+  md = (tfs_direntry_t *)buf_md->data;
 
   for(i=0;i<TFS_MAX_FILES;i++) {
-    if(stringcmp(tfs->buffer_md[i].name, filename) == 0) {
+    if(stringcmp(md[i].name, filename) == 0) {
+      bcache_release(buf_md);
       semaphore_V(tfs->lock);
       return VFS_ERROR;
     }
 
-    if(from_big_endian32(tfs->buffer_md[i].inode) == 0) {
+    if(from_big_endian32(md[i].inode) == 0) {
       /* found free slot from directory */
       index = i;
     }
@@ -296,96 +537,75 @@ int tfs_create(fs_t *fs, char *filename, int size)
 
   if(index == -1) {
     /* there was no space in directory, because index is not set */
+    bcache_release(buf_md);
     semaphore_V(tfs->lock);
     return VFS_ERROR;
   }
 
-  stringcopy(tfs->buffer_md[index].name,filename, TFS_FILENAME_MAX);
-
   /* Read allocation block and... */
-  req.block = tfs->startblock + TFS_ALLOCATION_BLOCK;
-  req.buf = ADDR_KERNEL_TO_PHYS((uintptr_t)tfs->buffer_bat);
-  req.sem = NULL;
-  r = tfs->disk->read_block(tfs->disk, &req);
-  if(r==0) {
+  buf_bat = bcache_read(tfs->disk, tfs->startblock + TFS_ALLOCATION_BLOCK);
+  if(buf_bat == NULL) {
     /* An error occured. */
+    bcache_release(buf_md);
     semaphore_V(tfs->lock);
     return VFS_ERROR;
   }
-
+  bat = (bitmap_t *)buf_bat->data;
 
   /* ...find space for inode... */
-  tfs->buffer_md[index].inode = bitmap_findnset(tfs->buffer_bat,
-                                                tfs->totalblocks);
-
-  if((int)(from_big_endian32(tfs->buffer_md[index].inode)) == -1) {
+  inode_block = bitmap_findnset(bat, tfs->totalblocks);
+  if(inode_block == -1) {
+    bcache_release(buf_bat);
+    bcache_release(buf_md);
     semaphore_V(tfs->lock);
     return VFS_ERROR;
   }
 
   /* ...and the rest of the blocks. Mark found block numbers in
-     inode.*/
-  tfs->buffer_inode->filesize = from_big_endian32(size);
+     inode. The inode block is new, so it need not be read. */
+  buf_inode = bcache_get(tfs->disk, tfs->startblock + inode_block);
+  inode = (tfs_inode_t *)buf_inode->data;
+  inode->filesize = from_big_endian32(size);
   for(i=0; i<numblocks; i++) {
-    tfs->buffer_inode->block[i] = from_big_endian32(bitmap_findnset(tfs->buffer_bat,
-                                                                    tfs->totalblocks));
-    if((int)from_big_endian32(tfs->buffer_inode->block[i]) == -1) {
-      /* Disk full. No free block found. */
+    block = bitmap_findnset(bat, tfs->totalblocks);
+    if(block == -1) {
+      /* Disk full. No free block found. Give the blocks back, the
+         cached allocation block must stay as it was. */
+      for(j=0; j<i; j++)
+        bitmap_set(bat, from_big_endian32(inode->block[j]), 0);
+      bitmap_set(bat, inode_block, 0);
+      bcache_release(buf_inode);
+      bcache_release(buf_bat);
+      bcache_release(buf_md);
       semaphore_V(tfs->lock);
       return VFS_ERROR;
     }
+    inode->block[i] = from_big_endian32(block);
   }
 
   /* Mark rest of the blocks in inode as unused. */
   while(i < (TFS_BLOCK_SIZE / 4 - 1))
-    tfs->buffer_inode->block[i++] = 0;
-
-  req.block = tfs->startblock + TFS_ALLOCATION_BLOCK;
-  req.buf   = ADDR_KERNEL_TO_PHYS((uintptr_t)tfs->buffer_bat);
-  req.sem   = NULL;
-  r = tfs->disk->write_block(tfs->disk, &req);
-  if(r==0) {
-    /* An error occured. */
-    semaphore_V(tfs->lock);
-    return VFS_ERROR;
-  }
+    inode->block[i++] = 0;
 
-  req.block = tfs->startblock + TFS_DIRECTORY_BLOCK;
-  req.buf   = ADDR_KERNEL_TO_PHYS((uintptr_t)tfs->buffer_md);
-  req.sem   = NULL;
-  r = tfs->disk->write_block(tfs->disk, &req);
-  if(r==0) {
-    /* An error occured. */
-    semaphore_V(tfs->lock);
-    return VFS_ERROR;
-  }
+  stringcopy(md[index].name, filename, TFS_FILENAME_MAX);
+  md[index].inode = from_big_endian32(inode_block);
 
-  req.block = tfs->startblock + from_big_endian32(tfs->buffer_md[index].inode);
-  req.buf   = ADDR_KERNEL_TO_PHYS((uintptr_t)tfs->buffer_inode);
-  req.sem   = NULL;
-  r = tfs->disk->write_block(tfs->disk, &req);
-  if(r==0) {
-    /* An error occured. */
-    semaphore_V(tfs->lock);
-    return VFS_ERROR;
-  }
+  bcache_dirty(buf_bat);
+  bcache_dirty(buf_md);
+  bcache_dirty(buf_inode);
+  bcache_release(buf_bat);
+  bcache_release(buf_md);
 
-  /* Write zeros to the reserved blocks. Buffer for allocation block
-     is no longer needed, so lets use it as zero buffer. */
-  memoryset(tfs->buffer_bat, 0, TFS_BLOCK_SIZE);
+  /* Write zeros to the reserved blocks. */
   for(i=0;i<numblocks;i++) {
-    req.block = tfs->startblock + from_big_endian32(tfs->buffer_inode->block[i]);
-    req.buf   = ADDR_KERNEL_TO_PHYS((uintptr_t)tfs->buffer_bat);
-    req.sem   = NULL;
-    r = tfs->disk->write_block(tfs->disk, &req);
-    if(r==0) {
-      /* An error occured. */
-      semaphore_V(tfs->lock);
-      return VFS_ERROR;
-    }
-
+    buf = bcache_get(tfs->disk,
+                     tfs->startblock + from_big_endian32(inode->block[i]));
+    memoryset(buf->data, 0, TFS_BLOCK_SIZE);
+    bcache_dirty(buf);
+    bcache_release(buf);
   }
 
+  bcache_release(buf_inode);
   semaphore_V(tfs->lock);
   return VFS_OK;
 }
@@ -403,90 +623,90 @@ int tfs_create(fs_t *fs, char *filename, int size)
 int tfs_remove(fs_t *fs, char *filename)
 {
   tfs_t *tfs = (tfs_t *)fs->internal;
-  gbd_request_t req;
+  bcache_buf_t *buf_md, *buf_bat, *buf_inode;
+  tfs_direntry_t *md;
+  bitmap_t *bat;
+  tfs_inode_t *inode;
+  tfs_open_inode_t *open_inode;
+  interrupt_status_t intr_status;
   uint32_t i;
   int index = -1;
-  int r;
 
   semaphore_P(tfs->lock);
 
   /* Find file and inode block number from directory block.
      If not found return VFS_NOT_FOUND. */
-  req.block = tfs->startblock + TFS_DIRECTORY_BLOCK;
-  req.buf = ADDR_KERNEL_TO_PHYS((uintptr_t)tfs->buffer_md);
-  req.sem = NULL;
-  r = tfs->disk->read_block(tfs->disk, &req);
-  if(r == 0) {
+  buf_md = bcache_read(tfs->disk, tfs->startblock + TFS_DIRECTORY_BLOCK);
+  if(buf_md == NULL) {
     /* An error occured. */
     semaphore_V(tfs->lock);
     return VFS_ERROR;
   }
+  md = (tfs_direntry_t *)buf_md->data;
 
   for(i=0;i<TFS_MAX_FILES;i++) {
-    if(stringcmp(tfs->buffer_md[i].name, filename) == 0) {
+    if(stringcmp(md[i].name, filename) == 0) {
       index = i;
       break;
     }
   }
   if(index == -1) {
+    bcache_release(buf_md);
     semaphore_V(tfs->lock);
     return VFS_NOT_FOUND;
   }
 
   /* Read allocation block of the device and inode block of the file.
      Free reserved blocks (marked in inode) from allocation block. */
-  req.block = tfs->startblock + TFS_ALLOCATION_BLOCK;
-  req.buf = ADDR_KERNEL_TO_PHYS((uintptr_t)tfs->buffer_bat);
-  req.sem = NULL;
-  r = tfs->disk->read_block(tfs->disk, &req);
-  if(r == 0) {
+  buf_bat = bcache_read(tfs->disk, tfs->startblock + TFS_ALLOCATION_BLOCK);
+  if(buf_bat == NULL) {
     /* An error occured. */
+    bcache_release(buf_md);
     semaphore_V(tfs->lock);
     return VFS_ERROR;
   }
+  bat = (bitmap_t *)buf_bat->data;
 
-  req.block = tfs->startblock + from_big_endian32(tfs->buffer_md[index].inode);
-  req.buf = ADDR_KERNEL_TO_PHYS((uintptr_t)tfs->buffer_inode);
-  req.sem = NULL;
-  r = tfs->disk->read_block(tfs->disk, &req);
-  if(r == 0) {
+  buf_inode = bcache_read(tfs->disk,
+                          tfs->startblock + from_big_endian32(md[index].inode));
+  if(buf_inode == NULL) {
     /* An error occured. */
+    bcache_release(buf_bat);
+    bcache_release(buf_md);
     semaphore_V(tfs->lock);
     return VFS_ERROR;
   }
+  inode = (tfs_inode_t *)buf_inode->data;
+
+  /* The inode block may be reused by a new file, which must not get
+     the inode of this one */
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&tfs->inode_slock);
+  for(open_inode = tfs->inodes; open_inode != NULL;
+      open_inode = open_inode->next) {
+    if(open_inode->fileid == (int)from_big_endian32(md[index].inode))
+      open_inode->removed = 1;
+  }
+  spinlock_release(&tfs->inode_slock);
+  _interrupt_set_state(intr_status);
 
-
-  bitmap_set(tfs->buffer_bat, from_big_endian32(tfs->buffer_md[index].inode),0);
+  bitmap_set(bat, from_big_endian32(md[index].inode),0);
   i=0;
-  while(from_big_endian32(tfs->buffer_inode->block[i]) != 0 &&
-        i < (TFS_BLOCK_SIZE / 4 - 1)) {
-    bitmap_set(tfs->buffer_bat, from_big_endian32(tfs->buffer_inode->block[i]),0);
+  while(i < (TFS_BLOCK_SIZE / 4 - 1) &&
+        from_big_endian32(inode->block[i]) != 0) {
+    bitmap_set(bat, from_big_endian32(inode->block[i]),0);
     i++;
   }
+  bcache_release(buf_inode);
 
   /* Free directory entry. */
-  tfs->buffer_md[index].inode   = 0;
-  tfs->buffer_md[index].name[0] = 0;
-
-  req.block = tfs->startblock + TFS_ALLOCATION_BLOCK;
-  req.buf   = ADDR_KERNEL_TO_PHYS((uintptr_t)tfs->buffer_bat);
-  req.sem   = NULL;
-  r = tfs->disk->write_block(tfs->disk, &req);
-  if(r == 0) {
-    /* An error occured. */
-    semaphore_V(tfs->lock);
-    return VFS_ERROR;
-  }
+  md[index].inode   = 0;
+  md[index].name[0] = 0;
 
-  req.block = tfs->startblock + TFS_DIRECTORY_BLOCK;
-  req.buf   = ADDR_KERNEL_TO_PHYS((uintptr_t)tfs->buffer_md);
-  req.sem   = NULL;
-  r = tfs->disk->write_block(tfs->disk, &req);
-  if(r == 0) {
-    /* An error occured. */
-    semaphore_V(tfs->lock);
-    return VFS_ERROR;
-  }
+  bcache_dirty(buf_bat);
+  bcache_dirty(buf_md);
+  bcache_release(buf_bat);
+  bcache_release(buf_md);
 
   semaphore_V(tfs->lock);
   return VFS_OK;
@@ -511,42 +731,39 @@ int tfs_remove(fs_t *fs, char *filename)
 int tfs_read(fs_t *fs, int fileid, void *buffer, int bufsize, int offset)
 {
   tfs_t *tfs = (tfs_t *)fs->internal;
-  gbd_request_t req;
+  bcache_buf_t *buf;
+  tfs_open_inode_t *inode;
   int b1, b2;
   int read=0;
-  int r;
-
-  semaphore_P(tfs->lock);
+  int count;
 
   /* fileid is blocknum so ensure that we don't read system blocks
      or outside the disk */
 
   if(fileid < 2 || fileid > (int)tfs->totalblocks) {
-    semaphore_V(tfs->lock);
     return VFS_ERROR;
   }
 
-  req.block = tfs->startblock + fileid;
-  req.buf   = ADDR_KERNEL_TO_PHYS((uintptr_t)tfs->buffer_inode);
-  req.sem   = NULL;
-  r = tfs->disk->read_block(tfs->disk, &req);
-  if(r == 0) {
+  inode = tfs_inode_get(tfs, fileid);
+  if(inode == NULL) {
     /* An error occured. */
-    semaphore_V(tfs->lock);
     return VFS_ERROR;
   }
+  tfs_inode_lock(tfs, inode, 0);
 
   /* Check that offset is inside the file */
-  if(offset < 0 || offset > (int)from_big_endian32(tfs->buffer_inode->filesize)) {
-    semaphore_V(tfs->lock);
+  if(offset < 0 || offset > (int)inode->filesize) {
+    tfs_inode_unlock(tfs, inode);
+    tfs_inode_put(tfs, inode);
     return VFS_ERROR;
   }
 
   /* Read at most what is left from the file. */
-  bufsize = MIN(bufsize,((int)from_big_endian32(tfs->buffer_inode->filesize)) - offset);
+  bufsize = MIN(bufsize,((int)inode->filesize) - offset);
 
   if(bufsize==0) {
-    semaphore_V(tfs->lock);
+    tfs_inode_unlock(tfs, inode);
+    tfs_inode_put(tfs, inode);
     return 0;
   }
 
@@ -556,63 +773,80 @@ int tfs_read(fs_t *fs, int fileid, void *buffer, int bufsize, int offset)
   /* last block to be read from the disk */
   b2 = (offset+bufsize-1) / TFS_BLOCK_SIZE;
 
-  /* Read blocks from b1 to b2. First and last are
-     special cases because whole block might not be written
-     to the buffer. */
-  req.block = tfs->startblock + from_big_endian32(tfs->buffer_inode->block[b1]);
-  req.buf   = ADDR_KERNEL_TO_PHYS((uintptr_t)tfs->buffer_bat);
-  req.sem   = NULL;
-  r = tfs->disk->read_block(tfs->disk, &req);
-  if(r == 0) {
-    /* An error occured. */
-    semaphore_V(tfs->lock);
-    return VFS_ERROR;
-  }
-
-  /* Count the number of the bytes to be read from the block and
-     written to the buffer from the first block. */
-  read = MIN(TFS_BLOCK_SIZE - (offset % TFS_BLOCK_SIZE), bufsize);
-  memcopy(read,
-          buffer,
-          (const uint32_t *)(((uintptr_t)tfs->buffer_bat) +
-                             (offset % TFS_BLOCK_SIZE)));
+  tfs_prefetch(tfs, inode, b1, b2, 0);
 
-  buffer = (void *)((uintptr_t)buffer + read);
-  b1++;
+  /* Read blocks from b1 to b2. First and last might not be
+     read whole. */
   while(b1 <= b2) {
-    req.block = tfs->startblock + from_big_endian32(tfs->buffer_inode->block[b1]);
-    req.buf   = ADDR_KERNEL_TO_PHYS((uintptr_t)tfs->buffer_bat);
-    req.sem   = NULL;
-    r = tfs->disk->read_block(tfs->disk, &req);
-    if(r == 0) {
+    buf = bcache_read(tfs->disk,
+                      tfs->startblock + inode->block[b1]);
+    if(buf == NULL) {
       /* An error occured. */
-      semaphore_V(tfs->lock);
+      tfs_inode_unlock(tfs, inode);
+      tfs_inode_put(tfs, inode);
       return VFS_ERROR;
     }
 
-    if(b1 == b2) {
-      /* Last block. Whole block might not be read.*/
-      memcopy(bufsize - read,
-              buffer,
-              (const uint32_t *)(uintptr_t)tfs->buffer_bat);
-      read += (bufsize - read);
-    }
-    else {
-      /* Read whole block */
-      memcopy(TFS_BLOCK_SIZE,
-              buffer,
-              (const uint32_t *)tfs->buffer_bat);
-      read += TFS_BLOCK_SIZE;
-      buffer = (void *)((uintptr_t)buffer + TFS_BLOCK_SIZE);
-    }
+    count = MIN(TFS_BLOCK_SIZE - ((offset + read) % TFS_BLOCK_SIZE),
+                bufsize - read);
+    memcopy(count,
+            (void *)((uintptr_t)buffer + read),
+            (const void *)((uintptr_t)buf->data +
+                           ((offset + read) % TFS_BLOCK_SIZE)));
+    bcache_release(buf);
+
+    read += count;
     b1++;
   }
 
-  semaphore_V(tfs->lock);
+  tfs_inode_unlock(tfs, inode);
+  tfs_inode_put(tfs, inode);
   return read;
 }
 
 
+/**
+ * Starts reading bytes bytes of an open file from offset into the
+ * buffer cache, without waiting for the disk. Implements fs's
+ * readahead() function.
+ *
+ * @param fs Pointer to fs data structure of the device.
+ *
+ * @param fileid Open file.
+ *
+ * @param offset Start reading from this offset of the file.
+ *
+ * @param bytes How many bytes to read ahead.
+ *
+ * @return VFS_OK, or VFS_ERROR if the file could not be found.
+ */
+int tfs_readahead(fs_t *fs, int fileid, int offset, int bytes)
+{
+  tfs_t *tfs = (tfs_t *)fs->internal;
+  tfs_open_inode_t *inode;
+
+  if(fileid < 2 || fileid > (int)tfs->totalblocks) {
+    return VFS_ERROR;
+  }
+
+  inode = tfs_inode_get(tfs, fileid);
+  if(inode == NULL) {
+    return VFS_ERROR;
+  }
+
+  /* Read ahead at most what is left from the file. */
+  if(offset >= 0 && offset < (int)inode->filesize) {
+    bytes = MIN(bytes, ((int)inode->filesize) - offset);
+    if(bytes > 0)
+      tfs_prefetch(tfs, inode, offset / TFS_BLOCK_SIZE,
+                   (offset + bytes - 1) / TFS_BLOCK_SIZE, 1);
+  }
+
+  tfs_inode_put(tfs, inode);
+  return VFS_OK;
+}
+
+
 
 /**
  * Write at most datasize bytes from buffer to the file starting from
@@ -632,41 +866,39 @@ int tfs_read(fs_t *fs, int fileid, void *buffer, int bufsize, int offset)
 int tfs_write(fs_t *fs, int fileid, void *buffer, int datasize, int offset)
 {
   tfs_t *tfs = (tfs_t *)fs->internal;
-  gbd_request_t req;
+  bcache_buf_t *buf;
+  tfs_open_inode_t *inode;
+  uint32_t block;
   int b1, b2;
   int written=0;
-  int r;
-
-  semaphore_P(tfs->lock);
+  int count;
 
   /* fileid is blocknum so ensure that we don't read system blocks
      or outside the disk */
   if(fileid < 2 || fileid > (int)tfs->totalblocks) {
-    semaphore_V(tfs->lock);
     return VFS_ERROR;
   }
 
-  req.block = tfs->startblock + fileid;
-  req.buf   = ADDR_KERNEL_TO_PHYS((uintptr_t)tfs->buffer_inode);
-  req.sem   = NULL;
-  r = tfs->disk->read_block(tfs->disk, &req);
-  if(r == 0) {
+  inode = tfs_inode_get(tfs, fileid);
+  if(inode == NULL) {
     /* An error occured. */
-    semaphore_V(tfs->lock);
     return VFS_ERROR;
   }
+  tfs_inode_lock(tfs, inode, 1);
 
   /* check that start position is inside the disk */
-  if(offset < 0 || offset > (int)from_big_endian32(tfs->buffer_inode->filesize)) {
-    semaphore_V(tfs->lock);
+  if(offset < 0 || offset > (int)inode->filesize) {
+    tfs_inode_unlock(tfs, inode);
+    tfs_inode_put(tfs, inode);
     return VFS_ERROR;
   }
 
   /* write at most the number of bytes left in the file */
-  datasize = MIN(datasize,(int)from_big_endian32(tfs->buffer_inode->filesize)-offset);
+  datasize = MIN(datasize,(int)inode->filesize-offset);
 
   if(datasize==0) {
-    semaphore_V(tfs->lock);
+    tfs_inode_unlock(tfs, inode);
+    tfs_inode_put(tfs, inode);
     return 0;
   }
 
@@ -676,89 +908,37 @@ int tfs_write(fs_t *fs, int fileid, void *buffer, int datasize, int offset)
   /* last block to be written into */
   b2 = (offset+datasize-1) / TFS_BLOCK_SIZE;
 
-  /* Write data to blocks from b1 to b2. First and last are special
-     cases because whole block might not be written. Because of possible
-     partial write, first and last block must be read before writing.
-
-     If we write less than block size or start writing in the middle
-     of the block, read the block firts. Buffer for allocation block
-     is used because it is not needed (for allocation block) in this
-     function. */
-  written = MIN(TFS_BLOCK_SIZE - (offset % TFS_BLOCK_SIZE),datasize);
-  if(written < TFS_BLOCK_SIZE) {
-    req.block = tfs->startblock + from_big_endian32(tfs->buffer_inode->block[b1]);
-    req.buf   = ADDR_KERNEL_TO_PHYS((uintptr_t)tfs->buffer_bat);
-    req.sem   = NULL;
-    r = tfs->disk->read_block(tfs->disk, &req);
-    if(r == 0) {
-      /* An error occured. */
-      semaphore_V(tfs->lock);
-      return VFS_ERROR;
-    }
-  }
-
-  memcopy(written,
-          (uint32_t *)(((uintptr_t)tfs->buffer_bat) +
-                       (offset % TFS_BLOCK_SIZE)),
-          buffer);
-
-  req.block = tfs->startblock + from_big_endian32(tfs->buffer_inode->block[b1]);
-  req.buf   = ADDR_KERNEL_TO_PHYS((uintptr_t)tfs->buffer_bat);
-  req.sem   = NULL;
-  r = tfs->disk->write_block(tfs->disk, &req);
-  if(r == 0) {
-    /* An error occured. */
-    semaphore_V(tfs->lock);
-    return VFS_ERROR;
-  }
-
-  buffer = (void *)((uintptr_t)buffer + written);
-  b1++;
+  /* Write data to blocks from b1 to b2. A block that is only partly
+     written must be read first; a whole block need not be. */
   while(b1 <= b2) {
-
-    if(b1 == b2) {
-      /* Last block. If partial write, read the block first.
-         Write anyway always to the beginning of the block */
-      if((datasize - written)  < TFS_BLOCK_SIZE) {
-        req.block = tfs->startblock + from_big_endian32(tfs->buffer_inode->block[b1]);
-        req.buf   = ADDR_KERNEL_TO_PHYS((uintptr_t)tfs->buffer_bat);
-        req.sem   = NULL;
-        r = tfs->disk->read_block(tfs->disk, &req);
-        if(r == 0) {
-          /* An error occured. */
-          semaphore_V(tfs->lock);
-          return VFS_ERROR;
-        }
-      }
-
-      memcopy(datasize - written,
-              (uint32_t *)(uintptr_t)tfs->buffer_bat,
-              buffer);
-      written = datasize;
-    }
-    else {
-      /* Write whole block */
-      memcopy(TFS_BLOCK_SIZE,
-              (uint32_t *)(uintptr_t)tfs->buffer_bat,
-              buffer);
-      written += TFS_BLOCK_SIZE;
-      buffer = (void *)((uintptr_t)buffer + TFS_BLOCK_SIZE);
-    }
-
-    req.block = tfs->startblock + from_big_endian32(tfs->buffer_inode->block[b1]);
-    req.buf   = ADDR_KERNEL_TO_PHYS((uintptr_t)tfs->buffer_bat);
-    req.sem   = NULL;
-    r = tfs->disk->write_block(tfs->disk, &req);
-    if(r == 0) {
+    count = MIN(TFS_BLOCK_SIZE - ((offset + written) % TFS_BLOCK_SIZE),
+                datasize - written);
+    block = tfs->startblock + inode->block[b1];
+
+    if(count < TFS_BLOCK_SIZE)
+      buf = bcache_read(tfs->disk, block);
+    else
+      buf = bcache_get(tfs->disk, block);
+    if(buf == NULL) {
       /* An error occured. */
-      semaphore_V(tfs->lock);
+      tfs_inode_unlock(tfs, inode);
+      tfs_inode_put(tfs, inode);
       return VFS_ERROR;
     }
 
+    memcopy(count,
+            (void *)((uintptr_t)buf->data +
+                     ((offset + written) % TFS_BLOCK_SIZE)),
+            (const void *)((uintptr_t)buffer + written));
+    bcache_dirty(buf);
+    bcache_release(buf);
+
+    written += count;
     b1++;
   }
 
-  semaphore_V(tfs->lock);
+  tfs_inode_unlock(tfs, inode);
+  tfs_inode_put(tfs, inode);
   return written;
 }
 
@@ -774,27 +954,24 @@ int tfs_write(fs_t *fs, int fileid, void *buffer, int datasize, int offset)
 int tfs_getfree(fs_t *fs)
 {
   tfs_t *tfs = (tfs_t *)fs->internal;
-  gbd_request_t req;
+  bcache_buf_t *buf;
   int allocated = 0;
   uint32_t i;
-  int r;
 
   semaphore_P(tfs->lock);
 
-  req.block = tfs->startblock + TFS_ALLOCATION_BLOCK;
-  req.buf = ADDR_KERNEL_TO_PHYS((uintptr_t)tfs->buffer_bat);
-  req.sem = NULL;
-  r = tfs->disk->read_block(tfs->disk, &req);
-  if(r == 0) {
+  buf = bcache_read(tfs->disk, tfs->startblock + TFS_ALLOCATION_BLOCK);
+  if(buf == NULL) {
     /* An error occured. */
     semaphore_V(tfs->lock);
     return VFS_ERROR;
   }
 
   for(i=0;i<tfs->totalblocks;i++) {
-    allocated += bitmap_get(tfs->buffer_bat,i);
+    allocated += bitmap_get((bitmap_t *)buf->data,i);
   }
 
+  bcache_release(buf);
   semaphore_V(tfs->lock);
   return (tfs->totalblocks - allocated)*TFS_BLOCK_SIZE;
 }
@@ -804,9 +981,9 @@ int tfs_getfree(fs_t *fs)
 int tfs_filecount(fs_t *fs, char *dirname)
 {
   tfs_t *tfs = (tfs_t *)fs->internal;
-  gbd_request_t req;
+  bcache_buf_t *buf;
+  tfs_direntry_t *md;
   uint32_t i;
-  int r;
   int count = 0;
 
   if (stringcmp(dirname, "/") != 0)
@@ -814,21 +991,20 @@ int tfs_filecount(fs_t *fs, char *dirname)
 
   semaphore_P(tfs->lock);
 
-  req.block = tfs->startblock + TFS_DIRECTORY_BLOCK;
-  req.buf = ADDR_KERNEL_TO_PHYS((uintptr_t)tfs->buffer_md);
-  req.sem = NULL;
-  r = tfs->disk->read_block(tfs->disk, &req);
-  if(r == 0) {
+  buf = bcache_read(tfs->disk, tfs->startblock + TFS_DIRECTORY_BLOCK);
+  if(buf == NULL) {
     semaphore_V(tfs->lock);
     return VFS_ERROR;
   }
+  md = (tfs_direntry_t *)buf->data;
 
   for(i=0; i < TFS_MAX_FILES; ++i) {
-    if(tfs->buffer_md[i].inode != 0) {
+    if(md[i].inode != 0) {
       ++count;
     }
   }
 
+  bcache_release(buf);
   semaphore_V(tfs->lock);
   return count;
 }
@@ -840,37 +1016,36 @@ int tfs_filecount(fs_t *fs, char *dirname)
 int tfs_file(fs_t *fs, char *dirname, int idx, char *buffer)
 {
   tfs_t *tfs = (tfs_t *)fs->internal;
+  bcache_buf_t *buf;
+  tfs_direntry_t *md;
   uint32_t i;
-  int r;
   int count = 0;
-  gbd_request_t req;
 
   if (stringcmp(dirname, "/") != 0 || idx < 0)
     return VFS_ERROR;
 
   semaphore_P(tfs->lock);
 
-  req.block = tfs->startblock + TFS_DIRECTORY_BLOCK;
-  req.buf = ADDR_KERNEL_TO_PHYS((uintptr_t)tfs->buffer_md);
-  req.sem = NULL;
-  r = tfs->disk->read_block(tfs->disk, &req);
-
- if(r == 0) {
+  buf = bcache_read(tfs->disk, tfs->startblock + TFS_DIRECTORY_BLOCK);
+  if(buf == NULL) {
     semaphore_V(tfs->lock);
     return VFS_ERROR;
   }
+  md = (tfs_direntry_t *)buf->data;
 
   for(i=0; i < TFS_MAX_FILES; ++i)
     {
-      if(tfs->buffer_md[i].inode != 0 && count++ == idx)
+      if(md[i].inode != 0 && count++ == idx)
         {
-          stringcopy(buffer, tfs->buffer_md[i].name,
+          stringcopy(buffer, md[i].name,
                      TFS_FILENAME_MAX);
+          bcache_release(buf);
           semaphore_V(tfs->lock);
           return VFS_OK;
         }
     }
 
+  bcache_release(buf);
   semaphore_V(tfs->lock);
   return VFS_ERROR;
 }
@@ -22,6 +22,7 @@ int tfs_create(fs_t *fs, char *filename, int size);
 int tfs_remove(fs_t *fs, char *filename);
 int tfs_read(fs_t *fs, int fileid, void *buffer, int bufsize, int offset);
 int tfs_write(fs_t *fs, int fileid, void *buffer, int datasize, int offset);
+int tfs_readahead(fs_t *fs, int fileid, int offset, int bytes);
 int tfs_getfree(fs_t *fs);
 int tfs_filecount(fs_t *fs, char *dirname);
 int tfs_file(fs_t *fs, char *dirname, int idx, char *buffer);
@@ -10,6 +10,7 @@
 #include "drivers/device.h"
 #include "fs/tfs.h"
 #include "fs/filesystems.h"
+#include "vm/pagecache.h"
 
 /** @name Virtual Filesystem
  *
@@ -38,8 +39,19 @@ typedef struct {
 
   /* Current seek position in the file. */
   int seek_position;
+
+  /* Sequential readahead state: the offset where a read continuing
+     the previous one starts, the size of the readahead window in
+     bytes (0 if the file is not read sequentially), and the offset
+     up to which data has been read ahead. */
+  int ra_next;
+  int ra_window;
+  int ra_end;
 } openfile_entry_t;
 
+/* Smallest readahead window, in bytes */
+#define VFS_READAHEAD_MIN 4096
+
 
 /* Table of mounted filesystems. */
 static struct {
@@ -472,6 +484,7 @@ int vfs_unmount(char *name)
     }
   }
 
+  pagecache_invalidate(fs, -1);
   fs->unmount(fs);
   vfs_table.filesystems[row].filesystem = NULL;
 
@@ -551,6 +564,9 @@ openfile_t vfs_open(char *pathname)
 
   openfile_table.files[file].fileid = fileid;
   openfile_table.files[file].seek_position = 0;
+  openfile_table.files[file].ra_next = 0;
+  openfile_table.files[file].ra_window = 0;
+  openfile_table.files[file].ra_end = 0;
 
   vfs_end_op();
   return file;
@@ -621,6 +637,38 @@ int vfs_close(openfile_t file)
 }
 
 
+/**
+ * Gets the filesystem and the filesystem specific id of an open file,
+ * which together identify the file while it is open.
+ *
+ * @return VFS_OK on success, negative (VFS_*) on error.
+ */
+int vfs_get_fileid(openfile_t file, fs_t **fs, int *fileid)
+{
+  openfile_entry_t *openfile;
+
+  if (vfs_start_op() != VFS_OK)
+    return VFS_UNUSABLE;
+
+  semaphore_P(openfile_table.sem);
+
+  openfile = vfs_verify_open(file);
+  if (openfile == NULL) {
+    semaphore_V(openfile_table.sem);
+    vfs_end_op();
+    return VFS_INVALID_PARAMS;
+  }
+
+  *fs = openfile->filesystem;
+  *fileid = openfile->fileid;
+
+  semaphore_V(openfile_table.sem);
+
+  vfs_end_op();
+  return VFS_OK;
+}
+
+
 /**
  * Seek given file to given position. The position is not verified
  * to be within the file's size.
@@ -653,6 +701,57 @@ int vfs_seek(openfile_t file, int seek_position)
 }
 
 
+/**
+ * Updates the sequential readahead state of an open file after a read
+ * of len bytes from offset. A read that starts where the previous one
+ * ended doubles the readahead window, up to CONFIG_VFS_READAHEAD_MAX
+ * bytes. Any other read closes the window. More data is read ahead
+ * when less than half a window is left ahead of the reader. The
+ * caller holds the open file table lock.
+ *
+ * @param openfile The open file.
+ *
+ * @param offset Offset of the read.
+ *
+ * @param len Number of bytes read.
+ *
+ * @param start Set to the offset to read ahead from.
+ *
+ * @return Number of bytes to read ahead, 0 for none.
+ */
+static int vfs_readahead_update(openfile_entry_t *openfile, int offset,
+                                int len, int *start)
+{
+  int end;
+
+  if (offset != openfile->ra_next) {
+    openfile->ra_window = 0;
+    openfile->ra_end = 0;
+    openfile->ra_next = offset + len;
+    return 0;
+  }
+  openfile->ra_next = offset + len;
+
+  if (openfile->ra_window == 0)
+    openfile->ra_window = VFS_READAHEAD_MIN;
+  else
+    openfile->ra_window *= 2;
+  if (openfile->ra_window > CONFIG_VFS_READAHEAD_MAX)
+    openfile->ra_window = CONFIG_VFS_READAHEAD_MAX;
+
+  if (openfile->ra_end - openfile->ra_next >= openfile->ra_window / 2)
+    return 0;
+
+  *start = MAX(openfile->ra_end, openfile->ra_next);
+  end = openfile->ra_next + openfile->ra_window;
+  if (end <= *start)
+    return 0;
+
+  openfile->ra_end = end;
+  return end - *start;
+}
+
+
 /**
  * Reads at most bufsize bytes from given open file to given buffer.
  * The read is started from current seek position and after read, the
@@ -668,11 +767,12 @@ int vfs_seek(openfile_t file, int seek_position)
  * negative values are errors.
  *
  */
-
 int vfs_read(openfile_t file, void *buffer, int bufsize)
 {
   openfile_entry_t *openfile;
   fs_t *fs;
+  int fileid, offset;
+  int ra_start = 0, ra_bytes = 0;
   int ret;
 
   if (vfs_start_op() != VFS_OK)
@@ -684,18 +784,24 @@ int vfs_read(openfile_t file, void *buffer, int bufsize)
   }
 
   fs = openfile->filesystem;
+  fileid = openfile->fileid;
+  offset = openfile->seek_position;
 
   KERNEL_ASSERT(bufsize >= 0 && buffer != NULL);
 
-  ret = fs->read(fs, openfile->fileid, buffer, bufsize,
-                 openfile->seek_position);
+  ret = fs->read(fs, fileid, buffer, bufsize, offset);
 
   if(ret > 0) {
     semaphore_P(openfile_table.sem);
     openfile->seek_position += ret;
+    ra_bytes = vfs_readahead_update(openfile, offset, ret, &ra_start);
     semaphore_V(openfile_table.sem);
   }
 
+  /* Start reading what a sequential reader wants next */
+  if (ra_bytes > 0 && fs->readahead != NULL)
+    fs->readahead(fs, fileid, ra_start, ra_bytes);
+
   vfs_end_op();
   return ret;
 }
@@ -739,6 +845,9 @@ int vfs_write(openfile_t file, void *buffer, int datasize)
                   openfile->seek_position);
 
   if(ret > 0) {
+    /* Cached text of the file is stale now */
+    pagecache_invalidate(fs, openfile->fileid);
+
     semaphore_P(openfile_table.sem);
     openfile->seek_position += ret;
     semaphore_V(openfile_table.sem);
@@ -834,6 +943,10 @@ int vfs_remove(char *pathname)
 
   ret = fs->remove(fs, filename);
 
+  /* The file id of the removed file may be reused */
+  if (ret == VFS_OK)
+    pagecache_invalidate(fs, -1);
+
   semaphore_V(vfs_table.sem);
 
   vfs_end_op();
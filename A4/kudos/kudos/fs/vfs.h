@@ -118,6 +118,17 @@ typedef struct fs_struct{
      Returns success value as defined above (VFS_OK, etc.)
   */
   int (*file)(struct fs_struct *fs, char *dirname, int idx, char *buf);
+
+  /* Function pointer to a function which starts reading bytes bytes
+     of given open file (fileid) from given offset into memory, so
+     that the following reads do not have to wait for the disk. The
+     function does not wait for the data. May be NULL if the
+     filesystem does not read ahead.
+
+     Returns success value as defined above (VFS_OK, etc.)
+  */
+  int (*readahead)(struct fs_struct *fs, int fileid, int offset,
+                   int bytes);
 } fs_t;
 
 
@@ -132,6 +143,7 @@ int vfs_unmount(char *name);
 openfile_t vfs_open(char *pathname);
 int vfs_close(openfile_t file);
 int vfs_seek(openfile_t file, int seek_position);
+int vfs_get_fileid(openfile_t file, fs_t **fs, int *fileid);
 int vfs_read(openfile_t file, void *buffer, int bufsize);
 int vfs_write(openfile_t file, void *buffer, int datasize);
 
@@ -4,6 +4,7 @@
 
 #include "init/common.h"
 #include <arch.h>
+#include "drivers/bcache.h"
 #include "drivers/bootargs.h"
 #include "drivers/device.h"
 #include "drivers/gcd.h"
@@ -25,7 +26,9 @@
 #include "proc/process.h"
 #include "proc/fdt.h"
 #include "vm/memory.h"
+#include "vm/pagecache.h"
 #include "proc/usr_sem.h"
+#include "proc/futex.h"
 
 /**
  * Fallback function for system startup. This function is executed
@@ -88,6 +91,12 @@ void init_startup_thread(uint32_t arg)
      need any. Silence the compiler warning by using the argument. */
   arg = arg;
 
+  kprintf("Initializing the page cache\n");
+  pagecache_init();
+
+  kprintf("Initializing the buffer cache\n");
+  bcache_init();
+
   kprintf("Mounting filesystems\n");
   vfs_mount_all();
 
@@ -100,6 +109,9 @@ void init_startup_thread(uint32_t arg)
   kprintf("Initializing user semaphores\n");
   usr_sem_init();
 
+  kprintf("Initializing futexes\n");
+  futex_init();
+
   if(bootargs_get("initprog") == NULL) {
     kprintf("No initial program (initprog), dropping to fallback\n");
     init_startup_fallback();
@@ -12,6 +12,7 @@
 #include "fs/vfs.h"
 #include "kernel/assert.h"
 #include "kernel/config.h"
+#include "kernel/cpulocal.h"
 #include "kernel/halt.h"
 #include "kernel/idle.h"
 #include "kernel/interrupt.h"
@@ -45,6 +46,9 @@ void init(void)
   TID_t startup_thread;
   int numcpus;
 
+  // Initialise per-CPU data.
+  cpu_local_init();
+
   // Initialise static allocation.
   stalloc_init();
 
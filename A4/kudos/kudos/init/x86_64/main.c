@@ -11,6 +11,7 @@
 #include "drivers/polltty.h"
 #include "kernel/stalloc.h"
 #include "kernel/thread.h"
+#include "kernel/cpulocal.h"
 #include "kernel/sleepq.h"
 #include "kernel/semaphore.h"
 #include "kernel/scheduler.h"
@@ -19,6 +20,7 @@
 #include "fs/vfs.h"
 #include <keyboard.h>
 #include "drivers/modules.h"
+#include <smp.h>
 
 /**
  * Initialize the system. This function is called by CPU0 just
@@ -34,6 +36,10 @@ int init(uint64_t magic, uint8_t *multiboot)
   /* Setup Static Allocation System */
   multiboot_info_t *mb_info = (multiboot_info_t*)multiboot;
   TID_t startup_thread;
+
+  /* Setup per-CPU data, used by _interrupt_getcpu() */
+  cpu_local_init();
+
   stalloc_init();
 
   /* Setup video printing */
@@ -108,6 +114,7 @@ int init(uint64_t magic, uint8_t *multiboot)
   thread_run(startup_thread);
 
   kprintf("Starting threading system and SMP\n");
+  smp_init();
 
   /* Enter context switch, scheduler will be run automatically,
      since thread_switch() behaviour is identical to timer tick
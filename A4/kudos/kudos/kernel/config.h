@@ -25,6 +25,57 @@
  */
 #define CONFIG_SCHEDULER_TIMESLICE 750
 
+/* Number of priority levels used by the multi-level feedback queue
+ * scheduler (boot argument scheduler=mlfq). Level 0 is the highest.
+ * Range from 1 to 32.
+ */
+#define CONFIG_SCHEDULER_LEVELS 8
+
+/* Milliseconds between two priority boosts of the multi-level
+ * feedback queue scheduler, which move every ready thread back to the
+ * top level.
+ * Range from 10 to 100000.
+ */
+#define CONFIG_SCHEDULER_BOOST_PERIOD 1000
+
+/* Spinlock algorithm: 1 selects ticket locks, which are granted in
+ * FIFO order; 0 selects test-and-set locks, which are unfair.
+ * Range from 0 to 1.
+ */
+#define CONFIG_SPINLOCK_TICKET 1
+
+/* Set to 1 to count acquisitions, contended acquisitions, spins and
+ * the maximum hold time of every spinlock. The counters of the locks
+ * named with spinlock_register() are printed at shutdown when the
+ * "debuglocks" boot argument is given.
+ * Range from 0 to 1.
+ */
+#define CONFIG_SPINLOCK_STATS 0
+
+/* Maximum number of spinlocks that can be named for statistics.
+ * Range from 1 to 1024.
+ */
+#define CONFIG_SPINLOCK_STATS_MAX 32
+
+/* Number of free physical frames each CPU keeps in its own cache in
+ * front of the shared frame allocator. The cache is refilled and
+ * drained half of this at a time. Only used on x86_64.
+ * Range from 2 to 256.
+ */
+#define CONFIG_PHYSMEM_CACHE_SIZE 32
+
+/* Number of read-only executable pages kept in the page cache, so
+ * that every process running the same program maps the same frames.
+ * Range from 16 to 4096.
+ */
+#define CONFIG_PAGECACHE_PAGES 256
+
+/* Number of disk blocks kept in the buffer cache, unless the
+ * "bcacheblocks" boot argument says otherwise.
+ * Range from 16 to 65536.
+ */
+#define CONFIG_BCACHE_BLOCKS 256
+
 /* Sets the maximum number of boot arguments that the kernel will 
  * accept.
  * Range from 1 to 1024
@@ -53,6 +104,12 @@
 
 #define CONFIG_MAX_OPEN_FILES 512
 
+/* Largest readahead window of a file that is read sequentially, in
+ * bytes. 0 turns readahead off.
+ * Range from 0 to 1048576
+ */
+#define CONFIG_VFS_READAHEAD_MAX 65536
+
 /* Maximum number of simultaneously open sockets for POP/SOP 
  * Range from 4 to 65536
  */
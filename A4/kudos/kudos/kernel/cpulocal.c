@@ -0,0 +1,36 @@
+/*
+ * Per-CPU data
+ */
+
+#include "kernel/cpulocal.h"
+
+/** The per-CPU blocks, indexed by CPU number */
+cpu_local_t cpu_local[CONFIG_MAX_CPUS];
+
+/**
+ * Initializes the per-CPU blocks with the idle thread as the current
+ * thread of every CPU, and makes block 0 reachable from the calling
+ * CPU. Called by CPU 0 before anything asks for the current thread or
+ * the CPU number. The other CPUs load their blocks when they start.
+ */
+void cpu_local_init(void)
+{
+  int i;
+
+  for (i = 0; i < CONFIG_MAX_CPUS; i++) {
+    cpu_local[i].cpu = i;
+    cpu_local_set_current_thread(i, IDLE_THREAD_TID);
+  }
+
+  _cpu_local_load(&cpu_local[0]);
+}
+
+/**
+ * Records t as the thread running on the given CPU. Only called by the
+ * scheduler on that CPU, with interrupts disabled.
+ */
+void cpu_local_set_current_thread(int cpu, TID_t t)
+{
+  cpu_local[cpu].current_thread = t;
+  cpu_local[cpu].current_thread_entry = thread_get_thread_entry(t);
+}
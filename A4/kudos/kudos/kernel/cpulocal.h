@@ -0,0 +1,37 @@
+/*
+ * Per-CPU data
+ */
+
+#ifndef KUDOS_KERNEL_CPULOCAL_H
+#define KUDOS_KERNEL_CPULOCAL_H
+
+#include "lib/types.h"
+#include "kernel/config.h"
+#include "kernel/thread.h"
+
+/* Data private to one CPU. Every CPU keeps the address of its own
+ * block in a register (the GS base on x86_64, k1 on MIPS32), so a
+ * field can be read with one load relative to that register. Such a
+ * load cannot be split by a thread being moved to another CPU, and
+ * the current thread fields it reads are the same on whichever CPU
+ * the calling thread runs: the calling thread itself. The blocks are
+ * cache line sized, so CPUs never write to each other's lines. */
+typedef struct {
+  /* TID of the thread running on this CPU */
+  TID_t current_thread;
+  /* Number of this CPU */
+  int cpu;
+  /* Thread table entry of current_thread */
+  thread_table_t *current_thread_entry;
+} __attribute__((aligned(64))) cpu_local_t;
+
+extern cpu_local_t cpu_local[CONFIG_MAX_CPUS];
+
+void cpu_local_init(void);
+void cpu_local_set_current_thread(int cpu, TID_t t);
+
+/* _cpu_local_load(), _cpu_local_current_thread(),
+   _cpu_local_current_thread_entry() and _cpu_local_cpu() */
+#include <_cpulocal.h>
+
+#endif // KUDOS_KERNEL_CPULOCAL_H
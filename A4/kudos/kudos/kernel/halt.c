@@ -5,6 +5,10 @@
 #include "drivers/metadev.h"
 #include "lib/libc.h"
 #include "fs/vfs.h"
+#include "drivers/bcache.h"
+#include "kernel/scheduler.h"
+#include "kernel/spinlock.h"
+#include "vm/memory.h"
 
 /**
  * Halt the kernel.
@@ -13,6 +17,11 @@ void halt_kernel(void)
 {
     kprintf("Kernel: System shutdown started...\n");
 
+    scheduler_print_stats();
+    spinlock_print_stats();
+    physmem_print_stats();
+    bcache_print_stats();
+
     /* Unmount all filesystems */
     vfs_deinit();
 
@@ -33,5 +33,6 @@ interrupt_status_t _interrupt_is_disabled(void);
 /* Arch Specific */
 void _interrupt_yield(void);
 int _interrupt_getcpu(void);
+void _interrupt_wake_cpu(int cpu);
 
 #endif // KUDOS_KERNEL_INTERRUPT_H
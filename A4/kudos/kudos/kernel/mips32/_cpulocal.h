@@ -0,0 +1,48 @@
+/*
+ * Per-CPU data
+ */
+
+#ifndef KUDOS_KERNEL_MIPS32__CPULOCAL_H
+#define KUDOS_KERNEL_MIPS32__CPULOCAL_H
+
+/* Included from kernel/cpulocal.h only, after cpu_local_t */
+
+/* The per-CPU block is reached through k1 ($27). GCC never uses k0
+ * and k1; the exception code in _cswitch.S uses them as scratch, but
+ * reloads k1 with _FETCH_CPU_LOCAL before calling any C code and
+ * before every eret, so k1 is valid whenever C code runs. */
+
+/* Makes the given block the per-CPU block of the calling CPU */
+static inline void _cpu_local_load(cpu_local_t *cl)
+{
+  asm volatile("move $27, %0" : : "r"(cl));
+}
+
+static inline TID_t _cpu_local_current_thread(void)
+{
+  TID_t t;
+
+  asm volatile("lw %0, %1($27)" : "=r"(t)
+               : "i"(__builtin_offsetof(cpu_local_t, current_thread)));
+  return t;
+}
+
+static inline thread_table_t *_cpu_local_current_thread_entry(void)
+{
+  thread_table_t *entry;
+
+  asm volatile("lw %0, %1($27)" : "=r"(entry)
+               : "i"(__builtin_offsetof(cpu_local_t, current_thread_entry)));
+  return entry;
+}
+
+static inline int _cpu_local_cpu(void)
+{
+  int cpu;
+
+  asm volatile("lw %0, %1($27)" : "=r"(cpu)
+               : "i"(__builtin_offsetof(cpu_local_t, cpu)));
+  return cpu;
+}
+
+#endif // KUDOS_KERNEL_MIPS32__CPULOCAL_H
@@ -13,7 +13,7 @@
 typedef struct _kthread
 {
     /* pad to 64 bytes */
-    uint32_t dummy_alignment_fill[8];
+    uint32_t dummy_alignment_fill[6];
 
 } _kthread_t;
 
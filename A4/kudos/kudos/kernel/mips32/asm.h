@@ -11,4 +11,13 @@
   mfc0  reg, PRId, 0;                           \
   srl   reg, reg, 24;
 
+/* Get the address of the per-CPU block of this cpu (an element of
+   cpu_local, 64 bytes each) into register reg, using tmp as scratch. */
+#define _FETCH_CPU_LOCAL(reg, tmp)              \
+  _FETCH_CPU_NUM(reg)                           \
+  sll   reg, reg, 6;                            \
+  lui   tmp, %hi(cpu_local);                    \
+  addiu tmp, tmp, %lo(cpu_local);               \
+  addu  reg, reg, tmp;
+
 #endif // KUDOS_KERNEL_MIPS32_ASM_H
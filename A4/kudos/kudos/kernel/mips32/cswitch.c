@@ -42,3 +42,8 @@ void _context_set_sp(context_t *cxt, virtaddr_t sp)
 {
   cxt->cpu_regs[MIPS_REGISTER_SP] = sp;
 }
+
+void _context_set_arg(context_t *cxt, uint32_t arg)
+{
+  cxt->cpu_regs[MIPS_REGISTER_A0] = arg;
+}
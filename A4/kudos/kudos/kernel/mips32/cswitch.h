@@ -65,6 +65,7 @@ void _context_init(context_t *cxt, virtaddr_t entry, virtaddr_t endentry,
 void _context_enter_userland(context_t *cxt);
 void _context_set_ip(context_t *cxt, virtaddr_t ip); /* Set new instruction pointer / program counter */
 void _context_set_sp(context_t *cxt, virtaddr_t sp); /* Sets a new stack pointer */
+void _context_set_arg(context_t *cxt, uint32_t arg); /* Sets the first argument */
 void _context_enable_ints(context_t *cxt); /* Enables interrupts */
 
 #endif // KUDOS_KERNEL_MIPS32_CSWITCH_H
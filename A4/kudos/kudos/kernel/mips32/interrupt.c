@@ -9,6 +9,8 @@
 #include "kernel/scheduler.h"
 #include "kernel/interrupt.h"
 #include "drivers/polltty.h"
+#include "drivers/device.h"
+#include "drivers/metadev.h"
 #include "kernel/thread.h"
 #include "lib/libc.h"
 #include <tlb.h>
@@ -153,6 +155,8 @@ void interrupt_handle(virtaddr_t cause) {
   if((cause & (INTERRUPT_CAUSE_SOFTWARE_0 |
                INTERRUPT_CAUSE_HARDWARE_5)) ||
      scheduler_current_thread[this_cpu] == IDLE_THREAD_TID) {
+    if (cause & INTERRUPT_CAUSE_HARDWARE_5)
+      scheduler_timer_expired();
     scheduler_schedule();
 
     /* Until we have proper VM we must manually fill
@@ -169,6 +173,21 @@ void interrupt_handle(virtaddr_t cause) {
   }
 }
 
+/**
+ * Interrupts the given CPU so that it runs the scheduler, by raising
+ * the interrupt of its CPU status device. An idle CPU runs the
+ * scheduler on any interrupt.
+ *
+ * @param cpu The CPU to interrupt.
+ */
+void _interrupt_wake_cpu(int cpu)
+{
+  device_t *dev = device_get(YAMS_TYPECODE_CPUSTATUS | cpu, 0);
+
+  if (dev != NULL)
+    cpustatus_generate_irq(dev);
+}
+
 interrupt_status_t _interrupt_is_disabled(void)
 {
   interrupt_status_t intr_state = _interrupt_get_state();
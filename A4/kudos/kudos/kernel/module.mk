@@ -3,6 +3,7 @@
 # Set the module name
 MODULE := kernel
 
-FILES := panic.c thread.c scheduler.c sleepq.c semaphore.c halt.c stalloc.c klock.c
+FILES := panic.c thread.c scheduler.c sleepq.c semaphore.c halt.c stalloc.c klock.c \
+	timeout.c spinlock.c cpulocal.c
 
 SRC += $(patsubst %, $(MODULE)/%, $(FILES))
@@ -4,106 +4,423 @@
 
 #include "kernel/thread.h"
 #include "kernel/klock.h"
+#include "kernel/spinlock.h"
+#include "kernel/scheduler.h"
+#include "kernel/sleepq.h"
 #include "kernel/assert.h"
 #include "kernel/panic.h"
 #include "kernel/interrupt.h"
+#include "kernel/cpulocal.h"
 #include "lib/libc.h"
+#include "lib/debug.h"
 #include "kernel/config.h"
 #include "drivers/timer.h"
+#include "drivers/metadev.h"
+#include "drivers/bootargs.h"
 
 /** @name Scheduler
  *
  * This module implements simple round robin scheduler.
  *
+ * Every CPU has its own ready to run queue protected by its own
+ * spinlock, so CPUs picking their next thread do not contend with
+ * each other. A thread is queued on the CPU it last ran on. A CPU
+ * whose own queue is empty steals the first thread from the busiest
+ * queue of the other CPUs before falling back to the idle thread.
+ *
+ * Two policies are available, chosen with the "scheduler" boot
+ * argument. The default is plain round robin. With "scheduler=mlfq"
+ * the ready queues are split into CONFIG_SCHEDULER_LEVELS levels
+ * (0 is the highest) and the highest non-empty level always runs
+ * first. A thread whose timeslice runs out drops one level and gets
+ * a longer slice; a thread that blocks in the sleep queue returns to
+ * its base level. Every CONFIG_SCHEDULER_BOOST_PERIOD timer
+ * interrupts all queued threads are moved to the top level so that
+ * CPU-bound threads cannot starve.
+ *
+ * Each ready queue keeps a bitmap of its non-empty levels, so picking
+ * the next thread is a find-first-set on the bitmap followed by a list
+ * head pop. Both enqueueing and picking take constant time regardless
+ * of the number of ready threads or of CONFIG_MAX_THREADS.
+ *
  */
 
+#if CONFIG_SCHEDULER_LEVELS < 1 || CONFIG_SCHEDULER_LEVELS > 32
+#error "CONFIG_SCHEDULER_LEVELS must be between 1 and 32"
+#endif
+
 /* Import thread table and its lock from thread.c */
 extern klock_t thread_table_klock;
 extern thread_table_t thread_table[CONFIG_MAX_THREADS];
 
-/** Currently running thread on each CPU */
+/** Currently running thread on each CPU. Mirrored in the per-CPU
+    blocks, which the rest of the kernel reads; this table is used by
+    the scheduler and the context switch code. */
 TID_t scheduler_current_thread[CONFIG_MAX_CPUS];
 
-/** List of threads ready to be run. */
-static struct {
+/** Scheduling policy in use, set from the boot arguments */
+static scheduler_policy_t scheduler_policy;
+
+/** FIFO of ready threads on one priority level. */
+typedef struct {
   TID_t head; /* the first thread in ready to run queue, negative if none */
   TID_t tail; /* the last thread in ready to run queue, negative if none */
-} scheduler_ready_to_run = {-1, -1};
+} scheduler_level_t;
+
+/** Ready to run queue of one CPU. */
+typedef struct {
+  spinlock_t slock; /* protects the fields below */
+  scheduler_level_t level[CONFIG_SCHEDULER_LEVELS];
+  /* Bit i is set iff level i is non-empty. May be read without the
+     lock to check whether the queue is empty. */
+  volatile uint32_t bitmap;
+  volatile int count; /* queue length, may be read without the lock */
+  /* Incremented by every priority boost of this queue */
+  uint8_t boost_epoch;
+} scheduler_runqueue_t;
+
+/** Lists of threads ready to be run, one for each CPU. */
+static scheduler_runqueue_t scheduler_ready_to_run[CONFIG_MAX_CPUS];
+
+/** Balancing counters for each CPU. Only updated by the owning CPU. */
+static scheduler_stats_t scheduler_stats[CONFIG_MAX_CPUS];
+
+/** Set by the timer interrupt when the running thread used its whole
+    timeslice, cleared by the scheduler. */
+static int scheduler_slice_expired[CONFIG_MAX_CPUS];
+
+/** Set when the timer of the CPU was armed to expire a sleep queue
+    timeout before the end of the timeslice. */
+static int scheduler_timer_for_timeout[CONFIG_MAX_CPUS];
+
+/** Time in milliseconds of the next priority boost of each CPU */
+static uint32_t scheduler_next_boost[CONFIG_MAX_CPUS];
+
+/** Bit i is set while CPU i runs its idle thread */
+static volatile uint32_t scheduler_idle_cpus;
 
 /**
- * Initializes the scheduler current thread table to 0 for each processor.
+ * Initializes the scheduler current thread table to 0 for each
+ * processor and empties the ready to run queues.
  */
 void scheduler_init(void) {
-  int i;
-  for (i=0; i<CONFIG_MAX_CPUS; i++)
+  int i, j;
+  char *policy = bootargs_get("scheduler");
+
+  scheduler_policy = SCHEDULER_POLICY_RR;
+  if (policy != NULL && stringcmp(policy, "mlfq") == 0) {
+    scheduler_policy = SCHEDULER_POLICY_MLFQ;
+    kprintf("Scheduler: using multi-level feedback queues\n");
+  }
+
+  for (i=0; i<CONFIG_MAX_CPUS; i++) {
     scheduler_current_thread[i] = 0;
+    cpu_local_set_current_thread(i, IDLE_THREAD_TID);
+    spinlock_reset(&scheduler_ready_to_run[i].slock);
+    for (j=0; j<CONFIG_SCHEDULER_LEVELS; j++) {
+      scheduler_ready_to_run[i].level[j].head = -1;
+      scheduler_ready_to_run[i].level[j].tail = -1;
+    }
+    scheduler_ready_to_run[i].bitmap = 0;
+    scheduler_ready_to_run[i].count = 0;
+    scheduler_ready_to_run[i].boost_epoch = 0;
+    scheduler_slice_expired[i] = 0;
+    scheduler_timer_for_timeout[i] = 0;
+    scheduler_next_boost[i] = CONFIG_SCHEDULER_BOOST_PERIOD;
+    memoryset(&scheduler_stats[i], 0, sizeof(scheduler_stats_t));
+  }
+  scheduler_idle_cpus = 0;
 }
 
 /**
- * Adds given thread to scheduler's ready to run list. Doesn't do
- * any synchronization, it is assumed that spinlock to the thread table
- * is held and interrups are disabled when calling this function.
- *
- * @param t thread to add to ready list
- *
+ * Returns the ready queue level thread t is put on. Round robin keeps
+ * every thread on level 0.
  */
+static int scheduler_level_of(TID_t t)
+{
+  if (scheduler_policy == SCHEDULER_POLICY_MLFQ)
+    return thread_table[t].priority;
+  return 0;
+}
 
-void scheduler_add_to_ready_list(TID_t t)
+/**
+ * Returns the length of the timeslice of thread t, in timer ticks.
+ * Under MLFQ lower levels get longer slices, since the threads there
+ * are CPU-bound and switching them often buys nothing.
+ */
+static uint32_t scheduler_timeslice(TID_t t)
 {
-  /* Idle thread should never go into the ready list */
-  KERNEL_ASSERT(t != IDLE_THREAD_TID);
+  uint32_t slice = CONFIG_SCHEDULER_TIMESLICE;
 
-  /* Sanity check */
-  KERNEL_ASSERT(t >= 0 && t < CONFIG_MAX_THREADS);
+  if (scheduler_policy == SCHEDULER_POLICY_MLFQ)
+    slice *= thread_table[t].priority + 1;
+
+  return _get_rand(slice) + slice / 2;
+}
+
+/**
+ * Appends thread t to the end of the given queue. The queue lock must
+ * be held.
+ */
+static void scheduler_queue_append(scheduler_runqueue_t *rq, TID_t t)
+{
+  int level = scheduler_level_of(t);
+  scheduler_level_t *lvl = &rq->level[level];
+
+  thread_table[t].next = -1;
 
-  if (scheduler_ready_to_run.tail < 0) {
+  if (lvl->tail < 0) {
     /* ready queue was empty */
-    scheduler_ready_to_run.head = t;
-    scheduler_ready_to_run.tail = t;
-    thread_table[t].next = -1;
+    lvl->head = t;
+    rq->bitmap |= 1U << level;
   } else {
     /* ready queue was not empty */
-    thread_table[scheduler_ready_to_run.tail].next = t;
-    thread_table[t].next = -1;
-    scheduler_ready_to_run.tail = t;
+    thread_table[lvl->tail].next = t;
   }
+  lvl->tail = t;
+  rq->count++;
 }
 
 /**
- * Removes the first thread from the ready to run list and returns it.
- * if the list was empty, returns the idle thread (TID 0). It is assumed
- * that interrupts are disabled and thread table spinlock is held when
- * this function is called.
- *
- * @return The removed thread.
+ * Removes the first thread of the highest non-empty level of the
+ * given queue and marks it running. A thread that has been waiting
+ * since the last priority boost is reset to its base level. The queue
+ * lock must be held.
  *
+ * @return The removed thread, negative if the queue was empty.
  */
-
-static TID_t scheduler_remove_first_ready(void)
+static TID_t scheduler_queue_pop(scheduler_runqueue_t *rq)
 {
+  scheduler_level_t *lvl;
   TID_t t;
+  int level;
+
+  if (rq->bitmap == 0)
+    return -1;
 
-  t = scheduler_ready_to_run.head;
+  /* Lowest set bit is the highest priority non-empty level */
+  level = __builtin_ctz(rq->bitmap);
+  lvl = &rq->level[level];
+  t = lvl->head;
 
   /* Idle thread should never be on the ready list. */
   KERNEL_ASSERT(t != IDLE_THREAD_TID);
 
-  if(t >= 0) {
+  if (t >= 0) {
     /* Threads in ready queue should be in state Ready */
     KERNEL_ASSERT(thread_table[t].state == THREAD_READY);
-    if(scheduler_ready_to_run.tail == t) {
-      scheduler_ready_to_run.tail = -1;
+    if (lvl->tail == t) {
+      lvl->tail = -1;
+      rq->bitmap &= ~(1U << level);
     }
-    scheduler_ready_to_run.head =
-      thread_table[scheduler_ready_to_run.head].next;
+    lvl->head = thread_table[t].next;
+    thread_table[t].next = -1;
+    thread_table[t].state = THREAD_RUNNING;
+    rq->count--;
 
+    if (thread_table[t].boost_epoch != rq->boost_epoch) {
+      thread_table[t].boost_epoch = rq->boost_epoch;
+      thread_table[t].priority = thread_table[t].base_priority;
+    }
   }
 
-  if(t < 0) {
-    return IDLE_THREAD_TID;
-  } else {
+  return t;
+}
+
+/**
+ * Moves every thread queued on the given CPU to the top level by
+ * splicing the lower level lists onto level 0. The threads get their
+ * base priority back when they are next picked.
+ */
+static void scheduler_boost(scheduler_runqueue_t *rq)
+{
+  scheduler_level_t *top = &rq->level[0];
+  int i;
+
+  spinlock_acquire(&rq->slock);
+
+  for (i = 1; i < CONFIG_SCHEDULER_LEVELS; i++) {
+    if (!(rq->bitmap & (1U << i)))
+      continue;
+
+    if (top->tail < 0)
+      top->head = rq->level[i].head;
+    else
+      thread_table[top->tail].next = rq->level[i].head;
+    top->tail = rq->level[i].tail;
+
+    rq->level[i].head = -1;
+    rq->level[i].tail = -1;
+  }
+  if (rq->bitmap != 0)
+    rq->bitmap = 1;
+  rq->boost_epoch++;
+
+  spinlock_release(&rq->slock);
+}
+
+/**
+ * Makes sure that a thread just queued on the given CPU is noticed by
+ * an idle CPU, since idle CPUs take no timer interrupts. The given
+ * CPU is interrupted if it is idle; otherwise any other idle CPU is,
+ * so that it can steal the thread. The calling CPU is never
+ * interrupted, it runs the scheduler on its own soon enough.
+ */
+static void scheduler_wake_idle(int cpu)
+{
+  uint32_t idle;
+
+  /* Order the queue update before reading the idle mask; pairs with
+     the idle CPU setting its bit before checking the queues */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  idle = scheduler_idle_cpus & ~(1U << _interrupt_getcpu());
+  if (idle == 0)
+    return;
+
+  if (!(idle & (1U << cpu)))
+    cpu = __builtin_ctz(idle);
+  _interrupt_wake_cpu(cpu);
+}
+
+/**
+ * Puts thread t on the ready queue of the CPU it last ran on, or on
+ * the queue of the calling CPU if it has not run yet. The thread table
+ * spinlock must be held.
+ *
+ * @return The CPU whose queue the thread was put on.
+ */
+static int scheduler_enqueue(TID_t t)
+{
+  scheduler_runqueue_t *rq;
+  int cpu;
+
+  /* Idle thread should never go into the ready list */
+  KERNEL_ASSERT(t != IDLE_THREAD_TID);
+
+  /* Sanity check */
+  KERNEL_ASSERT(t >= 0 && t < CONFIG_MAX_THREADS);
+
+  cpu = thread_table[t].cpu;
+  if (cpu < 0 || cpu >= CONFIG_MAX_CPUS) {
+    cpu = _interrupt_getcpu();
+    thread_table[t].cpu = cpu;
+  }
+
+  rq = &scheduler_ready_to_run[cpu];
+  spinlock_acquire(&rq->slock);
+  scheduler_queue_append(rq, t);
+  spinlock_release(&rq->slock);
+
+  return cpu;
+}
+
+/**
+ * Adds given thread to scheduler's ready to run list. The thread is
+ * placed on the queue of the CPU it last ran on, or on the queue of
+ * the calling CPU if it has not run yet, and an idle CPU is woken up
+ * to run it. Doesn't synchronize access to the thread table, it is
+ * assumed that spinlock to the thread table is held and interrups are
+ * disabled when calling this function.
+ *
+ * @param t thread to add to ready list
+ *
+ */
+
+void scheduler_add_to_ready_list(TID_t t)
+{
+  scheduler_wake_idle(scheduler_enqueue(t));
+}
+
+/**
+ * Takes the first thread from the queue of the CPU with the most
+ * ready threads. The queue lengths are read without locking, so the
+ * chosen queue may turn out to be empty once it is locked; in that
+ * case the search is retried a bounded number of times.
+ *
+ * @param this_cpu The stealing CPU, its own queue is skipped.
+ *
+ * @return The stolen thread, negative if nothing could be stolen.
+ */
+static TID_t scheduler_steal(int this_cpu)
+{
+  int attempt, cpu, busiest, max;
+  TID_t t;
+
+  for (attempt = 0; attempt < CONFIG_MAX_CPUS; attempt++) {
+    busiest = -1;
+    max = 0;
+    for (cpu = 0; cpu < CONFIG_MAX_CPUS; cpu++) {
+      if (cpu != this_cpu && scheduler_ready_to_run[cpu].count > max) {
+        max = scheduler_ready_to_run[cpu].count;
+        busiest = cpu;
+      }
+    }
+
+    if (busiest < 0)
+      return -1;
+
+    spinlock_acquire(&scheduler_ready_to_run[busiest].slock);
+    t = scheduler_queue_pop(&scheduler_ready_to_run[busiest]);
+    spinlock_release(&scheduler_ready_to_run[busiest].slock);
+
+    if (t >= 0)
+      return t;
+  }
+
+  return -1;
+}
+
+/**
+ * Picks the next thread for the given CPU: the first thread on its
+ * own queue, or a thread stolen from the busiest other CPU. If no
+ * thread is ready anywhere, returns the idle thread (TID 0). It is
+ * assumed that interrupts are disabled when this function is called.
+ * The returned thread is marked running.
+ *
+ * @return The removed thread.
+ *
+ */
+
+static TID_t scheduler_remove_first_ready(int this_cpu)
+{
+  scheduler_runqueue_t *rq = &scheduler_ready_to_run[this_cpu];
+  TID_t t;
+
+  t = -1;
+  /* Unlocked peek: an empty queue is not worth taking the lock for */
+  if (rq->bitmap != 0) {
+    spinlock_acquire(&rq->slock);
+    t = scheduler_queue_pop(rq);
+    spinlock_release(&rq->slock);
+  }
+
+  if (t >= 0) {
+    scheduler_stats[this_cpu].local_picks++;
+    if (scheduler_idle_cpus & (1U << this_cpu))
+      __atomic_fetch_and(&scheduler_idle_cpus, ~(1U << this_cpu),
+                         __ATOMIC_RELAXED);
+    return t;
+  }
+
+  /* Announce idleness before the last look at the other queues, so
+     that a thread queued after it is seen by scheduler_wake_idle() */
+  __atomic_fetch_or(&scheduler_idle_cpus, 1U << this_cpu, __ATOMIC_SEQ_CST);
+
+  t = scheduler_steal(this_cpu);
+  if (t >= 0) {
+    __atomic_fetch_and(&scheduler_idle_cpus, ~(1U << this_cpu),
+                       __ATOMIC_RELAXED);
+    scheduler_stats[this_cpu].steals++;
+    thread_table[t].cpu = this_cpu;
+    /* Boosts of the old queue no longer concern the thread */
+    thread_table[t].boost_epoch = rq->boost_epoch;
     return t;
   }
+
+  scheduler_stats[this_cpu].idle_picks++;
+  thread_table[IDLE_THREAD_TID].state = THREAD_RUNNING;
+  return IDLE_THREAD_TID;
 }
 
 /**
@@ -118,12 +435,10 @@ static TID_t scheduler_remove_first_ready(void)
 
 void scheduler_add_ready(TID_t t)
 {
-  interrupt_status_t intr_status;
-
   klock_status_t st = klock_lock(&thread_table_klock);
 
-  scheduler_add_to_ready_list(t);
   thread_table[t].state = THREAD_READY;
+  scheduler_add_to_ready_list(t);
 
   klock_open(st, &thread_table_klock);
 }
@@ -138,8 +453,10 @@ void scheduler_add_ready(TID_t t)
  *
  * Scheduler also handles thread table row freeing when thread is
  * DYING and removes threads wishing to sleep (sleeps_on != 0) from
- * ready status and places them SLEEPING. Syncronizes access to thread
- * table by acquiring the thread table spinlock.
+ * ready status and places them SLEEPING. The state change of the
+ * current thread is syncronized with the sleep queue by holding the
+ * thread table spinlock; picking the next thread only takes the ready
+ * queue locks.
  *
  * After selecting new thread for running the scheduler will reset the
  * CP0 timer to cause timer interrupt after thread's timeslice is
@@ -152,6 +469,8 @@ void scheduler_schedule(void)
   TID_t t;
   thread_table_t *current_thread;
   int this_cpu;
+  uint32_t ticks, wakeup, now;
+  int msec;
 
   this_cpu = _interrupt_getcpu();
 
@@ -164,19 +483,151 @@ void scheduler_schedule(void)
   } else if(current_thread->sleeps_on != 0) {
     current_thread->state = THREAD_SLEEPING;
   } else {
-    if(scheduler_current_thread[this_cpu] != IDLE_THREAD_TID)
-      scheduler_add_to_ready_list(scheduler_current_thread[this_cpu]);
     current_thread->state = THREAD_READY;
+    if(scheduler_current_thread[this_cpu] != IDLE_THREAD_TID) {
+      /* Used the whole slice: CPU-bound, drop one level */
+      if(scheduler_slice_expired[this_cpu] &&
+         current_thread->priority < CONFIG_SCHEDULER_LEVELS - 1)
+        current_thread->priority++;
+      /* No need to wake anyone, this CPU picks a thread right away */
+      scheduler_enqueue(scheduler_current_thread[this_cpu]);
+    }
   }
-
-  t = scheduler_remove_first_ready();
-  thread_table[t].state = THREAD_RUNNING;
+  scheduler_slice_expired[this_cpu] = 0;
 
   spinlock_release(&thread_table_klock);
 
+  /* The boost goes by elapsed time, since how often the timer
+     interrupts depends on the timeslices and timeouts */
+  if (scheduler_policy == SCHEDULER_POLICY_MLFQ) {
+    now = rtc_get_msec();
+    if ((int32_t)(now - scheduler_next_boost[this_cpu]) >= 0) {
+      scheduler_boost(&scheduler_ready_to_run[this_cpu]);
+      scheduler_next_boost[this_cpu] = now + CONFIG_SCHEDULER_BOOST_PERIOD;
+    }
+  }
+
+  t = scheduler_remove_first_ready(this_cpu);
+
   scheduler_current_thread[this_cpu] = t;
+  cpu_local_set_current_thread(this_cpu, t);
+
+  /* Schedule timer interrupt to occur after thread timeslice is
+     spent. The idle thread has nothing to be preempted for, so an
+     idle CPU takes no timer interrupts; it is woken by other
+     interrupts instead. Either way the timer must also fire when the
+     next sleep queue timeout expires. */
+  ticks = 0;
+  if (t != IDLE_THREAD_TID)
+    ticks = scheduler_timeslice(t);
+
+  scheduler_timer_for_timeout[this_cpu] = 0;
+  msec = sleepq_next_timeout();
+  if (msec >= 0) {
+    wakeup = timer_ms_to_ticks(msec);
+    if (ticks == 0 || wakeup < ticks) {
+      ticks = wakeup;
+      scheduler_timer_for_timeout[this_cpu] = 1;
+    }
+  }
+
+  if (ticks != 0)
+    timer_set_ticks(ticks);
+}
+
+/**
+ * Checks, without locking, whether the calling CPU could run a thread
+ * other than the idle thread. Used by the idle loop to decide whether
+ * to halt. Interrupts must be disabled.
+ *
+ * @return Non-zero if a thread is ready on this or another CPU.
+ */
+int scheduler_has_ready(void)
+{
+  int cpu;
+
+  if (scheduler_ready_to_run[_interrupt_getcpu()].bitmap != 0)
+    return 1;
+
+  for (cpu = 0; cpu < CONFIG_MAX_CPUS; cpu++) {
+    if (scheduler_ready_to_run[cpu].count > 0)
+      return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * Tells the scheduler that the timer interrupt fired, i.e. that the
+ * thread running on this CPU used up its timeslice or that a sleep
+ * queue timeout is due. Expires the due timeouts. Called from the
+ * timer interrupt handler, with interrupts disabled, right before
+ * scheduler_schedule().
+ */
+void scheduler_timer_expired(void)
+{
+  int this_cpu = _interrupt_getcpu();
+
+  /* A wakeup for a timeout cuts the slice short, it did not run out */
+  if (!scheduler_timer_for_timeout[this_cpu])
+    scheduler_slice_expired[this_cpu] = 1;
+
+  sleepq_expire_timeouts();
+}
+
+/**
+ * Sets the base priority of the given thread. The thread also starts
+ * over on that level; if it is currently queued, the new level takes
+ * effect the next time it is put on a ready queue.
+ *
+ * @param t The thread.
+ * @param priority The new base level, 0 (highest) to
+ * CONFIG_SCHEDULER_LEVELS - 1.
+ *
+ * @return 0 on success, -1 if the priority is out of range.
+ */
+int scheduler_set_priority(TID_t t, int priority)
+{
+  klock_status_t st;
+
+  KERNEL_ASSERT(t >= 0 && t < CONFIG_MAX_THREADS);
+
+  if (priority < 0 || priority >= CONFIG_SCHEDULER_LEVELS)
+    return -1;
+
+  st = klock_lock(&thread_table_klock);
+  thread_table[t].base_priority = priority;
+  thread_table[t].priority = priority;
+  klock_open(st, &thread_table_klock);
+
+  return 0;
+}
 
-  /* Schedule timer interrupt to occur after thread timeslice is spent */
-  timer_set_ticks(_get_rand(CONFIG_SCHEDULER_TIMESLICE) +
-                  CONFIG_SCHEDULER_TIMESLICE / 2);
+/**
+ * Copies the balancing counters of the given CPU.
+ *
+ * @param cpu The CPU whose counters are wanted.
+ * @param stats Where the counters are copied.
+ */
+void scheduler_get_stats(int cpu, scheduler_stats_t *stats)
+{
+  KERNEL_ASSERT(cpu >= 0 && cpu < CONFIG_MAX_CPUS);
+  *stats = scheduler_stats[cpu];
+}
+
+/**
+ * Prints the balancing counters of every CPU if the "debugsched" boot
+ * argument was given.
+ */
+void scheduler_print_stats(void)
+{
+  scheduler_stats_t stats;
+  int cpu;
+
+  for (cpu = 0; cpu < CONFIG_MAX_CPUS; cpu++) {
+    scheduler_get_stats(cpu, &stats);
+    DEBUG("debugsched", "Scheduler: CPU %d: %u local, %u stolen, %u idle, "
+          "%d queued\n", cpu, stats.local_picks, stats.steals,
+          stats.idle_picks, scheduler_ready_to_run[cpu].count);
+  }
 }
@@ -5,11 +5,34 @@
 #ifndef KUDOS_KERNEL_SCHEDULER_H
 #define KUDOS_KERNEL_SCHEDULER_H
 
+#include "lib/types.h"
 #include "kernel/thread.h"
 
+/* Scheduling policies, selected with the "scheduler" boot argument */
+typedef enum {
+  SCHEDULER_POLICY_RR,   /* round robin (default) */
+  SCHEDULER_POLICY_MLFQ  /* multi-level feedback queues */
+} scheduler_policy_t;
+
+/* Per-CPU load balancing counters */
+typedef struct {
+  /* threads taken from the CPU's own ready queue */
+  uint32_t local_picks;
+  /* threads stolen from the ready queue of another CPU */
+  uint32_t steals;
+  /* times nothing was ready anywhere and the idle thread was run */
+  uint32_t idle_picks;
+} scheduler_stats_t;
+
 /* function definitions */
 void scheduler_init(void);
 void scheduler_add_ready(TID_t t);
 void scheduler_schedule(void);
+void scheduler_timer_expired(void);
+int scheduler_has_ready(void);
+int scheduler_set_priority(TID_t t, int priority);
+
+void scheduler_get_stats(int cpu, scheduler_stats_t *stats);
+void scheduler_print_stats(void);
 
 #endif // KUDOS_KERNEL_SCHEDULER_H
@@ -33,6 +33,7 @@ void semaphore_init(void)
   int i;
 
   spinlock_reset(&semaphore_table_slock);
+  spinlock_register(&semaphore_table_slock, "semaphore_table_slock");
   for(i = 0; i < CONFIG_MAX_SEMAPHORES; i++)
     semaphore_table[i].creator = -1;
 }
@@ -126,6 +127,45 @@ void semaphore_P(semaphore_t *sem)
   _interrupt_set_state(intr_status);
 }
 
+/**
+ * Like semaphore_P(), but gives up if the semaphore could not be
+ * lowered within the given time.
+ *
+ * @param sem Semaphore to lower by one.
+ * @param msec Maximum time to wait, in milliseconds.
+ *
+ * @return 0 if the semaphore was lowered, -1 on timeout.
+ */
+
+int semaphore_P_timeout(semaphore_t *sem, uint32_t msec)
+{
+  interrupt_status_t intr_status;
+  int retval = 0;
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&sem->slock);
+
+  sem->value--;
+  if (sem->value < 0) {
+    sleepq_add_timeout(sem, msec);
+    spinlock_release(&sem->slock);
+    thread_switch();
+
+    if (sleepq_timed_out()) {
+      /* We are no longer waiting, so undo our decrement */
+      spinlock_acquire(&sem->slock);
+      sem->value++;
+      spinlock_release(&sem->slock);
+      retval = -1;
+    }
+  } else {
+    spinlock_release(&sem->slock);
+  }
+  _interrupt_set_state(intr_status);
+
+  return retval;
+}
+
 /**
  * Increases the value of the semaphore sem by one. Wakes up
  * one waiter, if needed. 
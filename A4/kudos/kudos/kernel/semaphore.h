@@ -18,6 +18,7 @@ void semaphore_init(void);
 semaphore_t *semaphore_create(int value);
 void semaphore_destroy(semaphore_t *sem);
 void semaphore_P(semaphore_t *sem);
+int semaphore_P_timeout(semaphore_t *sem, uint32_t msec);
 void semaphore_V(semaphore_t *sem);
 
 #endif // KUDOS_KERNEL_SEMAPHORE_H
@@ -9,6 +9,8 @@
 #include "kernel/config.h"
 #include "kernel/interrupt.h"
 #include "kernel/assert.h"
+#include "kernel/timeout.h"
+#include "drivers/metadev.h"
 #include "vm/memory.h"
 
 /** @name Sleep queue
@@ -23,6 +25,23 @@
  * The resources are referenced by memory address. The address is used
  * only as a key, it is never referenced by the sleep queue mechanism.
  *
+ * Every hash table bucket has its own lock, so threads sleeping on
+ * resources in different buckets never contend. Inside a bucket each
+ * resource has its own FIFO of waiters: the first waiter of each
+ * resource is linked to the first waiter of the next resource in the
+ * bucket, and the rest are chained behind it through the next field
+ * of the thread table. Waking a thread thus only looks at the waiters
+ * of other resources once per resource, not once per thread.
+ *
+ * A thread may also sleep with a timeout, after which it is woken even
+ * if the resource did not become available. The timeouts are kept in
+ * a timer wheel (see timeout.c) which is advanced from the timer
+ * interrupt and protected by its own lock. Bucket locks are taken
+ * before the timeout lock. The expiry path therefore takes the
+ * expired timeouts off the wheel first and then locks the bucket,
+ * using a per-thread sleep sequence number to ignore timeouts of
+ * sleeps that ended in between.
+ *
  * @{
  */
 
@@ -32,27 +51,168 @@
 extern thread_table_t thread_table[CONFIG_MAX_THREADS];
 extern klock_t thread_table_klock;
 
-/* spinlock for synchronizing sleep queue table access */
-static spinlock_t sleepq_slock;
+/* One bucket of the sleep queue hashtable */
+typedef struct {
+  /* spinlock for synchronizing access to this bucket */
+  spinlock_t slock;
+  /* first waiter of the first resource, negative if none */
+  TID_t head;
+} sleepq_bucket_t;
+
+/* Sleep queue bookkeeping of a thread */
+typedef struct {
+  /* first waiter of the next resource in the bucket (first waiters only) */
+  TID_t next_resource;
+  /* last waiter for the same resource (first waiters only) */
+  TID_t tail;
+  /* incremented every time the thread goes to sleep */
+  uint32_t seq;
+  /* the current sleep has a timeout armed */
+  int has_timeout;
+  /* the thread was woken by its timeout */
+  int timedout;
+} sleepq_waiter_t;
+
 /* the sleep queue hashtable itself */
-static TID_t sleepq_hashtable[SLEEPQ_HASHTABLE_SIZE];
+static sleepq_bucket_t sleepq_hashtable[SLEEPQ_HASHTABLE_SIZE];
+static sleepq_waiter_t sleepq_waiters[CONFIG_MAX_THREADS];
+
+/* spinlock for synchronizing access to the timer wheel */
+static spinlock_t sleepq_timeout_slock;
+
+/* Import prototype for unsafe function from scheduler.c */
+void scheduler_add_to_ready_list(TID_t t);
 
 
 /* Hash function used to index the sleep queue table */
 #define SLEEPQ_HASH(res) ((virtaddr_t)(res) % SLEEPQ_HASHTABLE_SIZE)
 
 /** Initializes the sleep queue system. The hashtable entries are all
- * set to -1 (NULL) and the spinlock is reset (set to 0=free).
+ * set to -1 (NULL) and the spinlocks are reset (set to 0=free).
  */
 void sleepq_init(void)
 {
   int i;
 
   for (i=0; i<SLEEPQ_HASHTABLE_SIZE; i++) {
-    sleepq_hashtable[i] = -1;
+    sleepq_hashtable[i].head = -1;
+    spinlock_reset(&sleepq_hashtable[i].slock);
+  }
+
+  for (i=0; i<CONFIG_MAX_THREADS; i++) {
+    sleepq_waiters[i].next_resource = -1;
+    sleepq_waiters[i].tail = -1;
+    sleepq_waiters[i].seq = 0;
+    sleepq_waiters[i].has_timeout = 0;
+    sleepq_waiters[i].timedout = 0;
+  }
+
+  /* The clock may not be running yet. The wheel catches up on the
+     first advance, since it is empty until then. */
+  timeout_init(0);
+
+  spinlock_reset(&sleepq_timeout_slock);
+  spinlock_register(&sleepq_timeout_slock, "sleepq_timeout_slock");
+}
+
+/* Finds the waiters for resource in bucket b. Returns the link that
+   points to the first waiter, or the link at the end of the bucket
+   (which is negative) if nobody waits for the resource. The bucket
+   lock must be held. */
+static TID_t *sleepq_find(sleepq_bucket_t *b, virtaddr_t resource)
+{
+  TID_t *link = &b->head;
+
+  while (*link >= 0 && thread_table[*link].sleeps_on != resource)
+    link = &sleepq_waiters[*link].next_resource;
+
+  return link;
+}
+
+/* Removes the first waiter of the resource whose first waiter *link
+   points to. The bucket lock must be held. */
+static TID_t sleepq_pop(TID_t *link)
+{
+  TID_t first = *link;
+  TID_t second = thread_table[first].next;
+
+  if (second >= 0) {
+    /* the second waiter takes the place of the first */
+    sleepq_waiters[second].next_resource = sleepq_waiters[first].next_resource;
+    sleepq_waiters[second].tail = sleepq_waiters[first].tail;
+    *link = second;
+  } else {
+    *link = sleepq_waiters[first].next_resource;
+  }
+
+  thread_table[first].next = -1;
+  return first;
+}
+
+/* Removes thread t from its sleep queue FIFO. The bucket lock must be
+   held. */
+static void sleepq_unlink(sleepq_bucket_t *b, TID_t t)
+{
+  TID_t *link;
+  TID_t first, prev;
+
+  link = sleepq_find(b, thread_table[t].sleeps_on);
+  first = *link;
+  KERNEL_ASSERT(first >= 0);
+
+  if (first == t) {
+    sleepq_pop(link);
+    return;
+  }
+
+  prev = first;
+  while (thread_table[prev].next != t) {
+    prev = thread_table[prev].next;
+    KERNEL_ASSERT(prev >= 0);
+  }
+
+  thread_table[prev].next = thread_table[t].next;
+  if (sleepq_waiters[first].tail == t)
+    sleepq_waiters[first].tail = prev;
+  thread_table[t].next = -1;
+}
+
+/* Adds the current thread to the end of the FIFO of resource in
+   bucket b. The bucket lock must be held. */
+static TID_t sleepq_insert(sleepq_bucket_t *b, void *resource)
+{
+  TID_t my_tid;
+  TID_t *link;
+
+  my_tid = thread_get_current_thread();
+
+  /* Idle thread should never do _anything_ (other than its own wait loop) */
+  KERNEL_ASSERT(my_tid != IDLE_THREAD_TID);
+
+  /* the thread to be added should not have a next entry: */
+  thread_table[my_tid].next = -1;
+  /* A thread that blocks before its timeslice runs out is not
+     CPU-bound, so it goes back to its base scheduling level */
+  thread_table[my_tid].priority = thread_table[my_tid].base_priority;
+  sleepq_waiters[my_tid].seq++;
+  sleepq_waiters[my_tid].has_timeout = 0;
+  sleepq_waiters[my_tid].timedout = 0;
+
+  link = sleepq_find(b, (virtaddr_t)resource);
+  if (*link < 0) {
+    /* first waiter for this resource, put it first in the bucket */
+    sleepq_waiters[my_tid].next_resource = b->head;
+    sleepq_waiters[my_tid].tail = my_tid;
+    b->head = my_tid;
+  } else {
+    /* append to the FIFO of the resource */
+    thread_table[sleepq_waiters[*link].tail].next = my_tid;
+    sleepq_waiters[*link].tail = my_tid;
   }
 
-  spinlock_reset(&sleepq_slock);
+  thread_table[my_tid].sleeps_on = (virtaddr_t)resource;
+
+  return my_tid;
 }
 
 /** Adds the currently running thread into the sleep queue. The thread
@@ -68,100 +228,165 @@ void sleepq_init(void)
  */
 void sleepq_add(void *resource)
 {
-  uint32_t hash;
-  TID_t my_tid;
+  sleepq_bucket_t *b;
 
   /* Interrupts _must_ be disabled when calling this function: */
   if(!_interrupt_is_disabled())
     return;
 
-  hash = SLEEPQ_HASH(resource);
-  my_tid = thread_get_current_thread();
-  /* the thread to be added should not have a next entry: */
-  thread_table[my_tid].next = -1;
-  thread_table[my_tid].sleeps_on = (virtaddr_t)resource; 
+  b = &sleepq_hashtable[SLEEPQ_HASH(resource)];
 
-  /* Idle thread should never do _anything_ (other than its own wait loop) */
-  KERNEL_ASSERT(my_tid != IDLE_THREAD_TID);
+  spinlock_acquire(&b->slock);
+  sleepq_insert(b, resource);
+  spinlock_release(&b->slock);
+}
 
-  spinlock_acquire(&sleepq_slock);
+/** Like sleepq_add(), but the thread is also woken if the resource
+ * does not become available within the given time. After switching,
+ * sleepq_timed_out() tells which of the two happened.
+ *
+ * Note that interrupts must be disabled before calling this function.
+ *
+ * @param resource The resource to wait for
+ * @param msec Maximum time to wait, in milliseconds
+ */
+void sleepq_add_timeout(void *resource, uint32_t msec)
+{
+  sleepq_bucket_t *b;
+  TID_t my_tid;
 
-  /* Add the current thread to the end of the sleepqueue */
-  if (sleepq_hashtable[hash] <= 0) {
-    /* hashtable entry empty */
-    sleepq_hashtable[hash] = my_tid;
-  } else {
-    TID_t prev;
-    /* hashtable entry nonempty, chain to end of linked list */
-    prev = sleepq_hashtable[hash];
-    while (thread_table[prev].next > 0) {
-      prev = thread_table[prev].next;
-    }
-    thread_table[prev].next = my_tid;
-  }
+  /* Interrupts _must_ be disabled when calling this function: */
+  if(!_interrupt_is_disabled())
+    return;
 
-  spinlock_release(&sleepq_slock);
-}
+  b = &sleepq_hashtable[SLEEPQ_HASH(resource)];
 
-/* Import prototype for unsafe function from scheduler.c */
-void scheduler_add_to_ready_list(TID_t t);
+  spinlock_acquire(&b->slock);
+  my_tid = sleepq_insert(b, resource);
+  sleepq_waiters[my_tid].has_timeout = 1;
 
+  spinlock_acquire(&sleepq_timeout_slock);
+  timeout_add(my_tid, rtc_get_msec(), msec, sleepq_waiters[my_tid].seq);
+  spinlock_release(&sleepq_timeout_slock);
 
-/** Wake the first thread waiting for given resource from the sleep
- * queue. If such a thread exists, it is removed from the sleep queue
- * and placed on the scheduler's ready-to-run list.
+  spinlock_release(&b->slock);
+}
+
+/** Returns non-zero if the current thread was last woken from the
+ * sleep queue by its timeout rather than by sleepq_wake().
+ */
+int sleepq_timed_out(void)
+{
+  return sleepq_waiters[thread_get_current_thread()].timedout;
+}
+
+/** Puts the current thread to sleep for the given time. The thread
+ * uses no CPU time while sleeping.
  *
- * @param resource Wake the first thread waiting for this resource
+ * @param msec Time to sleep, in milliseconds
  */
-void sleepq_wake(void *resource)
+void sleepq_sleep(uint32_t msec)
 {
-  uint32_t hash;
   interrupt_status_t intr_state;
-  TID_t first, prev;
-
-  hash = SLEEPQ_HASH(resource);
 
   intr_state = _interrupt_disable();
-  spinlock_acquire(&sleepq_slock);
-
-  /* Find the first entry actually waiting for 'resource', since
-   * multiple resources may hash to the same index. 
-   */
-  prev = -1;
-  first = sleepq_hashtable[hash];
-  while (first > 0 && thread_table[first].sleeps_on != (virtaddr_t)resource) {
-    prev = first;
-    first = thread_table[first].next;
-  }
+  /* Nobody else knows this address, so only the timeout wakes us */
+  sleepq_add_timeout(&sleepq_waiters[thread_get_current_thread()], msec);
+  thread_switch();
+  _interrupt_set_state(intr_state);
+}
 
-  /* First entry with correct resource found */
-  if (first > 0) {
-    /* remove it from the sleep queue */
-    if (prev <= 0) { 
-      /* it was the first entry in the table slot */
-      sleepq_hashtable[hash] = thread_table[first].next;
-    } else {
-      thread_table[prev].next = thread_table[first].next;
+/* Puts the threads of the given list, chained through their next
+   fields, on the ready list. Their sleeps_on fields must already be
+   cleared. */
+static void sleepq_make_ready(TID_t list)
+{
+  TID_t t;
+
+  spinlock_acquire(&thread_table_klock);
+
+  while (list >= 0) {
+    t = list;
+    list = thread_table[t].next;
+    thread_table[t].next = -1;
+
+    if (thread_table[t].state == THREAD_SLEEPING) {
+      thread_table[t].state = THREAD_READY;
+      scheduler_add_to_ready_list(t);
     }
+  }
 
-    /* Clear the sleeps_on field and add the thread to the ready
-     * list (if necessary)
-     */
-    spinlock_acquire(&thread_table_klock);
-
-    thread_table[first].sleeps_on = 0;
-    thread_table[first].next = -1;
-        
-    if (thread_table[first].state == THREAD_SLEEPING) {
-      thread_table[first].state = THREAD_READY;
-      scheduler_add_to_ready_list(first);
+  spinlock_release(&thread_table_klock);
+}
+
+/** Wake at most n threads waiting for given resource from the sleep
+ * queue, in the order they went to sleep. The woken threads are
+ * removed from the sleep queue and placed on the scheduler's
+ * ready-to-run list, all under a single acquisition of the thread
+ * table lock.
+ *
+ * @param resource Wake threads waiting for this resource
+ * @param n Maximum number of threads to wake
+ *
+ * @return The number of threads woken
+ */
+int sleepq_wake_n(void *resource, int n)
+{
+  sleepq_bucket_t *b;
+  interrupt_status_t intr_state;
+  TID_t *link;
+  TID_t t, woken, last;
+  int count = 0;
+
+  b = &sleepq_hashtable[SLEEPQ_HASH(resource)];
+  woken = last = -1;
+
+  intr_state = _interrupt_disable();
+  spinlock_acquire(&b->slock);
+
+  link = sleepq_find(b, (virtaddr_t)resource);
+  while (count < n && *link >= 0) {
+    t = sleepq_pop(link);
+
+    /* Clear the sleeps_on field while the bucket is locked, so that
+     * an expiring timeout can tell the sleep is over. */
+    thread_table[t].sleeps_on = 0;
+    if (sleepq_waiters[t].has_timeout) {
+      sleepq_waiters[t].has_timeout = 0;
+      spinlock_acquire(&sleepq_timeout_slock);
+      timeout_cancel(t);
+      spinlock_release(&sleepq_timeout_slock);
     }
 
-    spinlock_release(&thread_table_klock);
+    /* Keep the woken threads in order */
+    if (last < 0)
+      woken = t;
+    else
+      thread_table[last].next = t;
+    last = t;
+    count++;
   }
 
-  spinlock_release(&sleepq_slock);
+  spinlock_release(&b->slock);
+
+  /* Add the threads to the ready list (if necessary) */
+  if (woken >= 0)
+    sleepq_make_ready(woken);
+
   _interrupt_set_state(intr_state);
+
+  return count;
+}
+
+/** Wake the first thread waiting for given resource from the sleep
+ * queue. If such a thread exists, it is removed from the sleep queue
+ * and placed on the scheduler's ready-to-run list.
+ *
+ * @param resource Wake the first thread waiting for this resource
+ */
+void sleepq_wake(void *resource)
+{
+  sleepq_wake_n(resource, 1);
 }
 
 
@@ -173,61 +398,78 @@ void sleepq_wake(void *resource)
  */
 void sleepq_wake_all(void *resource)
 {
-  uint32_t hash;
-  interrupt_status_t intr_state;
-  TID_t first, prev, wake;
+  sleepq_wake_n(resource, CONFIG_MAX_THREADS);
+}
 
-  hash = SLEEPQ_HASH(resource);
+/** Wakes every thread whose sleep queue timeout has expired. Called
+ * from the timer interrupt handler.
+ */
+void sleepq_expire_timeouts(void)
+{
+  interrupt_status_t intr_state;
+  sleepq_bucket_t *b;
+  virtaddr_t resource;
+  uint32_t seq;
+  TID_t t;
 
   intr_state = _interrupt_disable();
-  spinlock_acquire(&sleepq_slock);
-
-  /* init linked list traversing variables to the first item */
-  prev = -1;
-  first = sleepq_hashtable[hash];
-
-  /* Traverse the whole linked list in order to wake up all threads */
-  while (first > 0) {
-
-    /* Find the next entry actually waiting for 'resource', since
-     * multiple resources may hash to the same index. 
-     */
-    while (first > 0 
-           && thread_table[first].sleeps_on != (virtaddr_t)resource) {
-      prev = first;
-      first = thread_table[first].next;
-    }
 
-    /* Next entry w/ resource found */
-    if (first > 0) {
-      wake = first;
-      /* remove it from the sleep queue */
-      if (prev <= 0) { 
-        /* it was the first entry in the table slot */
-        first = sleepq_hashtable[hash] = thread_table[wake].next;
-      } else {
-        first = thread_table[prev].next = thread_table[wake].next;
-      }
-
-      /* Clear the sleeps_on field and add the thread to the ready
-       * list (if necessary)
-       */
-      spinlock_acquire(&thread_table_klock);
-
-      thread_table[wake].sleeps_on = 0;
-      thread_table[wake].next      = -1;
-        
-      if (thread_table[wake].state == THREAD_SLEEPING) {
-        thread_table[wake].state = THREAD_READY;
-        scheduler_add_to_ready_list(wake);
-      }
-
-      spinlock_release(&thread_table_klock);
+  spinlock_acquire(&sleepq_timeout_slock);
+  timeout_advance(rtc_get_msec());
+  spinlock_release(&sleepq_timeout_slock);
+
+  for (;;) {
+    spinlock_acquire(&sleepq_timeout_slock);
+    t = timeout_pop_expired(&seq);
+    spinlock_release(&sleepq_timeout_slock);
+
+    if (t < 0)
+      break;
+
+    resource = thread_table[t].sleeps_on;
+    if (resource == 0)
+      continue;
+
+    b = &sleepq_hashtable[SLEEPQ_HASH(resource)];
+    spinlock_acquire(&b->slock);
+
+    /* The thread may have been woken, and even gone back to sleep,
+     * since its timeout was taken off the wheel */
+    if (thread_table[t].sleeps_on != resource ||
+        sleepq_waiters[t].seq != seq) {
+      spinlock_release(&b->slock);
+      continue;
     }
+
+    sleepq_unlink(b, t);
+    thread_table[t].sleeps_on = 0;
+    sleepq_waiters[t].has_timeout = 0;
+    sleepq_waiters[t].timedout = 1;
+
+    spinlock_release(&b->slock);
+
+    sleepq_make_ready(t);
   }
 
-  spinlock_release(&sleepq_slock);
   _interrupt_set_state(intr_state);
 }
 
+/** Returns the number of milliseconds until sleepq_expire_timeouts()
+ * next has work to do, or a negative value if no thread is sleeping
+ * with a timeout.
+ */
+int sleepq_next_timeout(void)
+{
+  interrupt_status_t intr_state;
+  int msec;
+
+  intr_state = _interrupt_disable();
+  spinlock_acquire(&sleepq_timeout_slock);
+  msec = timeout_next(rtc_get_msec());
+  spinlock_release(&sleepq_timeout_slock);
+  _interrupt_set_state(intr_state);
+
+  return msec;
+}
+
 /** @} */
@@ -5,10 +5,18 @@
 #ifndef KUDOS_KERNEL_SLEEPQ_H
 #define KUDOS_KERNEL_SLEEPQ_H
 
+#include "lib/types.h"
+
 /* Prototypes for sleep queue functions */
 void sleepq_init(void);
 void sleepq_add(void *resource);
+void sleepq_add_timeout(void *resource, uint32_t msec);
+int sleepq_timed_out(void);
+void sleepq_sleep(uint32_t msec);
 void sleepq_wake(void *resource);
 void sleepq_wake_all(void *resource);
+int sleepq_wake_n(void *resource, int n);
+void sleepq_expire_timeouts(void);
+int sleepq_next_timeout(void);
 
 #endif // KUDOS_KERNEL_SLEEPQ_H
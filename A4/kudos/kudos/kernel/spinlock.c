@@ -0,0 +1,162 @@
+/*
+ * Spinlocks
+ */
+
+#include "kernel/spinlock.h"
+#include "kernel/config.h"
+#include "lib/libc.h"
+#include "lib/debug.h"
+
+/** @name Spinlocks
+ *
+ * Spinlocks for short critical sections, also between CPUs. Interrupts
+ * must be disabled while a spinlock is held.
+ *
+ * Two algorithms are available, chosen with CONFIG_SPINLOCK_TICKET in
+ * kernel/config.h. A ticket lock hands the lock to the waiters in the
+ * order they arrived, so no CPU can starve, and the waiters only read
+ * the lock while spinning. The test-and-set lock is the simpler,
+ * unfair alternative; it only retries the atomic exchange once the
+ * lock has been seen free.
+ *
+ * With CONFIG_SPINLOCK_STATS every lock also counts its acquisitions,
+ * how many of them had to wait and for how many spins, and its
+ * longest hold time. Locks given a name with spinlock_register() are
+ * listed by spinlock_print_stats().
+ *
+ * @{
+ */
+
+/* Import architecture specific helpers */
+extern void _spinlock_pause(void);
+extern uint32_t _spinlock_cycles(void);
+
+#if CONFIG_SPINLOCK_STATS
+/* Locks listed by spinlock_print_stats() */
+static spinlock_t *spinlock_registry[CONFIG_SPINLOCK_STATS_MAX];
+static int spinlock_registered = 0;
+#endif
+
+/**
+ * Initializes the spinlock as free. Clears its statistics, but keeps
+ * its name.
+ */
+void spinlock_reset(spinlock_t *slock)
+{
+#if CONFIG_SPINLOCK_STATS
+  const char *name = slock->stats.name;
+  memoryset(&slock->stats, 0, sizeof(spinlock_stats_t));
+  slock->stats.name = name;
+#endif
+
+#if CONFIG_SPINLOCK_TICKET
+  slock->next = 0;
+  slock->owner = 0;
+#else
+  slock->locked = 0;
+#endif
+}
+
+/**
+ * Acquires the spinlock, spinning until it is free.
+ */
+void spinlock_acquire(spinlock_t *slock)
+{
+  uint32_t spins = 0;
+
+#if CONFIG_SPINLOCK_TICKET
+  uint32_t ticket = __atomic_fetch_add(&slock->next, 1, __ATOMIC_RELAXED);
+
+  while (__atomic_load_n(&slock->owner, __ATOMIC_ACQUIRE) != ticket) {
+    _spinlock_pause();
+    spins++;
+  }
+#else
+  while (__atomic_exchange_n(&slock->locked, 1, __ATOMIC_ACQUIRE) != 0) {
+    /* Wait with plain reads, so the cache line is not bounced around */
+    while (slock->locked != 0) {
+      _spinlock_pause();
+      spins++;
+    }
+  }
+#endif
+
+#if CONFIG_SPINLOCK_STATS
+  slock->stats.acquisitions++;
+  if (spins > 0) {
+    slock->stats.contended++;
+    slock->stats.spins += spins;
+  }
+  slock->stats.acquired_at = _spinlock_cycles();
+#else
+  spins = spins;
+#endif
+}
+
+/**
+ * Releases the spinlock, which must be held by the caller.
+ */
+void spinlock_release(spinlock_t *slock)
+{
+#if CONFIG_SPINLOCK_STATS
+  uint32_t held = _spinlock_cycles() - slock->stats.acquired_at;
+  if (held > slock->stats.max_hold)
+    slock->stats.max_hold = held;
+#endif
+
+#if CONFIG_SPINLOCK_TICKET
+  __atomic_store_n(&slock->owner, slock->owner + 1, __ATOMIC_RELEASE);
+#else
+  __atomic_store_n(&slock->locked, 0, __ATOMIC_RELEASE);
+#endif
+}
+
+/**
+ * Gives the spinlock a name and lists it in spinlock_print_stats().
+ * Does nothing unless CONFIG_SPINLOCK_STATS is enabled.
+ *
+ * @param slock The spinlock.
+ * @param name Name to print; must stay valid.
+ */
+void spinlock_register(spinlock_t *slock, const char *name)
+{
+#if CONFIG_SPINLOCK_STATS
+  int i;
+
+  slock->stats.name = name;
+
+  /* Locks that are reinitialized may be registered again */
+  for (i = 0; i < spinlock_registered; i++) {
+    if (spinlock_registry[i] == slock)
+      return;
+  }
+
+  if (spinlock_registered < CONFIG_SPINLOCK_STATS_MAX)
+    spinlock_registry[spinlock_registered++] = slock;
+#else
+  slock = slock;
+  name = name;
+#endif
+}
+
+/**
+ * Prints the statistics of the registered spinlocks, when the
+ * "debuglocks" boot argument is given.
+ */
+void spinlock_print_stats(void)
+{
+#if CONFIG_SPINLOCK_STATS
+  int i;
+  spinlock_stats_t *s;
+
+  for (i = 0; i < spinlock_registered; i++) {
+    s = &spinlock_registry[i]->stats;
+    DEBUG("debuglocks",
+          "Spinlock %s: %u acquisitions, %u contended, %u spins, "
+          "max hold %u cycles\n",
+          s->name, s->acquisitions, s->contended, s->spins, s->max_hold);
+  }
+#endif
+}
+
+/** @} */
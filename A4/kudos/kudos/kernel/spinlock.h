@@ -5,10 +5,40 @@
 #ifndef KUDOS_KERNEL_SPINLOCK_H
 #define KUDOS_KERNEL_SPINLOCK_H
 
-typedef int spinlock_t;
+#include "lib/types.h"
+#include "kernel/config.h"
+
+#if CONFIG_SPINLOCK_STATS
+/* Contention counters of one spinlock */
+typedef struct {
+  const char *name;     /* set by spinlock_register(), NULL if unnamed */
+  uint32_t acquisitions;
+  uint32_t contended;   /* acquisitions that had to wait */
+  uint32_t spins;       /* iterations of the wait loop */
+  uint32_t max_hold;    /* longest hold time, in CPU cycles */
+  uint32_t acquired_at; /* cycle counter when last acquired */
+} spinlock_stats_t;
+#endif
+
+/* A spinlock. All zero bits is a free lock, so statically allocated
+   locks need no explicit reset. */
+typedef struct {
+#if CONFIG_SPINLOCK_TICKET
+  volatile uint32_t next;   /* next ticket to hand out */
+  volatile uint32_t owner;  /* ticket now holding the lock */
+#else
+  volatile uint32_t locked;
+#endif
+#if CONFIG_SPINLOCK_STATS
+  spinlock_stats_t stats;
+#endif
+} spinlock_t;
 
 void spinlock_reset(spinlock_t *slock);
 void spinlock_acquire(spinlock_t *slock);
 void spinlock_release(spinlock_t *slock);
 
+void spinlock_register(spinlock_t *slock, const char *name);
+void spinlock_print_stats(void);
+
 #endif // KUDOS_KERNEL_SPINLOCK_H
@@ -11,6 +11,7 @@
 #include "kernel/config.h"
 #include "kernel/interrupt.h"
 #include "kernel/idle.h"
+#include "kernel/cpulocal.h"
 
 /** @name Thread library
  *
@@ -30,9 +31,6 @@ int sleep_resource;
 /* Thread stack areas for kernel threads */
 char thread_stack_areas[CONFIG_THREAD_STACKSIZE * CONFIG_MAX_THREADS];
 
-/* Import running thread id table from scheduler */
-extern TID_t scheduler_current_thread[CONFIG_MAX_CPUS];
-
 /** Initializes the threading system. Does this by setting all thread
  *  table entry states to THREAD_FREE. Called only once before any
  *  threads are created.
@@ -49,6 +47,7 @@ void thread_table_init(void)
   KERNEL_ASSERT(sizeof(thread_table_t) == 64);
 
   klock_init(&thread_table_klock);
+  spinlock_register(&thread_table_klock, "thread_table_klock");
 
   /* Init all entries to 'NULL' */
   for (i=0; i<CONFIG_MAX_THREADS; i++) {
@@ -63,6 +62,10 @@ void thread_table_init(void)
     thread_table[i].attribs      = 0;
     thread_table[i].pid   = -1;
     thread_table[i].next         = -1;
+    thread_table[i].cpu          = -1;
+    thread_table[i].priority     = 0;
+    thread_table[i].base_priority = 0;
+    thread_table[i].boost_epoch  = 0;
   }
 
   /* Setup Idle Thread */
@@ -139,6 +142,10 @@ TID_t thread_create(void (*func)(uint64_t), uint64_t arg)
   thread_table[tid].attribs      = 0;
   thread_table[tid].pid          = -1;
   thread_table[tid].next         = -1;
+  thread_table[tid].cpu          = -1;
+  thread_table[tid].priority     = 0;
+  thread_table[tid].base_priority = 0;
+  thread_table[tid].boost_epoch  = 0;
 
   /* Make sure that we always have a valid back reference on context chain */
   thread_table[tid].context->prev_context = thread_table[tid].context;
@@ -186,23 +193,16 @@ void thread_switch(void)
 
 /**
  * Return the TID of the calling thread.
- * Finds out what is the TID of the thread calling this function.
+ * Finds out what is the TID of the thread calling this function. The
+ * TID is read from the per-CPU block in a single load, so interrupts
+ * need not be disabled.
  *
  * @return Thread ID of the calling thread.
  */
 
 TID_t thread_get_current_thread(void)
 {
-  TID_t t;
-  interrupt_status_t intr_status;
-
-  intr_status = _interrupt_disable();
-
-  t = scheduler_current_thread[_interrupt_getcpu()];
-
-  _interrupt_set_state(intr_status);
-
-  return t;
+  return _cpu_local_current_thread();
 }
 
 /**
@@ -228,16 +228,7 @@ thread_table_t *thread_get_thread_entry(TID_t tid)
 
 thread_table_t *thread_get_current_thread_entry(void)
 {
-  TID_t t;
-  interrupt_status_t intr_status;
-
-  intr_status = _interrupt_disable();
-
-  t = scheduler_current_thread[_interrupt_getcpu()];
-
-  _interrupt_set_state(intr_status);
-
-  return thread_get_thread_entry(t);
+  return _cpu_local_current_thread_entry();
 }
 
 /**
@@ -34,13 +34,14 @@ typedef struct {
   /* for traps (syscalls), if applicable */
   context_t *user_context;
 
-  /* thread state */
-  thread_state_t state;
   /* which resource this thread sleeps on (0 for none) */
-  uint32_t sleeps_on;
+  virtaddr_t sleeps_on;
   /* pointer to this thread's pagetable */
   pagetable_t *pagetable;
 
+  /* thread state */
+  thread_state_t state;
+
   /* PID. Currently not used for anything, but might be useful
      if process table is implemented. */
   pid_t pid;
@@ -50,6 +51,16 @@ typedef struct {
   /* Attributes */
   uint32_t attribs;
 
+  /* CPU whose ready queue this thread is put on (<0 = not run yet) */
+  int cpu;
+
+  /* Current scheduling level (0 = highest) and the level the thread
+     returns to when it blocks. Only used by the MLFQ scheduler. */
+  uint8_t priority;
+  uint8_t base_priority;
+  /* Priority boost of the ready queue last seen by this thread */
+  uint8_t boost_epoch;
+
   /* Internal thread structure */
   _kthread_t thread_data;
 
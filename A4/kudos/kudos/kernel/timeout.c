@@ -0,0 +1,354 @@
+/*
+ * Thread timeouts (timer wheel)
+ */
+
+#include "kernel/timeout.h"
+#include "kernel/config.h"
+#include "kernel/assert.h"
+
+/** @name Timeouts
+ *
+ * This module keeps track of when sleeping threads must be woken up,
+ * using a hierarchical timer wheel. Each thread has at most one
+ * pending timeout. Time is counted in milliseconds.
+ *
+ * Level 0 of the wheel has one slot per millisecond for the next
+ * TIMEOUT_WHEEL_SIZE milliseconds; each higher level has slots that
+ * are TIMEOUT_WHEEL_SIZE times longer. A timeout is put on the lowest
+ * level that reaches its expiry time. Whenever the current time
+ * crosses the boundary of a higher level slot, the timeouts in that
+ * slot are moved (cascaded) down. Adding and cancelling a timeout is
+ * O(1), and every timeout is cascaded at most once per level, so
+ * expiring is O(1) amortized.
+ *
+ * Expired timeouts are moved to a separate list, from which the
+ * caller takes them one at a time with timeout_pop_expired(). Each
+ * timeout carries a cookie chosen by the caller, which lets it tell
+ * whether the expired timeout still matters once it has taken its own
+ * locks.
+ *
+ * The module does no locking of its own; the sleep queue, its only
+ * user, serializes all calls with its timeout lock.
+ *
+ * @{
+ */
+
+#define TIMEOUT_WHEEL_BITS   6
+#define TIMEOUT_WHEEL_SIZE   (1 << TIMEOUT_WHEEL_BITS)
+#define TIMEOUT_WHEEL_MASK   (TIMEOUT_WHEEL_SIZE - 1)
+#define TIMEOUT_WHEEL_LEVELS 4
+
+/* Longest timeout the wheel can hold, about 4.6 hours. Longer
+   timeouts are shortened to this. */
+#define TIMEOUT_MAX_MSEC \
+  ((1U << (TIMEOUT_WHEEL_BITS * TIMEOUT_WHEEL_LEVELS)) - 1)
+
+/* Value of the level field of a timeout on the expired list */
+#define TIMEOUT_EXPIRED TIMEOUT_WHEEL_LEVELS
+
+typedef struct {
+  uint32_t expires; /* expiry time in milliseconds */
+  uint32_t cookie;  /* given by the caller, returned on expiry */
+  TID_t next;       /* next timeout in the same list, negative if none */
+  TID_t prev;       /* previous timeout in the same list, negative if none */
+  int level;        /* wheel level or TIMEOUT_EXPIRED, negative if the
+                       timeout is not armed */
+  int slot;
+} timeout_entry_t;
+
+/** Pending timeout of each thread */
+static timeout_entry_t timeout_table[CONFIG_MAX_THREADS];
+
+/** Heads of the timeout lists of each slot, negative if empty */
+static TID_t timeout_wheel[TIMEOUT_WHEEL_LEVELS][TIMEOUT_WHEEL_SIZE];
+
+/** Bit i of word l is set iff slot i of level l is non-empty */
+static uint64_t timeout_occupied[TIMEOUT_WHEEL_LEVELS];
+
+/** Expired timeouts not yet taken by timeout_pop_expired() */
+static TID_t timeout_expired;
+
+/** Time up to which the wheel has been processed */
+static uint32_t timeout_now;
+
+/** Number of timeouts on the wheel */
+static int timeout_count;
+
+/**
+ * Initializes the timer wheel.
+ *
+ * @param now The current time in milliseconds.
+ */
+void timeout_init(uint32_t now)
+{
+  int i, j;
+
+  for (i = 0; i < CONFIG_MAX_THREADS; i++) {
+    timeout_table[i].next = -1;
+    timeout_table[i].prev = -1;
+    timeout_table[i].level = -1;
+  }
+
+  for (i = 0; i < TIMEOUT_WHEEL_LEVELS; i++) {
+    for (j = 0; j < TIMEOUT_WHEEL_SIZE; j++)
+      timeout_wheel[i][j] = -1;
+    timeout_occupied[i] = 0;
+  }
+
+  timeout_expired = -1;
+  timeout_now = now;
+  timeout_count = 0;
+}
+
+/* Puts an armed timeout on the wheel level and slot matching its
+   expiry time. */
+static void timeout_insert(TID_t t)
+{
+  timeout_entry_t *e = &timeout_table[t];
+  uint32_t delta = e->expires - timeout_now;
+  int level = 0;
+
+  while (level < TIMEOUT_WHEEL_LEVELS - 1 &&
+         delta >= (1U << (TIMEOUT_WHEEL_BITS * (level + 1))))
+    level++;
+
+  e->level = level;
+  e->slot = (e->expires >> (TIMEOUT_WHEEL_BITS * level)) & TIMEOUT_WHEEL_MASK;
+  e->prev = -1;
+  e->next = timeout_wheel[level][e->slot];
+  if (e->next >= 0)
+    timeout_table[e->next].prev = t;
+  timeout_wheel[level][e->slot] = t;
+  timeout_occupied[level] |= (uint64_t)1 << e->slot;
+}
+
+/* Takes a timeout off the wheel or the expired list. */
+static void timeout_unlink(TID_t t)
+{
+  timeout_entry_t *e = &timeout_table[t];
+  TID_t *head;
+
+  if (e->level == TIMEOUT_EXPIRED)
+    head = &timeout_expired;
+  else
+    head = &timeout_wheel[e->level][e->slot];
+
+  if (e->prev >= 0)
+    timeout_table[e->prev].next = e->next;
+  else
+    *head = e->next;
+
+  if (e->next >= 0)
+    timeout_table[e->next].prev = e->prev;
+
+  if (e->level != TIMEOUT_EXPIRED && *head < 0)
+    timeout_occupied[e->level] &= ~((uint64_t)1 << e->slot);
+
+  e->next = -1;
+  e->prev = -1;
+  e->level = -1;
+}
+
+/**
+ * Arms a timeout for thread t, replacing any pending one.
+ *
+ * @param t The thread.
+ * @param now The current time in milliseconds.
+ * @param msec Milliseconds until the timeout expires, at least 1.
+ * @param cookie Returned by timeout_pop_expired() for this timeout.
+ */
+void timeout_add(TID_t t, uint32_t now, uint32_t msec, uint32_t cookie)
+{
+  KERNEL_ASSERT(t >= 0 && t < CONFIG_MAX_THREADS);
+
+  timeout_cancel(t);
+
+  /* The wheel may lag behind now; keep the expiry within its reach */
+  if (msec == 0)
+    msec = 1;
+  if (msec > TIMEOUT_MAX_MSEC - (now - timeout_now))
+    msec = TIMEOUT_MAX_MSEC - (now - timeout_now);
+
+  timeout_table[t].expires = now + msec;
+  timeout_table[t].cookie = cookie;
+  timeout_insert(t);
+  timeout_count++;
+}
+
+/**
+ * Disarms the pending timeout of thread t, also if it has expired but
+ * not been taken by timeout_pop_expired() yet.
+ *
+ * @return 1 if a timeout was pending, 0 otherwise.
+ */
+int timeout_cancel(TID_t t)
+{
+  KERNEL_ASSERT(t >= 0 && t < CONFIG_MAX_THREADS);
+
+  if (timeout_table[t].level < 0)
+    return 0;
+
+  if (timeout_table[t].level != TIMEOUT_EXPIRED)
+    timeout_count--;
+  timeout_unlink(t);
+  return 1;
+}
+
+/* Moves the timeouts of the current slot of the given level down to
+   the lower levels. */
+static void timeout_cascade(int level)
+{
+  int slot = (timeout_now >> (TIMEOUT_WHEEL_BITS * level)) & TIMEOUT_WHEEL_MASK;
+  TID_t t, next;
+
+  t = timeout_wheel[level][slot];
+  timeout_wheel[level][slot] = -1;
+  timeout_occupied[level] &= ~((uint64_t)1 << slot);
+
+  while (t >= 0) {
+    next = timeout_table[t].next;
+    timeout_insert(t);
+    t = next;
+  }
+}
+
+/* Returns the time of the next wheel event after timeout_now: the
+   next non-empty level 0 slot, or the next slot boundary of the
+   lowest non-empty higher level, where that level is cascaded. The
+   wheel must hold timeouts. */
+static uint32_t timeout_next_event(void)
+{
+  uint64_t bits;
+  uint32_t next, boundary, shift;
+  int level;
+
+  next = timeout_now + TIMEOUT_MAX_MSEC;
+
+  bits = timeout_occupied[0];
+  if (bits != 0) {
+    /* Rotate so that bit 0 is the slot after the current one */
+    shift = (timeout_now + 1) & TIMEOUT_WHEEL_MASK;
+    if (shift != 0)
+      bits = (bits >> shift) | (bits << (TIMEOUT_WHEEL_SIZE - shift));
+    next = timeout_now + 1 + __builtin_ctzll(bits);
+  }
+
+  /* Boundaries of higher levels are also boundaries of the lower
+     ones, so the lowest non-empty level comes first */
+  for (level = 1; level < TIMEOUT_WHEEL_LEVELS; level++) {
+    if (timeout_occupied[level] != 0) {
+      shift = TIMEOUT_WHEEL_BITS * level;
+      boundary = ((timeout_now >> shift) + 1) << shift;
+      if ((int32_t)(boundary - next) < 0)
+        next = boundary;
+      break;
+    }
+  }
+
+  return next;
+}
+
+/**
+ * Advances the wheel to the given time and moves every timeout that
+ * expired on the way to the expired list. The wheel jumps from one
+ * event to the next, so the cost does not depend on how far behind
+ * it is.
+ *
+ * @param now The current time in milliseconds.
+ */
+void timeout_advance(uint32_t now)
+{
+  TID_t t, next;
+  uint32_t event;
+  int level, slot;
+
+  /* Nothing to expire, the wheel can jump straight to now */
+  if (timeout_count == 0) {
+    timeout_now = now;
+    return;
+  }
+
+  while ((int32_t)(now - timeout_now) > 0) {
+    /* Skip the empty stretch before the next event */
+    event = timeout_next_event();
+    if ((int32_t)(event - now) > 0) {
+      timeout_now = now;
+      break;
+    }
+    timeout_now = event;
+
+    for (level = 1; level < TIMEOUT_WHEEL_LEVELS; level++) {
+      if (timeout_now & ((1U << (TIMEOUT_WHEEL_BITS * level)) - 1))
+        break;
+      timeout_cascade(level);
+    }
+
+    slot = timeout_now & TIMEOUT_WHEEL_MASK;
+    t = timeout_wheel[0][slot];
+    while (t >= 0) {
+      next = timeout_table[t].next;
+      timeout_unlink(t);
+      timeout_count--;
+
+      timeout_table[t].level = TIMEOUT_EXPIRED;
+      timeout_table[t].prev = -1;
+      timeout_table[t].next = timeout_expired;
+      if (timeout_expired >= 0)
+        timeout_table[timeout_expired].prev = t;
+      timeout_expired = t;
+
+      t = next;
+    }
+
+    if (timeout_count == 0) {
+      timeout_now = now;
+      break;
+    }
+  }
+}
+
+/**
+ * Takes one timeout off the expired list. The timeout is no longer
+ * armed afterwards.
+ *
+ * @param cookie Set to the cookie the timeout was armed with.
+ *
+ * @return The thread of the timeout, negative if the list is empty.
+ */
+TID_t timeout_pop_expired(uint32_t *cookie)
+{
+  TID_t t = timeout_expired;
+
+  if (t < 0)
+    return -1;
+
+  *cookie = timeout_table[t].cookie;
+  timeout_unlink(t);
+  return t;
+}
+
+/**
+ * Returns the number of milliseconds until timeout_advance() next has
+ * work to do: expiring a timeout or cascading a higher level. The
+ * latter may happen before any timeout actually expires.
+ *
+ * @param now The current time in milliseconds.
+ *
+ * @return Milliseconds until the next wheel event (0 if overdue),
+ * negative if no timeouts are armed.
+ */
+int timeout_next(uint32_t now)
+{
+  uint32_t next;
+
+  if (timeout_count == 0)
+    return -1;
+
+  next = timeout_next_event();
+
+  if ((int32_t)(next - now) <= 0)
+    return 0;
+  return next - now;
+}
+
+/** @} */
@@ -0,0 +1,18 @@
+/*
+ * Thread timeouts (timer wheel)
+ */
+
+#ifndef KUDOS_KERNEL_TIMEOUT_H
+#define KUDOS_KERNEL_TIMEOUT_H
+
+#include "lib/types.h"
+#include "kernel/thread.h"
+
+void timeout_init(uint32_t now);
+void timeout_add(TID_t t, uint32_t now, uint32_t msec, uint32_t cookie);
+int timeout_cancel(TID_t t);
+void timeout_advance(uint32_t now);
+TID_t timeout_pop_expired(uint32_t *cookie);
+int timeout_next(uint32_t now);
+
+#endif // KUDOS_KERNEL_TIMEOUT_H
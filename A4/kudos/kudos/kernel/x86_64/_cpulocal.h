@@ -0,0 +1,49 @@
+/*
+ * Per-CPU data
+ */
+
+#ifndef KUDOS_KERNEL_X86_64__CPULOCAL_H
+#define KUDOS_KERNEL_X86_64__CPULOCAL_H
+
+/* Included from kernel/cpulocal.h only, after cpu_local_t */
+
+#include <asm.h>
+
+/* The per-CPU block is reached through the GS segment base. Nothing
+ * in KUDOS loads the GS selector, which would reset the base. */
+#define MSR_GS_BASE 0xC0000101
+
+/* Makes the given block the per-CPU block of the calling CPU */
+static inline void _cpu_local_load(cpu_local_t *cl)
+{
+  _wrmsr(MSR_GS_BASE, (uint64_t)cl);
+}
+
+static inline TID_t _cpu_local_current_thread(void)
+{
+  TID_t t;
+
+  asm volatile("movl %%gs:%c1, %0" : "=r"(t)
+               : "i"(__builtin_offsetof(cpu_local_t, current_thread)));
+  return t;
+}
+
+static inline thread_table_t *_cpu_local_current_thread_entry(void)
+{
+  thread_table_t *entry;
+
+  asm volatile("movq %%gs:%c1, %0" : "=r"(entry)
+               : "i"(__builtin_offsetof(cpu_local_t, current_thread_entry)));
+  return entry;
+}
+
+static inline int _cpu_local_cpu(void)
+{
+  int cpu;
+
+  asm volatile("movl %%gs:%c1, %0" : "=r"(cpu)
+               : "i"(__builtin_offsetof(cpu_local_t, cpu)));
+  return cpu;
+}
+
+#endif // KUDOS_KERNEL_X86_64__CPULOCAL_H
@@ -1,17 +1,19 @@
 /*
- * Spinlock implementation
+ * Spinlock helpers
  */
 
+#include <asm.h>
 #include "kernel/spinlock.h"
 
-/* Initialises the spinlock */
-void spinlock_reset(spinlock_t *slock)
+/* Tells the CPU it is in a spin-wait loop, which saves power and
+   avoids a memory order violation when the loop exits */
+void _spinlock_pause(void)
 {
-  *slock = 0;
+  asm volatile("pause" ::: "memory");
 }
 
-/* Release lock by setting it to 0 */
-void spinlock_release(spinlock_t *slock)
+/* Cycle counter used for the hold time statistics */
+uint32_t _spinlock_cycles(void)
 {
-  *slock = 0;
+  return (uint32_t)_rdtsc();
 }
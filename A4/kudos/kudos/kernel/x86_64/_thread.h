@@ -13,7 +13,7 @@
 typedef struct _kthread
 {
   /* PADDING */
-  uint32_t padding[5];
+  uint32_t padding[2];
 
 } _kthread_t;
 
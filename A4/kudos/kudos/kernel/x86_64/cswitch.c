@@ -62,6 +62,7 @@ void _context_init(context_t *cxt, virtaddr_t entry, virtaddr_t endentry,
   /* Setup memory */
   cxt->pml4 = (uint64_t)vmm_get_kernel_pml4();
   cxt->virt_memory = vmm_get_kernel_pml4();
+  cxt->pcid.generation = 0;
   cxt->flags = 0;
 }
 
@@ -98,7 +99,7 @@ void _context_enter_userland(context_t *cxt)
   *(rsp--) = 0; //R10
   *(rsp--) = 0; //R9
   *(rsp--) = 0; //R8
-  *(rsp--) = 0; //RDI
+  *(rsp--) = cxt->arg; //RDI
   *(rsp--) = 0; //RSI
   *(rsp--) = rbp;       //RBP
   *(rsp--) = 0; //RSP
@@ -135,6 +136,7 @@ void _context_enable_ints(context_t *cxt)
   /* Setup memory */
   cxt->pml4 = (uint64_t)vmm_get_kernel_pml4();
   cxt->virt_memory = vmm_get_kernel_pml4();
+  cxt->pcid.generation = 0;
   cxt->flags = 0;
 }
 
@@ -143,19 +145,33 @@ void _context_set_sp(context_t *cxt, virtaddr_t sp)
   cxt->stack = (virtaddr_t*)sp;
 }
 
+void _context_set_arg(context_t *cxt, uint64_t arg)
+{
+  cxt->arg = arg;
+}
+
 struct dirty_dirty_hack {
     uint64_t stack;
     uint64_t pml4;
 };
 
+/* Saved stack of the idle thread of each CPU. The idle thread has a
+ * single thread table entry but runs on every idle CPU at once, each
+ * on its own stack. */
+static uint64_t *cswitch_idle_stack[CONFIG_MAX_CPUS];
+
+/* Called on the interrupt stack of the CPU, see _interrupt_stack() */
 struct dirty_dirty_hack task_switch(uint64_t *stack)
 {
   /* OK, We want to save current stack */
   thread_table_t *task = thread_get_current_thread_entry();
+  int cpu = _interrupt_getcpu();
   virtaddr_t new_stack;
 
   /* Is it a usertask?  */
-  if(task->attribs & THREAD_FLAG_USERMODE)
+  if(thread_get_current_thread() == IDLE_THREAD_TID)
+    cswitch_idle_stack[cpu] = stack;
+  else if(task->attribs & THREAD_FLAG_USERMODE)
     task->user_context->stack = stack;
   else
     task->context->stack = stack;
@@ -167,7 +183,7 @@ struct dirty_dirty_hack task_switch(uint64_t *stack)
   task = thread_get_current_thread_entry();
 
   /* Update TSS */
-  tss_setstack(0, (uint64_t)task->context->stack);
+  tss_setstack(cpu, (uint64_t)task->context->stack);
 
   /* Test if this new task is set to
    * enter usermode */
@@ -178,7 +194,9 @@ struct dirty_dirty_hack task_switch(uint64_t *stack)
     }
 
   /* return new stack */
-  if(task->attribs & THREAD_FLAG_USERMODE)
+  if(thread_get_current_thread() == IDLE_THREAD_TID)
+    new_stack = (virtaddr_t)cswitch_idle_stack[cpu];
+  else if(task->attribs & THREAD_FLAG_USERMODE)
     new_stack = task->user_context->stack;
   else
     new_stack = task->context->stack;
@@ -186,6 +204,7 @@ struct dirty_dirty_hack task_switch(uint64_t *stack)
   //return new_stack;
   struct dirty_dirty_hack tmp;
   tmp.stack = new_stack;              //RAX
-  tmp.pml4 = task->context->pml4;     //RDX
+  tmp.pml4 = vmm_cr3((pagetable_t*)task->context->pml4,
+                     &task->context->pcid);  //RDX
   return tmp;
 }
@@ -16,6 +16,8 @@ typedef struct {
   pagetable_t *virt_memory;
 
   void    *prev_context;   /* Previous context in a nested exception chain */
+  uint64_t arg;            /* First argument (rdi) when entering userland */
+  vmm_pcid_t pcid;         /* PCID of the address space in pml4 */
 } context_t;
 
 /* Code to be inserted to interrupt vector */
@@ -30,6 +32,7 @@ void _context_init(context_t *cxt, virtaddr_t entry, virtaddr_t endentry,
 void _context_enter_userland(context_t *cxt);
 void _context_set_ip(context_t *cxt, virtaddr_t ip); /* Set new instruction pointer / program counter */
 void _context_set_sp(context_t *cxt, virtaddr_t sp); /* Sets a new stack pointer */
+void _context_set_arg(context_t *cxt, uint64_t arg); /* Sets the first argument */
 void _context_enable_ints(context_t *cxt); /* Masks interrupts */
 
 #endif // KUDOS_KERNEL_X86_64_CSWITCH_H
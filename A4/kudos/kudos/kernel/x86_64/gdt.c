@@ -3,84 +3,89 @@
  */
 
 #include <gdt.h>
+#include "kernel/config.h"
 #include "lib/libc.h"
 
-/* GDT */
-static gdt_desc_t gdtdescriptors[MAX_DESCRIPTORS];
-static gdt_t gdt;
-static uint32_t gdt_index;
+/* GDT of each CPU. They are identical except for the TSS descriptor,
+ * which the CPU marks busy when loading it. */
+static gdt_desc_t gdtdescriptors[CONFIG_MAX_CPUS][MAX_DESCRIPTORS];
+static gdt_t gdt[CONFIG_MAX_CPUS];
+static uint32_t gdt_index[CONFIG_MAX_CPUS];
 
-void gdt_init()
+void gdt_init(int cpu)
 {
   /* null out the gdt & descriptors */
-  gdt_index = 0;
-  memoryset(&gdt, 0, sizeof(gdt_t));
-  memoryset(&gdtdescriptors, 0, sizeof(gdt_desc_t) * MAX_DESCRIPTORS);
+  gdt_index[cpu] = 0;
+  memoryset(&gdt[cpu], 0, sizeof(gdt_t));
+  memoryset(&gdtdescriptors[cpu], 0, sizeof(gdt_desc_t) * MAX_DESCRIPTORS);
 
   /* Setup table */
-  gdt.limit = (sizeof(gdt_desc_t) * MAX_DESCRIPTORS) - 1;
-  gdt.base = (uint64_t)&gdtdescriptors[0];
+  gdt[cpu].limit = (sizeof(gdt_desc_t) * MAX_DESCRIPTORS) - 1;
+  gdt[cpu].base = (uint64_t)&gdtdescriptors[cpu][0];
 
   /* Install Descriptors */
 
   /* Null descriptor, all GDT starts with null descriptors */
-  gdt_install_descriptor(0, 0, 0, 0);
+  gdt_install_descriptor(cpu, 0, 0, 0, 0);
 
   /* Kernel Code Descriptor, 0x08 */
-  gdt_install_descriptor(0, 0,
+  gdt_install_descriptor(cpu, 0, 0,
                          GDT_DESC_MEMORY | GDT_DESC_READWRITE |
                          GDT_DESC_EXECUTABLE | GDT_DESC_CODEDATA,
                          GDT_GRAN_4K | GDT_GRAN_64BIT);
 
   /* Kernel Data Descriptor, 0x10 */
-  gdt_install_descriptor(0, 0,
+  gdt_install_descriptor(cpu, 0, 0,
                          GDT_DESC_MEMORY | GDT_DESC_READWRITE |
                          GDT_DESC_CODEDATA, GDT_GRAN_4K | GDT_GRAN_64BIT);
 
   /* User Code Descriptor, 0x18 */
-  gdt_install_descriptor(0, 0,
+  gdt_install_descriptor(cpu, 0, 0,
                          GDT_DESC_MEMORY | GDT_DESC_READWRITE |
                          GDT_DESC_EXECUTABLE | GDT_DESC_CODEDATA | GDT_DESC_DPL,
                          GDT_GRAN_4K | GDT_GRAN_64BIT);
 
   /* User Data Descriptor, 0x20 */
-  gdt_install_descriptor(0, 0,
+  gdt_install_descriptor(cpu, 0, 0,
                          GDT_DESC_MEMORY | GDT_DESC_READWRITE |
                          GDT_DESC_CODEDATA | GDT_DESC_DPL,
                          GDT_GRAN_4K | GDT_GRAN_64BIT);
 
   /* Install table */
-  asm volatile("lgdt (%%rax)" : : "a"((uint64_t)&gdt));
+  asm volatile("lgdt (%%rax)" : : "a"((uint64_t)&gdt[cpu]));
 }
 
-void gdt_install_descriptor(uint64_t base, uint64_t limit,
+void gdt_install_descriptor(int cpu, uint64_t base, uint64_t limit,
                             uint8_t access, uint8_t granularity)
 {
+  gdt_desc_t *gdt_desc = &gdtdescriptors[cpu][gdt_index[cpu]];
+
   /* Sanity */
-  if(gdt_index > MAX_DESCRIPTORS)
+  if(gdt_index[cpu] >= MAX_DESCRIPTORS)
     return;
 
   /* Setup */
-  gdtdescriptors[gdt_index].base_low = (uint16_t)(base & 0xFFFF);
-  gdtdescriptors[gdt_index].base_mid = (uint8_t)((base >> 16) & 0xFF);
-  gdtdescriptors[gdt_index].base_high = (uint8_t)((base >> 24) & 0xFF);
-  gdtdescriptors[gdt_index].limit = (uint16_t)(limit & 0xFFFF);
+  gdt_desc->base_low = (uint16_t)(base & 0xFFFF);
+  gdt_desc->base_mid = (uint8_t)((base >> 16) & 0xFF);
+  gdt_desc->base_high = (uint8_t)((base >> 24) & 0xFF);
+  gdt_desc->limit = (uint16_t)(limit & 0xFFFF);
 
-  gdtdescriptors[gdt_index].flags = access;
-  gdtdescriptors[gdt_index].granularity = (uint8_t)((limit >> 16) & 0x0F);
-  gdtdescriptors[gdt_index].granularity |= granularity & 0xF0;
+  gdt_desc->flags = access;
+  gdt_desc->granularity = (uint8_t)((limit >> 16) & 0x0F);
+  gdt_desc->granularity |= granularity & 0xF0;
 
-  gdt_index++;
+  gdt_index[cpu]++;
 }
 
-void gdt_install_tss(uint64_t base, uint64_t limit)
+void gdt_install_tss(int cpu, uint64_t base, uint64_t limit)
 {
   /* Setup */
   uint16_t tss_type = 0x0089;
-  gdt_sys_desc_t *gdt_desc = (gdt_sys_desc_t*)&gdtdescriptors[gdt_index];
+  gdt_sys_desc_t *gdt_desc =
+    (gdt_sys_desc_t*)&gdtdescriptors[cpu][gdt_index[cpu]];
 
   /* Sanity */
-  if(gdt_index > MAX_DESCRIPTORS)
+  if(gdt_index[cpu] + 1 >= MAX_DESCRIPTORS)
     return;
 
   gdt_desc->type_0 = (uint16_t)(tss_type & 0x00FF);
@@ -96,5 +101,5 @@ void gdt_install_tss(uint64_t base, uint64_t limit)
 
   gdt_desc->reserved = 0;
 
-  gdt_index += 2;
+  gdt_index[cpu] += 2;
 }
@@ -28,6 +28,7 @@
 #define GDT_KERNEL_DATA                 0x2
 #define GDT_USER_CODE                   0x3
 #define GDT_USER_DATA                   0x4
+#define GDT_TSS                         0x5
 
 
 /* Structures */
@@ -86,10 +87,10 @@ typedef struct gdt
 } __attribute__((packed)) gdt_t;
 
 /* Prototypes */
-void gdt_init();
+void gdt_init(int cpu);
 
-void gdt_install_tss(uint64_t base, uint64_t limit);
-void gdt_install_descriptor(uint64_t base, uint64_t limit,
+void gdt_install_tss(int cpu, uint64_t base, uint64_t limit);
+void gdt_install_descriptor(int cpu, uint64_t base, uint64_t limit,
                             uint8_t access, uint8_t grandularity);
 
 
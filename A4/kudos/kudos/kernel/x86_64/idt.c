@@ -30,6 +30,12 @@ void idt_init()
   idt_table.Base = (uint64_t)&idt_descriptors;
 
   /* Install table */
+  idt_load();
+}
+
+/* Loads the table on the calling CPU, it is shared by all CPUs */
+void idt_load(void)
+{
   asm volatile("lidt (%%rax)" : : "a"((uint64_t)&idt_table));
 }
 
@@ -61,6 +61,7 @@ typedef struct id_table
 
 /* Prototypes */
 void idt_init();
+void idt_load(void);
 
 void idt_install_gate(uint32_t index, uint16_t flags, uint16_t selector, irq_handler Irq);
 
@@ -8,11 +8,21 @@
 #include <pic.h>
 #include <tss.h>
 #include <exception.h>
+#include "kernel/config.h"
 #include "lib/libc.h"
+#include "kernel/thread.h"
 
 /* Initial stack start */
 uint64_t init_stack = 0x90000;
 
+/* Stacks the context switch runs the scheduler on, one per CPU. The
+ * outgoing thread may be picked by another CPU as soon as it is back
+ * on a ready queue, so its own stack must no longer be in use by
+ * then. */
+#define INTERRUPT_STACK_SIZE 0x2000
+static uint8_t interrupt_stacks[CONFIG_MAX_CPUS][INTERRUPT_STACK_SIZE]
+  __attribute__((aligned(16)));
+
 /* Externs */
 extern void syscall_init(void);
 extern void yield_irq_handler(void);
@@ -59,12 +69,21 @@ interrupt_status_t _interrupt_is_disabled(void)
   return !_interrupt_get_state();
 }
 
+/* Returns the top of the interrupt stack of the calling CPU */
+uint64_t _interrupt_stack(void)
+{
+  return (uint64_t)&interrupt_stacks[_interrupt_getcpu()][INTERRUPT_STACK_SIZE];
+}
+
+/* Initializes interrupt handling on the bootstrap CPU. The other
+ * CPUs are found and started later by smp_init(), so num_cpus is
+ * not used. */
 void interrupt_init(int num_cpus) 
 {
   num_cpus = num_cpus;
         
   /* Setup descriptors */
-  gdt_init();
+  gdt_init(0);
   idt_init();
 
   /* Setup basic interrupts */
@@ -173,7 +192,32 @@ void interrupt_handle(virtaddr_t cause)
       /* Page Fault */
     case 14:
       {
-        kprintf("Page Fault!\n");
+        uint64_t fault_addr;
+        asm volatile("mov %%cr2, %0" : "=r"(fault_addr));
+
+        /* A not-present page of a process is filled in on demand.
+         * That may block on the disk, so only do it if the faulting
+         * code could have been preempted anyway. */
+        if (!(Registers->errorcode & PF_ERROR_PRESENT)
+            && (Registers->rflags & EFLAGS_INTERRUPT_FLAG)) {
+          _interrupt_enable();
+          if (process_handle_fault(fault_addr) == 0) {
+            _interrupt_disable();
+            return;
+          }
+          _interrupt_disable();
+        }
+
+        /* A write to a page shared copy-on-write since a fork */
+        if ((Registers->errorcode & PF_ERROR_PRESENT)
+            && (Registers->errorcode & PF_ERROR_WRITE)) {
+          thread_table_t *thr = thread_get_current_thread_entry();
+          if (thr->pagetable != NULL
+              && vm_handle_cow(thr->pagetable, fault_addr) == 0)
+            return;
+        }
+
+        kprintf("Page Fault at 0x%xl!\n", fault_addr);
       } break;
       /* Reserved Exception */
     case 15:
@@ -33,6 +33,11 @@ typedef void (*int_handler_t)(void);
 
 #define EFLAGS_INTERRUPT_FLAG (1 << 9)
 
+/* Page fault error code: set if the page was present */
+#define PF_ERROR_PRESENT (1 << 0)
+/* Page fault error code: set if the access was a write */
+#define PF_ERROR_WRITE   (1 << 1)
+
 /* Interrupts */
 void isr_handler0(void);
 void isr_handler1(void);
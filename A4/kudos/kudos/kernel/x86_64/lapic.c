@@ -0,0 +1,186 @@
+/*
+ * The local advanced programmable interrupt controller.
+ */
+
+#include <lapic.h>
+#include <asm.h>
+#include <pit.h>
+#include <idt.h>
+#include <gdt.h>
+#include "vm/memory.h"
+#include "lib/libc.h"
+
+/* Registers, mapped uncached by lapic_init(). NULL until then. */
+static volatile uint32_t *lapic_regs = NULL;
+
+/* Timer counts per timer tick (see pit.h), 24.8 fixed point. The
+ * timer runs at the same rate on every CPU, so it is measured once. */
+static uint64_t lapic_timer_counts_per_tick = 0;
+
+/* Interrupt handlers */
+extern void lapic_timer_irq_handler(void);
+extern void lapic_resched_irq_handler(void);
+extern void isr_default_handler(void);
+
+/* Helpers */
+static uint32_t lapic_read(uint32_t reg)
+{
+  return lapic_regs[reg / sizeof(uint32_t)];
+}
+
+static void lapic_write(uint32_t reg, uint32_t value)
+{
+  lapic_regs[reg / sizeof(uint32_t)] = value;
+}
+
+/* Waits until the last interrupt command has been delivered */
+static void lapic_wait_icr(void)
+{
+  while (lapic_read(LAPIC_REG_ICR_LOW) & LAPIC_ICR_PENDING)
+    asm volatile("pause");
+}
+
+/* Checks whether the CPU has a local APIC (CPUID.1:EDX bit 9) */
+int lapic_present(void)
+{
+  uint32_t eax = 1, ebx, ecx = 0, edx;
+
+  asm volatile("cpuid"
+               : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+
+  return (edx >> 9) & 1;
+}
+
+/* Enables the local APIC of the calling CPU. The bootstrap CPU also
+ * maps the registers and installs the interrupt vectors, and keeps
+ * taking the interrupts of the PICs through LINT0; the other CPUs
+ * only take interrupts sent to them directly. */
+void lapic_init(int bsp)
+{
+  uint64_t base = _rdmsr(LAPIC_BASE_MSR);
+  physaddr_t phys = base & PAGE_MASK;
+
+  /* Enable it globally, it may have been disabled by the firmware */
+  _wrmsr(LAPIC_BASE_MSR, base | LAPIC_BASE_MSR_ENABLE);
+
+  if (bsp) {
+    vm_map(vmm_get_kernel_pml4(), phys, phys, PAGE_WRITE | PAGE_NOT_CACHE);
+    lapic_regs = (volatile uint32_t*)phys;
+
+    idt_install_gate(LAPIC_VECTOR_TIMER, IDT_DESC_PRESENT | IDT_DESC_BIT32,
+                     (GDT_KERNEL_CODE << 3),
+                     (irq_handler)lapic_timer_irq_handler);
+    idt_install_gate(LAPIC_VECTOR_RESCHED, IDT_DESC_PRESENT | IDT_DESC_BIT32,
+                     (GDT_KERNEL_CODE << 3),
+                     (irq_handler)lapic_resched_irq_handler);
+    idt_install_gate(LAPIC_VECTOR_SPURIOUS, IDT_DESC_PRESENT | IDT_DESC_BIT32,
+                     (GDT_KERNEL_CODE << 3),
+                     (irq_handler)isr_default_handler);
+  }
+
+  /* Accept all interrupts */
+  lapic_write(LAPIC_REG_TPR, 0);
+
+  /* Virtual wire mode for the PICs on the bootstrap CPU only */
+  if (bsp) {
+    lapic_write(LAPIC_REG_LVT_LINT0, LAPIC_LVT_EXTINT);
+    lapic_write(LAPIC_REG_LVT_LINT1, LAPIC_LVT_NMI);
+  } else {
+    lapic_write(LAPIC_REG_LVT_LINT0, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_REG_LVT_LINT1, LAPIC_LVT_MASKED);
+  }
+  lapic_write(LAPIC_REG_LVT_ERROR, LAPIC_LVT_MASKED);
+
+  /* The timer is one-shot and stopped until armed */
+  lapic_write(LAPIC_REG_TIMER_DIV, LAPIC_TIMER_DIV_16);
+  lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_VECTOR_TIMER);
+  lapic_write(LAPIC_REG_TIMER_INIT, 0);
+
+  /* Clear errors, the register must be written before it is read */
+  lapic_write(LAPIC_REG_ESR, 0);
+  lapic_read(LAPIC_REG_ESR);
+
+  /* Software enable */
+  lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | LAPIC_VECTOR_SPURIOUS);
+
+  lapic_eoi();
+}
+
+/* Returns the APIC id of the calling CPU */
+uint32_t lapic_id(void)
+{
+  return lapic_read(LAPIC_REG_ID) >> 24;
+}
+
+/* Acknowledges the interrupt being handled */
+void lapic_eoi(void)
+{
+  lapic_write(LAPIC_REG_EOI, 0);
+}
+
+/* Sends an interrupt to the CPU with the given APIC id */
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector)
+{
+  lapic_wait_icr();
+  lapic_write(LAPIC_REG_ICR_HIGH, apic_id << 24);
+  lapic_write(LAPIC_REG_ICR_LOW, LAPIC_ICR_FIXED | LAPIC_ICR_ASSERT | vector);
+}
+
+/* Starts every other CPU executing the real mode code at the given
+ * page aligned address below 1 MB, with the INIT-SIPI-SIPI sequence
+ * of the Intel MultiProcessor Specification. */
+void lapic_start_aps(physaddr_t trampoline)
+{
+  uint32_t vector = (uint32_t)(trampoline >> 12) & 0xFF;
+
+  lapic_wait_icr();
+  lapic_write(LAPIC_REG_ICR_LOW, LAPIC_ICR_ALL_BUT_SELF | LAPIC_ICR_INIT |
+              LAPIC_ICR_ASSERT | LAPIC_ICR_LEVEL);
+  pit_delay_us(10000);
+
+  lapic_wait_icr();
+  lapic_write(LAPIC_REG_ICR_LOW, LAPIC_ICR_ALL_BUT_SELF | LAPIC_ICR_STARTUP |
+              LAPIC_ICR_ASSERT | vector);
+  pit_delay_us(200);
+
+  lapic_wait_icr();
+  lapic_write(LAPIC_REG_ICR_LOW, LAPIC_ICR_ALL_BUT_SELF | LAPIC_ICR_STARTUP |
+              LAPIC_ICR_ASSERT | vector);
+  pit_delay_us(200);
+
+  lapic_wait_icr();
+}
+
+/* Measures the timer rate against the PIT-calibrated TSC. Called on
+ * the bootstrap CPU with interrupts disabled. */
+void lapic_timer_calibrate(void)
+{
+  uint64_t counts;
+
+  lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_VECTOR_TIMER);
+  lapic_write(LAPIC_REG_TIMER_INIT, 0xFFFFFFFF);
+  pit_delay_us(10000);
+  counts = 0xFFFFFFFF - lapic_read(LAPIC_REG_TIMER_CUR);
+  lapic_write(LAPIC_REG_TIMER_INIT, 0);
+  lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_VECTOR_TIMER);
+
+  /* 10 ms is PIT_BASE_FREQUENCY / 100 PIT clocks */
+  lapic_timer_counts_per_tick = (counts << (PIT_ONESHOT_SHIFT + 8)) /
+    (PIT_BASE_FREQUENCY / 100);
+  if (lapic_timer_counts_per_tick == 0)
+    lapic_timer_counts_per_tick = 1;
+}
+
+/* Arms the timer of the calling CPU to interrupt once after the given
+ * number of timer ticks */
+void lapic_timer_set_ticks(uint32_t ticks)
+{
+  uint64_t counts = ((uint64_t)ticks * lapic_timer_counts_per_tick) >> 8;
+
+  if (counts == 0)
+    counts = 1;
+  if (counts > 0xFFFFFFFF)
+    counts = 0xFFFFFFFF;
+
+  lapic_write(LAPIC_REG_TIMER_INIT, (uint32_t)counts);
+}
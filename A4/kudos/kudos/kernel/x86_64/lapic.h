@@ -0,0 +1,70 @@
+/*
+ * The local advanced programmable interrupt controller.
+ */
+
+#ifndef KUDOS_KERNEL_X86_64_LAPIC_H
+#define KUDOS_KERNEL_X86_64_LAPIC_H
+
+/* Includes */
+#include "lib/types.h"
+
+/* Defines */
+#define LAPIC_BASE_MSR          0x1B
+#define LAPIC_BASE_MSR_ENABLE   0x800
+#define LAPIC_DEFAULT_BASE      0xFEE00000
+
+/* Registers, offsets from the base */
+#define LAPIC_REG_ID            0x020
+#define LAPIC_REG_VERSION       0x030
+#define LAPIC_REG_TPR           0x080
+#define LAPIC_REG_EOI           0x0B0
+#define LAPIC_REG_SVR           0x0F0
+#define LAPIC_REG_ESR           0x280
+#define LAPIC_REG_ICR_LOW       0x300
+#define LAPIC_REG_ICR_HIGH      0x310
+#define LAPIC_REG_LVT_TIMER     0x320
+#define LAPIC_REG_LVT_LINT0     0x350
+#define LAPIC_REG_LVT_LINT1     0x360
+#define LAPIC_REG_LVT_ERROR     0x370
+#define LAPIC_REG_TIMER_INIT    0x380
+#define LAPIC_REG_TIMER_CUR     0x390
+#define LAPIC_REG_TIMER_DIV     0x3E0
+
+/* Spurious vector register bits */
+#define LAPIC_SVR_ENABLE        0x100
+
+/* Local vector table bits */
+#define LAPIC_LVT_MASKED        0x10000
+#define LAPIC_LVT_EXTINT        0x700
+#define LAPIC_LVT_NMI           0x400
+
+/* Interrupt command register bits */
+#define LAPIC_ICR_FIXED         0x000
+#define LAPIC_ICR_INIT          0x500
+#define LAPIC_ICR_STARTUP       0x600
+#define LAPIC_ICR_PENDING       0x1000
+#define LAPIC_ICR_ASSERT        0x4000
+#define LAPIC_ICR_LEVEL         0x8000
+#define LAPIC_ICR_ALL_BUT_SELF  0xC0000
+
+/* Timer divides the bus clock by 16 */
+#define LAPIC_TIMER_DIV_16      0x3
+
+/* Interrupt vectors, above the ones of the PICs */
+#define LAPIC_VECTOR_TIMER      0x40
+#define LAPIC_VECTOR_RESCHED    0x41
+#define LAPIC_VECTOR_SPURIOUS   0xFF
+
+/* Prototypes */
+int lapic_present(void);
+void lapic_init(int bsp);
+uint32_t lapic_id(void);
+void lapic_eoi(void);
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+void lapic_start_aps(physaddr_t trampoline);
+
+void lapic_timer_calibrate(void);
+void lapic_timer_set_ticks(uint32_t ticks);
+
+#endif // KUDOS_KERNEL_X86_64_LAPIC_H
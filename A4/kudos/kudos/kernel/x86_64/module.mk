@@ -3,7 +3,7 @@
 # Set the module name
 MODULE := kernel/x86_64
 
-FILES := _irq.S _spinlock.c cswitch.c interrupt.c stubs.c \
-	 gdt.c idt.c exception.c pic.c tss.c spinlock.S
+FILES := _irq.S _smp.S _spinlock.c cswitch.c interrupt.c stubs.c \
+	 gdt.c idt.c exception.c pic.c tss.c lapic.c smp.c
 
 X64SRC += $(patsubst %, $(MODULE)/%, $(FILES))
@@ -0,0 +1,142 @@
+/*
+ * Symmetric multiprocessing
+ */
+
+#include <smp.h>
+#include <lapic.h>
+#include <gdt.h>
+#include <idt.h>
+#include <tss.h>
+#include <pit.h>
+#include "kernel/config.h"
+#include "kernel/interrupt.h"
+#include "kernel/idle.h"
+#include "kernel/cpulocal.h"
+#include "vm/memory.h"
+#include "lib/libc.h"
+
+/* The startup code and its parameters, see _smp.S */
+extern uint8_t smp_trampoline_start[];
+extern uint8_t smp_trampoline_end[];
+extern uint64_t smp_trampoline_entry;
+extern uint64_t smp_trampoline_stacks;
+extern uint64_t smp_trampoline_stack_size;
+extern uint32_t smp_trampoline_cr3;
+extern uint32_t smp_trampoline_next_cpu;
+extern uint32_t smp_trampoline_max_cpus;
+
+/* Address of a trampoline parameter in the copy at SMP_TRAMPOLINE_BASE */
+#define SMP_TRAMPOLINE_PARAM(sym)                                       \
+  ((void*)(SMP_TRAMPOLINE_BASE +                                        \
+           ((uint8_t*)&(sym) - smp_trampoline_start)))
+
+/* Initial stacks of the application processors, the one of CPU n is
+ * smp_ap_stacks[n]. The bootstrap CPU keeps its boot stack. */
+static uint8_t smp_ap_stacks[CONFIG_MAX_CPUS][SMP_AP_STACK_SIZE]
+  __attribute__((aligned(16)));
+
+/* Bit n is set once CPU n is running */
+static volatile uint32_t smp_online_cpus = 1;
+
+/* APIC id of each CPU */
+static uint32_t smp_apic_ids[CONFIG_MAX_CPUS];
+
+/* Returns the number of the calling CPU, from its per-CPU block */
+int _interrupt_getcpu(void)
+{
+  return _cpu_local_cpu();
+}
+
+/* Interrupts the given CPU so that it runs the scheduler */
+void _interrupt_wake_cpu(int cpu)
+{
+  if (cpu < 0 || cpu >= CONFIG_MAX_CPUS ||
+      !(smp_online_cpus & (1U << cpu)) || cpu == _interrupt_getcpu())
+    return;
+
+  lapic_send_ipi(smp_apic_ids[cpu], LAPIC_VECTOR_RESCHED);
+}
+
+/* Returns the number of running CPUs */
+int smp_num_cpus(void)
+{
+  uint32_t online = smp_online_cpus;
+  int n = 0;
+
+  for (; online != 0; online &= online - 1)
+    n++;
+
+  return n;
+}
+
+/* Brings up the local APIC of the bootstrap CPU and starts the other
+ * CPUs. Called once the scheduler is ready to give them threads. */
+void smp_init(void)
+{
+  interrupt_status_t intr_status;
+  int i;
+
+  if (!lapic_present()) {
+    kprintf("SMP: No local APIC, using one CPU\n");
+    return;
+  }
+
+  intr_status = _interrupt_disable();
+  lapic_init(1);
+  lapic_timer_calibrate();
+  smp_apic_ids[0] = lapic_id();
+  _interrupt_set_state(intr_status);
+
+  if (CONFIG_MAX_CPUS == 1)
+    return;
+
+  /* Install the startup code and its parameters */
+  memcopy(smp_trampoline_end - smp_trampoline_start,
+          (void*)SMP_TRAMPOLINE_BASE, smp_trampoline_start);
+  *(uint64_t*)SMP_TRAMPOLINE_PARAM(smp_trampoline_entry) =
+    (uint64_t)smp_ap_main;
+  *(uint64_t*)SMP_TRAMPOLINE_PARAM(smp_trampoline_stacks) =
+    (uint64_t)smp_ap_stacks;
+  *(uint64_t*)SMP_TRAMPOLINE_PARAM(smp_trampoline_stack_size) =
+    SMP_AP_STACK_SIZE;
+  *(uint32_t*)SMP_TRAMPOLINE_PARAM(smp_trampoline_cr3) =
+    (uint32_t)(uint64_t)vmm_get_kernel_pml4();
+  *(uint32_t*)SMP_TRAMPOLINE_PARAM(smp_trampoline_next_cpu) = 1;
+  *(uint32_t*)SMP_TRAMPOLINE_PARAM(smp_trampoline_max_cpus) =
+    CONFIG_MAX_CPUS;
+
+  /* The CPUs are not enumerated from firmware tables: all of them are
+     started at once and number themselves in the order they arrive.
+     Those beyond CONFIG_MAX_CPUS halt in the startup code. */
+  lapic_start_aps(SMP_TRAMPOLINE_BASE);
+
+  for (i = 0; i < SMP_START_TIMEOUT_MS; i++) {
+    if (smp_num_cpus() == CONFIG_MAX_CPUS)
+      break;
+    pit_delay_us(1000);
+  }
+
+  kprintf("SMP: %d CPUs running\n", smp_num_cpus());
+}
+
+/* Entry point of the application processors, called by the startup
+ * code on the stack smp_ap_stacks[cpu] with interrupts disabled.
+ * Sets up the per-CPU block, the descriptor tables and the local APIC
+ * of the CPU and becomes its idle thread. */
+void smp_ap_main(uint64_t cpu)
+{
+  _cpu_local_load(&cpu_local[cpu]);
+  vmm_init_cpu();
+  gdt_init((int)cpu);
+  idt_load();
+  tss_install((int)cpu, (uint64_t)&smp_ap_stacks[cpu][SMP_AP_STACK_SIZE]);
+
+  lapic_init(0);
+  smp_apic_ids[cpu] = lapic_id();
+
+  __atomic_fetch_or(&smp_online_cpus, 1U << cpu, __ATOMIC_SEQ_CST);
+
+  /* Like on the bootstrap CPU, the startup stack lives on as the
+     stack of the idle thread */
+  _idle_thread_wait_loop();
+}
@@ -0,0 +1,25 @@
+/*
+ * Symmetric multiprocessing
+ */
+
+#ifndef KUDOS_KERNEL_X86_64_SMP_H
+#define KUDOS_KERNEL_X86_64_SMP_H
+
+/* Includes */
+#include "lib/types.h"
+
+/* Physical address the startup code of the other CPUs is copied to */
+#define SMP_TRAMPOLINE_BASE     0x8000
+
+/* Kernel stack of each application processor while it is idle */
+#define SMP_AP_STACK_SIZE       0x4000
+
+/* How long the bootstrap CPU waits for the others to come up */
+#define SMP_START_TIMEOUT_MS    100
+
+/* Prototypes */
+void smp_init(void);
+void smp_ap_main(uint64_t cpu);
+int smp_num_cpus(void);
+
+#endif // KUDOS_KERNEL_X86_64_SMP_H
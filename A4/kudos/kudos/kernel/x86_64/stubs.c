@@ -4,11 +4,6 @@
 #include "kernel/interrupt.h"
 #include "lib/libc.h"
 
-int _interrupt_getcpu()
-{
-  return 0;
-}
-
 void shutdown(int err)
 {
   /* Print */
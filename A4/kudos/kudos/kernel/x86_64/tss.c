@@ -30,15 +30,15 @@ void tss_install(int num_cpu, uint64_t cpu_stack)
   memoryset((uint64_t*)tss_base, 0, sizeof(tss_t));
 
   /* Install it */
-  gdt_install_tss(tss_base, sizeof(tss_t));
+  gdt_install_tss(num_cpu, tss_base, sizeof(tss_t));
 
   /* Set stack */
   tss_descriptors[num_cpu].rsp_ring0 = cpu_stack;
   tss_descriptors[num_cpu].io_map = 0xFFFF;
   tss_descriptors[num_cpu].ist[0] = cpu_stack;
 
-  /* Update hardware task register */
-  tss_flush((uint16_t)((5 + num_cpu) * sizeof(gdt_desc_t)));
+  /* Update hardware task register, every CPU has its own GDT */
+  tss_flush((uint16_t)(GDT_TSS * sizeof(gdt_desc_t)));
 }
 
 /* Update stacks */
@@ -52,3 +52,27 @@ void _outsw(uint16_t Port, uint64_t Count, uint8_t *Buffer)
                : "S"(Buffer), "c"(Count), "d"((uint64_t)Port)
                : "memory");
 }
+
+uint64_t _rdtsc(void)
+{
+  uint32_t lo, hi;
+
+  asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+
+  return ((uint64_t)hi << 32) | lo;
+}
+
+uint64_t _rdmsr(uint32_t msr)
+{
+  uint32_t lo, hi;
+
+  asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+
+  return ((uint64_t)hi << 32) | lo;
+}
+
+void _wrmsr(uint32_t msr, uint64_t value)
+{
+  asm volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value),
+               "d"((uint32_t)(value >> 32)));
+}
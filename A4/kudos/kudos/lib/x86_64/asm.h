@@ -22,4 +22,11 @@ uint32_t _inl(uint16_t Port);
 void _insw(uint16_t Port, uint64_t Count, uint8_t *Buffer);
 void _outsw(uint16_t Port, uint64_t Count, uint8_t *Buffer);
 
+/* Reads the time stamp counter */
+uint64_t _rdtsc(void);
+
+/* Reads and writes model specific registers */
+uint64_t _rdmsr(uint32_t msr);
+void _wrmsr(uint32_t msr, uint64_t value);
+
 #endif // KUDOS_LIB_X86_64_ASM_H
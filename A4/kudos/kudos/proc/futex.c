@@ -0,0 +1,124 @@
+/// Futexes: userland wait/wake on a word of user memory.
+///
+/// A futex lets userland synchronization primitives keep their state
+/// in ordinary user memory and update it with atomic instructions,
+/// entering the kernel only when a thread actually has to block or a
+/// blocked thread has to be woken.
+///
+/// Waiters are kept on the sleep queue, keyed on the physical address
+/// of the futex word. The physical address is the same for every
+/// process mapping the word, and user frames never hold kernel
+/// objects, so the key never collides with other sleep queue users.
+///
+/// The check of the futex word and the insertion on the sleep queue
+/// are made atomic with respect to futex_wake() by a small hash of
+/// spinlocks, so a wake-up between the two cannot be lost.
+
+#include "proc/futex.h"
+#include "kernel/thread.h"
+#include "kernel/sleepq.h"
+#include "kernel/spinlock.h"
+#include "kernel/interrupt.h"
+#include "vm/memory.h"
+
+#define FUTEX_HASH_SIZE 31
+#define FUTEX_HASH(key) ((key) % FUTEX_HASH_SIZE)
+
+/* Offset of an address within its page */
+#define FUTEX_PAGE_OFFSET(addr) ((addr) & 0xFFF)
+
+static spinlock_t futex_slocks[FUTEX_HASH_SIZE];
+
+/// Initialize the futex locks.
+void futex_init(void)
+{
+  int i;
+  for (i = 0; i < FUTEX_HASH_SIZE; i++)
+    spinlock_reset(&futex_slocks[i]);
+}
+
+/// Find the key of the futex word at uaddr in the current address
+/// space. Returns 0 if uaddr is unaligned or unmapped.
+static physaddr_t futex_key(uint32_t *uaddr)
+{
+  virtaddr_t vaddr = (virtaddr_t)uaddr;
+  physaddr_t phys;
+
+  if (vaddr == 0 || (vaddr & (sizeof(uint32_t) - 1)) != 0)
+    return 0;
+
+  phys = vm_getmap(thread_get_current_thread_entry()->pagetable, vaddr);
+  if (phys == 0)
+    return 0;
+
+  return (phys & ~(physaddr_t)0xFFF) | FUTEX_PAGE_OFFSET(vaddr);
+}
+
+/// Sleep on the futex word at uaddr if it still holds expected.
+///
+/// @param uaddr The futex word, in the current address space.
+/// @param expected The value the caller last saw in the word.
+/// @param msec Maximum time to sleep in milliseconds, 0 for no limit.
+///
+/// @return FUTEX_WOKEN, FUTEX_CHANGED, FUTEX_TIMEDOUT or FUTEX_EINVAL.
+int futex_wait(uint32_t *uaddr, uint32_t expected, uint32_t msec)
+{
+  interrupt_status_t intr_status;
+  spinlock_t *slock;
+  physaddr_t key;
+  int retval = FUTEX_WOKEN;
+
+  key = futex_key(uaddr);
+  if (key == 0)
+    return FUTEX_EINVAL;
+  slock = &futex_slocks[FUTEX_HASH(key)];
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(slock);
+
+  if (*(volatile uint32_t *)uaddr != expected) {
+    spinlock_release(slock);
+    _interrupt_set_state(intr_status);
+    return FUTEX_CHANGED;
+  }
+
+  if (msec > 0)
+    sleepq_add_timeout((void *)key, msec);
+  else
+    sleepq_add((void *)key);
+  spinlock_release(slock);
+  thread_switch();
+
+  if (msec > 0 && sleepq_timed_out())
+    retval = FUTEX_TIMEDOUT;
+  _interrupt_set_state(intr_status);
+
+  return retval;
+}
+
+/// Wake up to n threads sleeping on the futex word at uaddr, in the
+/// order they went to sleep.
+///
+/// @return The number of threads woken, or FUTEX_EINVAL.
+int futex_wake(uint32_t *uaddr, int n)
+{
+  interrupt_status_t intr_status;
+  spinlock_t *slock;
+  physaddr_t key;
+  int woken;
+
+  key = futex_key(uaddr);
+  if (key == 0)
+    return FUTEX_EINVAL;
+  if (n <= 0)
+    return 0;
+  slock = &futex_slocks[FUTEX_HASH(key)];
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(slock);
+  woken = sleepq_wake_n((void *)key, n);
+  spinlock_release(slock);
+  _interrupt_set_state(intr_status);
+
+  return woken;
+}
@@ -0,0 +1,18 @@
+/// Futexes: userland wait/wake on a word of user memory.
+
+#ifndef KUDOS_PROC_FUTEX_H
+#define KUDOS_PROC_FUTEX_H
+
+#include "lib/types.h"
+
+/* Return values of futex_wait() */
+#define FUTEX_WOKEN     (0)   /* woken by futex_wake() */
+#define FUTEX_CHANGED   (1)   /* the word no longer held the expected value */
+#define FUTEX_TIMEDOUT  (-2)  /* the timeout expired */
+#define FUTEX_EINVAL    (-1)  /* the address is unaligned or unmapped */
+
+void futex_init(void);
+int futex_wait(uint32_t *uaddr, uint32_t expected, uint32_t msec);
+int futex_wake(uint32_t *uaddr, int n);
+
+#endif // KUDOS_PROC_FUTEX_H
@@ -7,6 +7,7 @@
 #include "lib/libc.h"
 #include "kernel/thread.h"
 #include <exception.h>
+#include <tlb.h>
 
 void syscall_handle(context_t *user_context);
 
@@ -41,10 +42,10 @@ void user_exception_handle(int exception)
     KERNEL_PANIC("TLB Modification: not handled yet");
     break;
   case EXCEPTION_TLBL:
-    KERNEL_PANIC("TLB Load: not handled yet");
+    tlb_load_exception(true);
     break;
   case EXCEPTION_TLBS:
-    KERNEL_PANIC("TLB Store: not handled yet");
+    tlb_store_exception(true);
     break;
   case EXCEPTION_ADDRL:
     KERNEL_PANIC("Address Error Load: not handled yet");
@@ -3,7 +3,7 @@
 # Set the module name
 MODULE := proc
 
-FILES := elf.c syscall.c process.c fdt.c usr_sem.c
+FILES := elf.c syscall.c process.c fdt.c usr_sem.c futex.c
 
 SRC += $(patsubst %, $(MODULE)/%, $(FILES))
 
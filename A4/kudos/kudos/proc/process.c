@@ -14,6 +14,8 @@
 #include "kernel/sleepq.h"
 #include "vm/memory.h"
 #include "kernel/klock.h"
+#include "kernel/scheduler.h"
+#include "vm/pagecache.h"
 
 #include "drivers/device.h"     // device_*
 #include "drivers/gcd.h"        // gcd_*
@@ -35,6 +37,7 @@ void process_reset(const pid_t pid) {
 void process_init() {
   int i;
   klock_init(&process_table_lock);
+  spinlock_register(&process_table_lock, "process_table_lock");
   for (i = 0; i < PROCESS_MAX_PROCESSES; ++i) {
     process_reset(i);
   }
@@ -60,6 +63,17 @@ pid_t alloc_process_id() {
   return i;
 }
 
+/* Gives back a slot taken with alloc_process_id() whose process never
+   started. */
+static void free_process_id(pid_t pid) {
+  klock_status_t st;
+
+  st = klock_lock(&process_table_lock);
+  process_table[pid].pid = -1;
+  process_table[pid].state = PROCESS_FREE;
+  klock_open(st, &process_table_lock);
+}
+
 /* Return non-zero on error. */
 int setup_new_process(TID_t thread,
                       const char *path,
@@ -67,15 +81,15 @@ int setup_new_process(TID_t thread,
                       virtaddr_t *entry_point, virtaddr_t *stack_top)
 {
   pagetable_t *pagetable;
-  elf_info_t elf;
+  pcb_t *process;
   openfile_t file;
-  uintptr_t phys_page;
-  virtaddr_t virt_page;
-  int i, res;
+  int res;
   thread_table_t *thread_entry = thread_get_thread_entry(thread);
 
   flags = flags;
 
+  process = &process_table[thread_entry->pid];
+
   file = vfs_open((char *)path);
 
   /* Make sure the file existed and was a valid ELF file */
@@ -83,17 +97,19 @@ int setup_new_process(TID_t thread,
     return -1;
   }
 
-  res = elf_parse_header(&elf, file);
+  res = elf_parse_header(&process->elf, file);
   if (res < 0) {
+    vfs_close(file);
     return -1;
   }
 
   /* Trivial and naive sanity check for entry point: */
-  if (elf.entry_point <= VMM_KERNEL_SPACE) {
+  if (process->elf.entry_point <= VMM_KERNEL_SPACE) {
+    vfs_close(file);
     return -1;
   }
 
-  *entry_point = elf.entry_point;
+  *entry_point = process->elf.entry_point;
 
 
   pagetable = vm_create_pagetable(thread);
@@ -101,67 +117,126 @@ int setup_new_process(TID_t thread,
 
   thread_entry->pagetable = pagetable;
 
-  /* Allocate and map stack */
-  for(i = 0; i < CONFIG_USERLAND_STACK_SIZE; i++) {
-    phys_page = physmem_allocblock();
-    KERNEL_ASSERT(phys_page != 0);
-    virt_page = (USERLAND_STACK_TOP & PAGE_SIZE_MASK) - i*PAGE_SIZE;
-    vm_map(pagetable, phys_page,
-           virt_page, PAGE_USER | PAGE_WRITE);
-    /* Zero the page */
-    memoryset((void*)virt_page, 0, PAGE_SIZE);
-  }
+  /* Nothing is mapped yet. The stack and the ELF segments are filled
+     in one page at a time by process_handle_fault() when they are
+     first touched, so the file stays open until the process exits. */
+  process->file = file;
 
-  /* Allocate and map pages for the ELF segments. We assume that
-     the segments begin at a page boundary. (The linker script
-     in the userland directory helps users get this right.) */
-  for(i = 0; i < (int)elf.ro_pages; i++) {
-    int left_to_read = elf.ro_size - i*PAGE_SIZE;
-    phys_page = physmem_allocblock();
-    KERNEL_ASSERT(phys_page != 0);
-    virt_page = elf.ro_vaddr + i*PAGE_SIZE;
-    vm_map(pagetable, phys_page,
-           virt_page, PAGE_USER | PAGE_WRITE);
-    /* Zero the page */
-    memoryset((void*)virt_page, 0, PAGE_SIZE);
-    /* Fill the page from ro segment */
-    if (left_to_read > 0) {
-      KERNEL_ASSERT(vfs_seek(file, elf.ro_location + i*PAGE_SIZE) == VFS_OK);
-      KERNEL_ASSERT(vfs_read(file, (char*)virt_page,
-                             MIN(PAGE_SIZE, left_to_read))
-                    == (int) MIN(PAGE_SIZE, left_to_read));
-    }
-    //Make the page read only
-    vm_map(pagetable, phys_page,
-            virt_page, PAGE_USER);
+  *stack_top = USERLAND_STACK_TOP;
+
+  return 0;
+}
+
+/**
+ * Fills in the page holding addr for the current process: segment
+ * pages are read from the executable, BSS and stack pages are zeroed.
+ *
+ * @param addr The faulting virtual address.
+ *
+ * @return 0 if the page is now mapped, -1 if addr lies outside the
+ * segments and the stack of the process.
+ */
+int process_handle_fault(virtaddr_t addr)
+{
+  thread_table_t *thr = thread_get_current_thread_entry();
+  pcb_t *process;
+  elf_info_t *elf;
+  virtaddr_t page = addr & PAGE_SIZE_MASK;
+  virtaddr_t stack_bottom;
+  uint64_t location = 0, offset;
+  int to_read = 0;
+  int writable = 1;
+  physaddr_t phys_page;
+  fs_t *fs = NULL;
+  int fileid;
+  uint32_t generation = 0;
+
+  if (thr->pid < 0 || thr->pagetable == NULL)
+    return -1;
+
+  process = &process_table[thr->pid];
+  elf = &process->elf;
+  stack_bottom = (USERLAND_STACK_TOP & PAGE_SIZE_MASK)
+    - (CONFIG_USERLAND_STACK_SIZE - 1) * PAGE_SIZE;
+
+  /* We assume that the segments begin at a page boundary. (The
+     linker script in the userland directory helps users get this
+     right.) */
+  if (page >= elf->ro_vaddr
+      && page < elf->ro_vaddr + elf->ro_pages*PAGE_SIZE) {
+    offset = page - elf->ro_vaddr;
+    location = elf->ro_location + offset;
+    if (offset < elf->ro_size)
+      to_read = MIN(PAGE_SIZE, elf->ro_size - offset);
+    writable = 0;
+  } else if (page >= elf->rw_vaddr
+             && page < elf->rw_vaddr + elf->rw_pages*PAGE_SIZE) {
+    offset = page - elf->rw_vaddr;
+    location = elf->rw_location + offset;
+    /* Past rw_size is BSS, which is only zeroed */
+    if (offset < elf->rw_size)
+      to_read = MIN(PAGE_SIZE, elf->rw_size - offset);
+  } else if (page < stack_bottom) {
+    return -1;
   }
 
-  for(i = 0; i < (int)elf.rw_pages; i++) {
-    int left_to_read = elf.rw_size - i*PAGE_SIZE;
-    phys_page = physmem_allocblock();
-    KERNEL_ASSERT(phys_page != 0);
-    virt_page = elf.rw_vaddr + i*PAGE_SIZE;
-    vm_map(pagetable, phys_page,
-           virt_page, PAGE_USER | PAGE_WRITE);
-    /* Zero the page */
-    memoryset((void*)virt_page, 0, PAGE_SIZE);
-    /* Fill the page from rw segment */
-    if (left_to_read > 0) {
-      KERNEL_ASSERT(vfs_seek(file, elf.rw_location + i*PAGE_SIZE) == VFS_OK);
-      KERNEL_ASSERT(vfs_read(file, (void*)virt_page,
-                             MIN(PAGE_SIZE, left_to_read))
-                    == (int) MIN(PAGE_SIZE, left_to_read));
+  /* Processes have a single thread and an executable handle of their
+     own, so fills of different processes overlap freely and need no
+     lock: only this thread maps pages here or seeks on the file. */
+  /* Read-only pages of the file are shared with every process
+     running the same program */
+  if (!writable && to_read > 0
+      && vfs_get_fileid(process->file, &fs, &fileid) == VFS_OK) {
+    phys_page = pagecache_lookup(fs, fileid, location);
+    if (phys_page != 0) {
+      vm_map(thr->pagetable, phys_page, page, PAGE_USER);
+      return 0;
     }
+    /* A write to the file from here on keeps this copy out */
+    generation = pagecache_generation(fs, fileid);
   }
 
-  /* Done with the file. */
-  vfs_close(file);
+  phys_page = physmem_allocblock();
+  KERNEL_ASSERT(phys_page != 0);
+  vm_map(thr->pagetable, phys_page, page, PAGE_USER | PAGE_WRITE);
 
-  *stack_top = USERLAND_STACK_TOP;
+  if (to_read > 0) {
+    KERNEL_ASSERT(vfs_seek(process->file, location) == VFS_OK);
+    KERNEL_ASSERT(vfs_read(process->file, (void*)page, to_read) == to_read);
+  }
+  /* Zero the rest of the page */
+  memoryset((void*)(page + to_read), 0, PAGE_SIZE - to_read);
+
+  //Make the page read only
+  if (!writable) {
+    vm_map(thr->pagetable, phys_page, page, PAGE_USER);
+    if (fs != NULL)
+      pagecache_insert(fs, fileid, location, phys_page, generation);
+  }
 
   return 0;
 }
 
+/// Fault in the pages of a userland buffer before it is handed to
+/// code that accesses it under a spinlock.
+void process_touch_buffer(const void *buffer, int length)
+{
+  thread_table_t *thr = thread_get_current_thread_entry();
+  virtaddr_t page = (virtaddr_t)buffer & PAGE_SIZE_MASK;
+  uint64_t i, pages;
+
+  if (length <= 0 || thr->pagetable == NULL)
+    return;
+
+  /* Counted in pages, the stack ends at the very top of memory */
+  pages = (((virtaddr_t)buffer & ~PAGE_SIZE_MASK) + length + PAGE_SIZE - 1)
+    / PAGE_SIZE;
+  for (i = 0; i < pages; i++, page += PAGE_SIZE) {
+    if (vm_getmap(thr->pagetable, page) == 0)
+      process_handle_fault(page);
+  }
+}
+
 void process_start(uint64_t arg) {
   int pid;
   context_t user_context;
@@ -198,6 +273,10 @@ pid_t process_spawn(const char *executable, int flags)
   }
 
   tid = thread_create((void (*)(uint64_t))(&process_start), pid);
+  if (tid < 0) {
+    free_process_id(pid);
+    return PROCESS_PTABLE_FULL;
+  }
   thread_get_thread_entry(tid)->pid = pid;
 
   stringcopy(&process_table[pid].path, executable, strlen(executable) + 1);
@@ -215,6 +294,76 @@ pcb_t *process_get_current_process_entry(void) {
   return &process_table[process_get_current_process()];
 }
 
+void process_fork_start(uint64_t arg) {
+  int pid;
+  context_t user_context;
+  thread_table_t *thr = thread_get_current_thread_entry();
+
+  pid = (int)arg;
+
+  /* The page table was made by process_fork */
+  process_set_pagetable(thr->pagetable);
+
+  memoryset(&user_context, 0, sizeof(user_context));
+
+  _context_set_ip(&user_context, process_table[pid].fork_func);
+  _context_set_sp(&user_context, USERLAND_STACK_TOP);
+  _context_set_arg(&user_context, process_table[pid].fork_arg);
+
+  thread_goto_userland(&user_context);
+}
+
+pid_t process_fork(virtaddr_t func, uint64_t arg)
+{
+  pcb_t *parent = process_get_current_process_entry();
+  pcb_t *child;
+  pagetable_t *pagetable;
+  TID_t tid;
+  pid_t pid;
+
+  pid = alloc_process_id();
+  if (pid == PROCESS_MAX_PROCESSES) {
+    return PROCESS_PTABLE_FULL;
+  }
+  child = &process_table[pid];
+
+  stringcopy(child->path, parent->path, PROCESS_MAX_FILELENGTH);
+  child->elf = parent->elf;
+  child->fork_func = func;
+  child->fork_arg = arg;
+
+  /* Pages the parent has not touched yet are still filled from the
+     executable, so the child needs its own handle on it */
+  child->file = vfs_open(child->path);
+  if (child->file < 0) {
+    free_process_id(pid);
+    return -1;
+  }
+
+  pagetable = vm_fork_pagetable(thread_get_current_thread_entry()->pagetable,
+                                pid);
+  if (pagetable == NULL) {
+    vfs_close(child->file);
+    free_process_id(pid);
+    return -1;
+  }
+
+  tid = thread_create(&process_fork_start, pid);
+  if (tid < 0) {
+    /* Also drops the shares of the copy-on-write frames */
+    vm_destroy_pagetable(pagetable);
+    vfs_close(child->file);
+    free_process_id(pid);
+    return -1;
+  }
+  thread_get_thread_entry(tid)->pid = pid;
+  thread_get_thread_entry(tid)->pagetable = pagetable;
+
+  thread_run(tid);
+
+  return pid;
+}
+
 static int tty_read(void *buffer, int length) {
   device_t *dev;
   gcd_t *gcd;
@@ -247,6 +396,7 @@ int process_read(int filehandle, void *buffer, int length) {
   if (length < 0) {
     retval = IO_NEGATIVE_LENGTH;
   } else if (filehandle == FD_STDIN) {
+    process_touch_buffer(buffer, length);
     retval = tty_read(buffer, length);
   } else if (filehandle == FD_STDOUT
             || filehandle == FD_STDERR) {
@@ -269,6 +419,7 @@ int process_write(int filehandle, const void *buffer, int length) {
     retval = IO_INVALID_HANDLE;
   } else if (filehandle == FD_STDOUT
             || filehandle == FD_STDERR) {
+    process_touch_buffer(buffer, length);
     retval = tty_write(buffer, length);
   } else {
     retval = IO_NOT_IMPLEMENTED;
@@ -279,16 +430,29 @@ int process_write(int filehandle, const void *buffer, int length) {
 /// Stop the current process and the kernel thread in which it runs
 /// Argument: return value
 void process_exit(int retval){
-  thread_table_t* thr;
-  thr = thread_get_current_thread_entry();
+  thread_table_t *thr = thread_get_current_thread_entry();
   pid_t pid = process_get_current_process();
-  process_table[pid].state = PROCESS_ZOMBIE;
+  pagetable_t *pagetable;
+  klock_status_t status;
+
+  /* Let go of what the slot refers to while it is still ours: once
+     the process is a zombie, process_join() may free the slot and a
+     new process may take it */
+  vfs_close(process_table[pid].file);
+  process_table[pid].file = -1;
+
+  /* Move off the page table before it is freed */
+  pagetable = thr->pagetable;
+  thr->pagetable = NULL;
+  process_set_pagetable(NULL);
+  vm_destroy_pagetable(pagetable);
+
+  status = klock_lock(&process_table_lock);
   process_table[pid].retval = retval;
-  klock_status_t status = klock_lock(&process_table_lock);
-  sleepq_wake (&process_table[pid].state);
+  process_table[pid].state = PROCESS_ZOMBIE;
+  sleepq_wake(&process_table[pid].state);
   klock_open(status, &process_table_lock);
-  vm_destroy_pagetable(thr->pagetable);
-  thr->pagetable = NULL;
+
   thread_finish();
 }
 
@@ -296,16 +460,66 @@ void process_exit(int retval){
 /// and mark the process-table entry as free
 int process_join(pid_t pid){
         int retval;
+        klock_status_t status = klock_lock(&process_table_lock);
         while (process_table[pid].state != PROCESS_ZOMBIE){
-          klock_status_t status = klock_lock(&process_table_lock);
           sleepq_add(&process_table[pid].state);
           klock_open(status, &process_table_lock);
           thread_switch();
+          status = klock_lock(&process_table_lock);
         }
         retval = process_table[pid].retval;
         process_table[pid].state = PROCESS_FREE;
         process_table[pid].pid = -1;
-        klock_status_t status = klock_lock(&process_table_lock);
         klock_open(status, &process_table_lock);
         return retval;
 }
+
+/// Set the scheduling priority of all threads of the given process.
+/// A process may set its own priority freely, but may only lower
+/// (raise the level of) the priority of other processes.
+/// Returns 0 on success, -1 on an invalid process or priority, or if
+/// the caller may not give the process that priority.
+int process_set_priority(pid_t pid, int priority){
+  TID_t t;
+  thread_table_t *thr;
+  klock_status_t status;
+  int self;
+  int found = 0;
+
+  if (pid < 0 || pid >= PROCESS_MAX_PROCESSES
+      || priority < 0 || priority >= CONFIG_SCHEDULER_LEVELS)
+    return -1;
+
+  self = (pid == process_get_current_process());
+
+  status = klock_lock(&process_table_lock);
+
+  if (process_table[pid].state != PROCESS_RUNNING) {
+    klock_open(status, &process_table_lock);
+    return -1;
+  }
+
+  /* Check every thread before changing any, so that a refusal leaves
+     the process as it was */
+  for (t = 0; t < CONFIG_MAX_THREADS; t++) {
+    thr = thread_get_thread_entry(t);
+    if (t == IDLE_THREAD_TID || thr->state == THREAD_FREE || thr->pid != pid)
+      continue;
+    if (!self && priority < thr->base_priority) {
+      klock_open(status, &process_table_lock);
+      return -1;
+    }
+    found = 1;
+  }
+
+  for (t = 0; found && t < CONFIG_MAX_THREADS; t++) {
+    thr = thread_get_thread_entry(t);
+    if (t == IDLE_THREAD_TID || thr->state == THREAD_FREE || thr->pid != pid)
+      continue;
+    scheduler_set_priority(t, priority);
+  }
+
+  klock_open(status, &process_table_lock);
+
+  return found ? 0 : -1;
+}
@@ -6,6 +6,7 @@
 #include "lib/types.h"
 #include "vm/memory.h"
 #include "kernel/klock.h"
+#include <elf_info.h>
 
 #define PROCESS_PTABLE_FULL  (-1)
 #define PROCESS_ILLEGAL_JOIN (-2)
@@ -23,6 +24,15 @@ typedef struct {
   char path[256];
   enum process_state state;
   uint64_t retval;
+  /* Segments of the executable, filled in page by page on first
+     touch by process_handle_fault() */
+  elf_info_t elf;
+  /* The executable (an openfile_t), kept open while the process
+     runs */
+  int file;
+  /* Function and argument a forked process starts in */
+  virtaddr_t fork_func;
+  uint64_t fork_arg;
 } pcb_t;
 
 /// Initialize process table.
@@ -39,6 +49,13 @@ int process_write(int filehandle, const void *buffer, int length);
 /// Returns the process ID of the new process.
 pid_t process_spawn(char const* executable, int flags);
 
+/// Create a new process with a copy-on-write copy of the address
+/// space of the current one. Its only thread calls func(arg), which
+/// must end with syscall_exit.
+/// Returns the process ID of the new process, or a negative value on
+/// error.
+pid_t process_fork(virtaddr_t func, uint64_t arg);
+
 /// Stop the current process and the kernel thread in which it runs
 /// Argument: return value
 void process_exit(int retval);
@@ -46,4 +63,20 @@ void process_exit(int retval);
 /// and mark the process-table entry as free
 int process_join(pid_t pid);
 
+/// Fill in the page holding addr if it belongs to a segment or the
+/// stack of the current process and has not been touched before.
+/// Called on page faults; may block. Returns 0 if the page is now
+/// mapped, -1 if addr is not demand paged.
+int process_handle_fault(virtaddr_t addr);
+
+/// Fault in every page of a userland buffer, so that it can be
+/// accessed where a page fault cannot be served.
+void process_touch_buffer(const void *buffer, int length);
+
+/// Set the scheduling priority of all threads of the given process.
+/// Another process may only be given a lower priority than it has.
+/// Returns 0 on success, -1 on an invalid process or priority, or if
+/// the change is not allowed.
+int process_set_priority(pid_t pid, int priority);
+
 #endif // KUDOS_PROC_PROCESS_H
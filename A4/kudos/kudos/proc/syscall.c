@@ -9,6 +9,8 @@
 #include "vm/memory.h"
 #include "proc/process.h"
 #include "proc/usr_sem.h"
+#include "kernel/sleepq.h"
+#include "proc/futex.h"
 
 /// Handle system calls. Interrupts are enabled when this function is
 /// called.
@@ -41,12 +43,31 @@ uintptr_t syscall_entry(uintptr_t syscall,
   case SYSCALL_SPAWN:
     return process_spawn((char*) arg0, (int) arg1);
     break;
+  case SYSCALL_FORK:
+    return process_fork((virtaddr_t) arg0, (uint64_t) arg1);
+    break;
   case SYSCALL_EXIT:
     process_exit((int) arg0);
     break;
   case SYSCALL_JOIN:
     return process_join((pid_t) arg0);
     break;
+  case SYSCALL_SETPRIORITY:
+    return process_set_priority((pid_t) arg0, (int) arg1);
+    break;
+  case SYSCALL_SLEEP:
+    if ((int) arg0 < 0)
+      return -1;
+    sleepq_sleep((uint32_t) arg0);
+    break;
+  case SYSCALL_FUTEX_WAIT:
+    if ((int) arg2 < 0)
+      return FUTEX_EINVAL;
+    return futex_wait((uint32_t*) arg0, (uint32_t) arg1, (uint32_t) arg2);
+    break;
+  case SYSCALL_FUTEX_WAKE:
+    return futex_wake((uint32_t*) arg0, (int) arg1);
+    break;
   case SYSCALL_SEM_OPEN:
     usr_sem_init();
     break;
@@ -14,6 +14,10 @@
 #define SYSCALL_JOIN      (0x103)
 #define SYSCALL_FORK      (0x104)
 #define SYSCALL_MEMLIMIT  (0x105)
+#define SYSCALL_SETPRIORITY (0x106)
+#define SYSCALL_SLEEP     (0x107)
+#define SYSCALL_FUTEX_WAIT (0x108)
+#define SYSCALL_FUTEX_WAKE (0x109)
 
 #define SYSCALL_OPEN      (0x201)
 #define SYSCALL_CLOSE     (0x202)
@@ -31,6 +31,7 @@ static klock_t usr_sem_table_lock;
 void usr_sem_init() {
   int i;
   klock_init(&usr_sem_table_lock);
+  spinlock_register(&usr_sem_table_lock, "usr_sem_table_lock");
   for (i = 0; i < USR_SEM_MAX_SEMS; ++i) {
     klock_init(&usr_sem_table[i].klock);
     usr_sem_table[i].value = -1;
@@ -67,7 +68,7 @@ int usr_sem_close(usr_sem_t* sem){
   if (sem->value != sem->maxvalue){
     return(-1);
   }
-  klock_init(sem->klock);
+  klock_init(&sem->klock);
   klock_status_t status = klock_lock(&usr_sem_table_lock);
   semaphore_destroy(sem->ksem);
   sem->value = -1;
@@ -15,6 +15,7 @@ void process_set_pagetable(pagetable_t *pagetable)
     /* Transform the pagetable_t to pml4 */
     interrupt_status_t intr_status;
     pml4_t *pml4 = (pml4_t*)pagetable;
+    context_t *cxt;
 
     /* Switch page-dir */
     /* This means we can make use of the above mappings in
@@ -22,9 +23,18 @@ void process_set_pagetable(pagetable_t *pagetable)
      * in ring 0 and everything is kernel like, except we dont have
      * the heap mapped in, and we now have some extra pages mapped in
      * if vm_map worked correctly hihi */
+    /* Without a page table of its own, a thread runs on the kernel's */
+    if(pml4 == NULL)
+      pml4 = (pml4_t*)vmm_get_kernel_pml4();
+
     intr_status = _interrupt_disable(); //
-    vmm_setcr3((uintptr_t)pml4);
-    thread_get_current_thread_entry()->context->pml4 = (uintptr_t)pml4;
-    thread_get_current_thread_entry()->context->virt_memory = pml4;
+    cxt = thread_get_current_thread_entry()->context;
+
+    /* A new address space needs a PCID of its own */
+    if(cxt->pml4 != (uintptr_t)pml4)
+      cxt->pcid.generation = 0;
+    vmm_setcr3(vmm_cr3((pagetable_t*)pml4, &cxt->pcid));
+    cxt->pml4 = (uintptr_t)pml4;
+    cxt->virt_memory = pml4;
     _interrupt_set_state(intr_status);
 }
@@ -13,6 +13,16 @@
 /* Physical Memory Management */
 /* For the architecture that supports it */
 
+/* Counters of the per-CPU frame cache of one CPU */
+typedef struct {
+  /* single frame allocations served from the cache */
+  uint32_t hits;
+  /* single frame allocations that had to refill the cache */
+  uint32_t misses;
+  /* single frame frees that had to drain the cache */
+  uint32_t drains;
+} physmem_stats_t;
+
 /* Prototypes */
 void physmem_init(void *boot_info);
 
@@ -22,6 +32,13 @@ physaddr_t physmem_allocblocks(uint32_t count);
 void physmem_freeblock(void *ptr);
 void physmem_freeblocks(void *ptr, uint32_t size);
 
+void physmem_share(physaddr_t addr);
+int physmem_shared(physaddr_t addr);
+void physmem_release(physaddr_t addr);
+
+void physmem_get_stats(int cpu, physmem_stats_t *stats);
+void physmem_print_stats(void);
+
 /* Virtual Memory Management */
 #define USERLAND_STACK_TOP 0xFFFFFFFFFFFFFFFF
 
@@ -31,19 +48,32 @@ void vm_init(void);
 void vm_map(pagetable_t *pagetable, physaddr_t physaddr,
             virtaddr_t vaddr, int flags);
 void vm_unmap(pagetable_t *pagetable, virtaddr_t vaddr);
+void vm_map_range(pagetable_t *pagetable, physaddr_t physaddr,
+                  virtaddr_t vaddr, uint64_t pages, int flags);
+void vm_unmap_range(pagetable_t *pagetable, virtaddr_t vaddr, uint64_t pages);
 
 physaddr_t vm_getmap(pagetable_t *pagetable, virtaddr_t vaddr);
 void vm_set_dirty(pagetable_t *pagetable, virtaddr_t vaddr, int dirty);
 
 pagetable_t *vm_create_pagetable(uint32_t asid);
+pagetable_t *vm_fork_pagetable(pagetable_t *pagetable, uint32_t asid);
+int vm_handle_cow(pagetable_t *pagetable, virtaddr_t vaddr);
 void vm_destroy_pagetable(pagetable_t *pagetable);
 void vm_update_mappings(virtaddr_t *thread);
 
-void* kmalloc(uint64_t size);
-
 //void vm_memwrite(pagetable_t *pagetable, unsigned int buflen,
 //                 virtaddr_t target, const void *source);
 
+/* Kernel Heap */
+/* For the architecture that supports it */
+typedef struct kmem_cache kmem_cache_t;
+
+void kmem_init(void);
+kmem_cache_t *kmem_cache_create(const char *name, uint32_t size);
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+void kmem_print_stats(void);
+
 void* kmalloc(uint64_t size);
 void kfree(void* ptr);
 
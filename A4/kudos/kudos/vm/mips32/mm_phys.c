@@ -8,6 +8,8 @@
 #include "kernel/spinlock.h"
 #include "kernel/interrupt.h"
 #include "kernel/assert.h"
+#include "kernel/config.h"
+#include "lib/libc.h"
 
 /** @name Page pool
  *
@@ -31,6 +33,9 @@ static int physmem_num_free_pages;
    purpose).  */
 static int physmem_static_end;
 
+/* Number of users of each reserved page besides the first one */
+static uint8_t *physmem_share_count;
+
 /* Spinlock to handle synchronous access to physmem_free_pages */
 static spinlock_t physmem_slock;
 
@@ -109,6 +114,8 @@ void physmem_init(void *bootinfo)
   physmem_free_pages =
     (uint32_t *)stalloc(bitmap_sizeof(physmem_num_pages));
   bitmap_init(physmem_free_pages, physmem_num_pages);
+  physmem_share_count = (uint8_t *)stalloc(physmem_num_pages);
+  memoryset(physmem_share_count, 0, physmem_num_pages);
 
   /* Note that number of reserved pages must be get after we have
      (staticly) reserved memory for bitmap. */
@@ -187,6 +194,92 @@ void physmem_freeblock(void *Ptr)
   _interrupt_set_state(intr_status);
 }
 
+/**
+ * Adds a user to a reserved page. A page has a single user when it is
+ * allocated; every further user must be dropped again with
+ * physmem_release().
+ *
+ * @param phys_addr The page.
+ */
+void physmem_share(physaddr_t phys_addr)
+{
+  interrupt_status_t intr_status;
+  int i = phys_addr / PAGE_SIZE;
+
+  KERNEL_ASSERT(i >= physmem_static_end && i < physmem_num_pages);
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&physmem_slock);
+
+  KERNEL_ASSERT(physmem_share_count[i] < 0xFF);
+  physmem_share_count[i]++;
+
+  spinlock_release(&physmem_slock);
+  _interrupt_set_state(intr_status);
+}
+
+/**
+ * Returns the number of users of a reserved page besides the caller.
+ *
+ * @param phys_addr The page.
+ */
+int physmem_shared(physaddr_t phys_addr)
+{
+  int i = phys_addr / PAGE_SIZE;
+
+  if (i < 0 || i >= physmem_num_pages)
+    return 0;
+
+  return physmem_share_count[i];
+}
+
+/**
+ * Drops a user of a reserved page and frees the page if that was its
+ * last user.
+ *
+ * @param phys_addr The page.
+ */
+void physmem_release(physaddr_t phys_addr)
+{
+  interrupt_status_t intr_status;
+  int i = phys_addr / PAGE_SIZE;
+  int last;
+
+  KERNEL_ASSERT(i >= physmem_static_end && i < physmem_num_pages);
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&physmem_slock);
+
+  last = (physmem_share_count[i] == 0);
+  if (!last)
+    physmem_share_count[i]--;
+
+  spinlock_release(&physmem_slock);
+  _interrupt_set_state(intr_status);
+
+  if (last)
+    physmem_freeblock((void*)(i * PAGE_SIZE));
+}
+
+/**
+ * Returns the frame cache counters of the given CPU. There are no
+ * per-CPU frame caches on MIPS32, so they are all zero.
+ */
+void physmem_get_stats(int cpu, physmem_stats_t *stats)
+{
+  KERNEL_ASSERT(cpu >= 0 && cpu < CONFIG_MAX_CPUS);
+  stats->hits = 0;
+  stats->misses = 0;
+  stats->drains = 0;
+}
+
+/**
+ * Prints the frame cache counters. Nothing to print on MIPS32.
+ */
+void physmem_print_stats(void)
+{
+}
+
 
 
 /** @} */
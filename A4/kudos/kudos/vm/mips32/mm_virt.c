@@ -66,8 +66,38 @@ pagetable_t *vm_create_pagetable(uint32_t asid)
 }
 
 /**
- * Destroys given pagetable. Frees the memory (one page) allocated for
- * the pagetable. Does not remove mappings from the TLB.
+ * Copy-on-write copies of page tables need per-frame reference
+ * counts, which the MIPS32 physical memory manager does not keep.
+ *
+ * @return NULL, always
+ */
+pagetable_t *vm_fork_pagetable(pagetable_t *pagetable, uint32_t asid)
+{
+  pagetable = pagetable;
+  asid = asid;
+
+  /* Not implemented */
+  return NULL;
+}
+
+/**
+ * No page is ever copy-on-write on MIPS32, see vm_fork_pagetable().
+ *
+ * @return -1, always
+ */
+int vm_handle_cow(pagetable_t *pagetable, virtaddr_t vaddr)
+{
+  pagetable = pagetable;
+  vaddr = vaddr;
+
+  return -1;
+}
+
+/**
+ * Destroys given pagetable. Every frame mapped in it loses a user,
+ * which frees frames nobody else holds, and the memory (one page)
+ * allocated for the pagetable is freed. Does not remove mappings from
+ * the TLB.
  *
  * @param pagetable Page table to destroy
  *
@@ -75,6 +105,15 @@ pagetable_t *vm_create_pagetable(uint32_t asid)
 
 void vm_destroy_pagetable(pagetable_t *pagetable)
 {
+  unsigned int i;
+
+  for(i = 0; i < pagetable->valid_count; i++) {
+    if(pagetable->entries[i].V0)
+      physmem_release(pagetable->entries[i].PFN0 << 12);
+    if(pagetable->entries[i].V1)
+      physmem_release(pagetable->entries[i].PFN1 << 12);
+  }
+
   physmem_freeblock((void*)ADDR_KERNEL_TO_PHYS((uint32_t) pagetable));
 }
 
@@ -189,6 +228,30 @@ void vm_unmap(pagetable_t *pagetable, virtaddr_t vaddr)
   /* Not implemented */
 }
 
+/**
+ * Maps a range of pages to consecutive physical pages, see vm_map().
+ * The TLB is not touched, so there is nothing to batch here.
+ */
+void vm_map_range(pagetable_t *pagetable, physaddr_t physaddr,
+                  virtaddr_t vaddr, uint64_t pages, int flags)
+{
+  uint64_t i;
+
+  for (i = 0; i < pages; i++)
+    vm_map(pagetable, physaddr + i*PAGE_SIZE, vaddr + i*PAGE_SIZE, flags);
+}
+
+/**
+ * Unmaps a range of pages, see vm_unmap().
+ */
+void vm_unmap_range(pagetable_t *pagetable, virtaddr_t vaddr, uint64_t pages)
+{
+  uint64_t i;
+
+  for (i = 0; i < pages; i++)
+    vm_unmap(pagetable, vaddr + i*PAGE_SIZE);
+}
+
 physaddr_t vm_getmap(pagetable_t *pagetable, virtaddr_t vaddr)
 {
   virtaddr_t vpn = vaddr >> 12; /* Get page number, as 2**12 = 4096 = page size */
@@ -6,6 +6,9 @@
 
 #include "kernel/panic.h"
 #include "kernel/assert.h"
+#include "kernel/interrupt.h"
+#include "kernel/thread.h"
+#include "proc/process.h"
 #include <pagetable.h>
 #include <tlb.h>
 #include <types.h>
@@ -15,14 +18,38 @@ void tlb_modified_exception(UNUSED bool in_userland)
   KERNEL_PANIC("Unhandled TLB modified exception");
 }
 
+/* Fills in the missing page of the current process on demand and
+   reloads the TLB from its pagetable. */
+static int tlb_fill_on_demand(void)
+{
+  tlb_exception_state_t state;
+  thread_table_t *thr;
+
+  _tlb_get_exception_state(&state);
+
+  /* Filling may block on the disk */
+  _interrupt_enable();
+  if (process_handle_fault(state.badvaddr) != 0) {
+    _interrupt_disable();
+    return -1;
+  }
+  _interrupt_disable();
+
+  thr = thread_get_current_thread_entry();
+  tlb_fill(thr->pagetable);
+  return 0;
+}
+
 void tlb_load_exception(UNUSED bool in_userland)
 {
-  KERNEL_PANIC("Unhandled TLB load exception");
+  if (tlb_fill_on_demand() != 0)
+    KERNEL_PANIC("Unhandled TLB load exception");
 }
 
 void tlb_store_exception(UNUSED bool in_userland)
 {
-  KERNEL_PANIC("Unhandled TLB store exception");
+  if (tlb_fill_on_demand() != 0)
+    KERNEL_PANIC("Unhandled TLB store exception");
 }
 
 /**
@@ -3,7 +3,7 @@
 # Set the module name
 MODULE := vm
 
-FILES :=
+FILES := pagecache.c
 
 MIPSSRC += $(patsubst %, $(MODULE)/%, $(FILES))
 X64SRC += $(patsubst %, $(MODULE)/%, $(FILES))
@@ -0,0 +1,329 @@
+/*
+ * Page cache for executable text.
+ */
+
+#include "vm/pagecache.h"
+#include "vm/memory.h"
+#include "kernel/config.h"
+#include "kernel/spinlock.h"
+#include "kernel/interrupt.h"
+#include "lib/libc.h"
+
+/** @name Page cache
+ *
+ * The page cache remembers which frame holds each read-only page of
+ * an executable, keyed by filesystem, file id and offset in the
+ * file. Processes running the same program map these frames read
+ * only instead of reading their own copy of the text from disk.
+ *
+ * A cached frame has the cache as one of its users (see
+ * physmem_share()), so it stays around after the processes mapping it
+ * are gone. When the cache is full, a clock sweep evicts a page that
+ * no process maps and that has not been looked up since the hand last
+ * passed it.
+ *
+ * Writing to a file drops its pages from the cache. Removing a file
+ * or unmounting drops the pages of the whole filesystem, since the
+ * file id may be reused. Every invalidation also bumps the
+ * generation of the file, which a reader samples before it reads a
+ * page from disk and hands back to pagecache_insert(): a page read
+ * across a write is then not cached, as its contents may predate it.
+ *
+ * @{
+ */
+
+#define PAGECACHE_BUCKETS 64
+
+typedef struct {
+  fs_t *fs;            /* NULL if the entry is unused */
+  int fileid;
+  uint32_t offset;     /* page aligned offset in the file */
+  physaddr_t frame;
+  int next;            /* next entry in the same bucket or free list */
+  int referenced;      /* looked up since the clock hand passed */
+} pagecache_entry_t;
+
+static pagecache_entry_t pagecache_entries[CONFIG_PAGECACHE_PAGES];
+
+/* First entry of each hash chain, negative if empty */
+static int pagecache_buckets[PAGECACHE_BUCKETS];
+
+/* First unused entry, negative if none */
+static int pagecache_free;
+
+/* Clock hand for eviction */
+static int pagecache_hand;
+
+/* Invalidation generations, shared by the files that hash alike */
+static uint32_t pagecache_generations[PAGECACHE_BUCKETS];
+
+static spinlock_t pagecache_slock;
+
+static int pagecache_bucket(fs_t *fs, int fileid, uint32_t offset)
+{
+  uint64_t h = (uint64_t)(uintptr_t)fs;
+
+  h = h * 31 + (uint32_t)fileid;
+  h = h * 31 + offset / PAGE_SIZE;
+  return h % PAGECACHE_BUCKETS;
+}
+
+static int pagecache_file_bucket(fs_t *fs, int fileid)
+{
+  uint64_t h = (uint64_t)(uintptr_t)fs;
+
+  h = h * 31 + (uint32_t)fileid;
+  return h % PAGECACHE_BUCKETS;
+}
+
+/* Returns the entry for the key, negative if not cached. The caller
+   holds pagecache_slock. */
+static int pagecache_find(fs_t *fs, int fileid, uint32_t offset)
+{
+  int i = pagecache_buckets[pagecache_bucket(fs, fileid, offset)];
+
+  while (i >= 0) {
+    pagecache_entry_t *e = &pagecache_entries[i];
+    if (e->fs == fs && e->fileid == fileid && e->offset == offset)
+      return i;
+    i = e->next;
+  }
+
+  return -1;
+}
+
+/* Unlinks an entry from its bucket, puts it on the free list and
+   returns its frame. The caller holds pagecache_slock. */
+static physaddr_t pagecache_remove(int i)
+{
+  pagecache_entry_t *e = &pagecache_entries[i];
+  int *link = &pagecache_buckets[pagecache_bucket(e->fs, e->fileid,
+                                                  e->offset)];
+
+  while (*link != i)
+    link = &pagecache_entries[*link].next;
+  *link = e->next;
+
+  e->fs = NULL;
+  e->next = pagecache_free;
+  pagecache_free = i;
+
+  return e->frame;
+}
+
+/* Finds an entry to reuse, evicting a page no process maps. Returns
+   negative if every cached page is in use. The caller holds
+   pagecache_slock. */
+static int pagecache_evict(physaddr_t *frame)
+{
+  int step;
+
+  /* Two rounds: the first may only clear referenced bits */
+  for (step = 0; step < 2 * CONFIG_PAGECACHE_PAGES; step++) {
+    int i = pagecache_hand;
+    pagecache_entry_t *e = &pagecache_entries[i];
+
+    pagecache_hand = (pagecache_hand + 1) % CONFIG_PAGECACHE_PAGES;
+
+    if (e->referenced) {
+      e->referenced = 0;
+      continue;
+    }
+
+    /* Only evict pages whose one user is the cache */
+    if (physmem_shared(e->frame) == 0) {
+      *frame = pagecache_remove(i);
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ * Initializes the page cache. Called once during boot.
+ */
+void pagecache_init(void)
+{
+  int i;
+
+  spinlock_reset(&pagecache_slock);
+  spinlock_register(&pagecache_slock, "pagecache_slock");
+
+  for (i = 0; i < PAGECACHE_BUCKETS; i++) {
+    pagecache_buckets[i] = -1;
+    pagecache_generations[i] = 0;
+  }
+
+  for (i = 0; i < CONFIG_PAGECACHE_PAGES; i++) {
+    pagecache_entries[i].fs = NULL;
+    pagecache_entries[i].next = i + 1;
+  }
+  pagecache_entries[CONFIG_PAGECACHE_PAGES - 1].next = -1;
+
+  pagecache_free = 0;
+  pagecache_hand = 0;
+}
+
+/**
+ * Looks up a cached page. A found frame gets one more user, which the
+ * caller drops with physmem_release() when it unmaps the page.
+ *
+ * @param fs Filesystem of the file.
+ * @param fileid Filesystem specific id of the file.
+ * @param offset Page aligned offset of the page in the file.
+ *
+ * @return The frame holding the page, 0 if it is not cached.
+ */
+physaddr_t pagecache_lookup(fs_t *fs, int fileid, uint32_t offset)
+{
+  interrupt_status_t intr_status;
+  physaddr_t frame = 0;
+  int i;
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&pagecache_slock);
+
+  i = pagecache_find(fs, fileid, offset);
+  if (i >= 0) {
+    pagecache_entries[i].referenced = 1;
+    frame = pagecache_entries[i].frame;
+    physmem_share(frame);
+  }
+
+  spinlock_release(&pagecache_slock);
+  _interrupt_set_state(intr_status);
+
+  return frame;
+}
+
+/**
+ * Returns the invalidation generation of a file, to be sampled before
+ * reading a page of it for pagecache_insert().
+ *
+ * @param fs Filesystem of the file.
+ * @param fileid Filesystem specific id of the file.
+ *
+ * @return The generation.
+ */
+uint32_t pagecache_generation(fs_t *fs, int fileid)
+{
+  interrupt_status_t intr_status;
+  uint32_t generation;
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&pagecache_slock);
+  generation = pagecache_generations[pagecache_file_bucket(fs, fileid)];
+  spinlock_release(&pagecache_slock);
+  _interrupt_set_state(intr_status);
+
+  return generation;
+}
+
+/**
+ * Adds a page read from a file to the cache, which becomes one more
+ * user of its frame. The page must not be written to anymore. Nothing
+ * happens if the page is cached already, the file was invalidated
+ * since the generation was sampled, or the cache is full of pages in
+ * use.
+ *
+ * @param fs Filesystem of the file.
+ * @param fileid Filesystem specific id of the file.
+ * @param offset Page aligned offset of the page in the file.
+ * @param frame Frame holding the page.
+ * @param generation Generation of the file sampled with
+ * pagecache_generation() before the page was read.
+ */
+void pagecache_insert(fs_t *fs, int fileid, uint32_t offset,
+                      physaddr_t frame, uint32_t generation)
+{
+  interrupt_status_t intr_status;
+  physaddr_t evicted = 0;
+  pagecache_entry_t *e;
+  int i, bucket;
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&pagecache_slock);
+
+  /* Another process may have read the same page meanwhile, or the
+     file may have changed during the read */
+  if (pagecache_find(fs, fileid, offset) >= 0
+      || pagecache_generations[pagecache_file_bucket(fs, fileid)]
+         != generation) {
+    spinlock_release(&pagecache_slock);
+    _interrupt_set_state(intr_status);
+    return;
+  }
+
+  i = pagecache_free;
+  if (i >= 0)
+    pagecache_free = pagecache_entries[i].next;
+  else
+    i = pagecache_evict(&evicted);
+
+  if (i >= 0) {
+    e = &pagecache_entries[i];
+    e->fs = fs;
+    e->fileid = fileid;
+    e->offset = offset;
+    e->frame = frame;
+    e->referenced = 0;
+
+    bucket = pagecache_bucket(fs, fileid, offset);
+    e->next = pagecache_buckets[bucket];
+    pagecache_buckets[bucket] = i;
+
+    physmem_share(frame);
+  }
+
+  spinlock_release(&pagecache_slock);
+  _interrupt_set_state(intr_status);
+
+  if (evicted != 0)
+    physmem_release(evicted);
+}
+
+/**
+ * Drops the cached pages of a file, or of a whole filesystem.
+ * Processes keep the frames they have mapped.
+ *
+ * @param fs Filesystem of the file.
+ * @param fileid Filesystem specific id of the file, negative for every
+ * file on fs.
+ */
+void pagecache_invalidate(fs_t *fs, int fileid)
+{
+  interrupt_status_t intr_status;
+  physaddr_t frame;
+  int i;
+
+  /* Refuse the pages being read now, before dropping those cached */
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&pagecache_slock);
+  if (fileid < 0) {
+    for (i = 0; i < PAGECACHE_BUCKETS; i++)
+      pagecache_generations[i]++;
+  } else {
+    pagecache_generations[pagecache_file_bucket(fs, fileid)]++;
+  }
+  spinlock_release(&pagecache_slock);
+  _interrupt_set_state(intr_status);
+
+  for (i = 0; i < CONFIG_PAGECACHE_PAGES; i++) {
+    intr_status = _interrupt_disable();
+    spinlock_acquire(&pagecache_slock);
+
+    frame = 0;
+    if (pagecache_entries[i].fs == fs
+        && (fileid < 0 || pagecache_entries[i].fileid == fileid))
+      frame = pagecache_remove(i);
+
+    spinlock_release(&pagecache_slock);
+    _interrupt_set_state(intr_status);
+
+    if (frame != 0)
+      physmem_release(frame);
+  }
+}
+
+/** @} */
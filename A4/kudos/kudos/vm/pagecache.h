@@ -0,0 +1,18 @@
+/*
+ * Page cache for executable text.
+ */
+
+#ifndef KUDOS_VM_PAGECACHE_H
+#define KUDOS_VM_PAGECACHE_H
+
+#include "lib/types.h"
+#include "fs/vfs.h"
+
+void pagecache_init(void);
+physaddr_t pagecache_lookup(fs_t *fs, int fileid, uint32_t offset);
+uint32_t pagecache_generation(fs_t *fs, int fileid);
+void pagecache_insert(fs_t *fs, int fileid, uint32_t offset,
+                      physaddr_t frame, uint32_t generation);
+void pagecache_invalidate(fs_t *fs, int fileid);
+
+#endif // KUDOS_VM_PAGECACHE_H
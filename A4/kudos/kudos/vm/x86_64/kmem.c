@@ -0,0 +1,409 @@
+/*
+ * Kernel Heap for KUDOS
+ */
+
+#include <arch.h>
+#include "vm/memory.h"
+#include "lib/libc.h"
+#include "kernel/spinlock.h"
+#include "kernel/interrupt.h"
+#include "kernel/panic.h"
+#include "lib/debug.h"
+
+/* Kernel objects are allocated from object caches. Each cache hands
+ * out objects of one size, carved out of single page slabs. A slab
+ * starts with a header, followed by the objects; its free objects are
+ * chained through their first word. A cache keeps its slabs on three
+ * lists by how many of their objects are used (partial, full, empty),
+ * and holds on to at most one empty slab. Allocating from a partial
+ * slab and freeing are O(1).
+ *
+ * kmalloc() serves sizes up to KMEM_MAX_CLASS from a set of caches of
+ * power of two sizes, and larger sizes from whole frames. Heap pages
+ * are mapped at their physical address, so slab objects are never
+ * page aligned and whole frame allocations always are; kfree() tells
+ * them apart by that. */
+
+/* Sizes of the kmalloc() caches, KMEM_MIN_CLASS to KMEM_MAX_CLASS */
+#define KMEM_MIN_SHIFT 4
+#define KMEM_MAX_SHIFT 10
+#define KMEM_CLASSES (KMEM_MAX_SHIFT - KMEM_MIN_SHIFT + 1)
+#define KMEM_MIN_CLASS (1 << KMEM_MIN_SHIFT)
+#define KMEM_MAX_CLASS (1 << KMEM_MAX_SHIFT)
+
+/* Objects are aligned to this */
+#define KMEM_ALIGN 16
+
+/* Identifies slab headers */
+#define KMEM_SLAB_MAGIC 0x51AB51AB
+
+/* Number of hash buckets for whole frame allocations */
+#define KMEM_LARGE_BUCKETS 64
+
+typedef struct kmem_slab {
+  uint32_t magic;
+  /* number of objects handed out */
+  uint32_t inuse;
+  kmem_cache_t *cache;
+  struct kmem_slab *next;
+  struct kmem_slab *prev;
+  /* first free object */
+  void *free;
+} kmem_slab_t;
+
+/* Offset of the first object in a slab */
+#define KMEM_SLAB_HEADER \
+  ((sizeof(kmem_slab_t) + KMEM_ALIGN - 1) & ~(uint64_t)(KMEM_ALIGN - 1))
+
+struct kmem_cache {
+  const char *name;
+  /* object size and number of objects per slab */
+  uint32_t size;
+  uint32_t per_slab;
+  spinlock_t slock;
+  kmem_slab_t *partial;
+  kmem_slab_t *full;
+  kmem_slab_t *empty;
+  /* counters */
+  uint32_t allocs;
+  uint32_t frees;
+  uint32_t slabs;
+  /* next cache in kmem_caches */
+  kmem_cache_t *next;
+};
+
+/* A whole frame allocation of kmalloc() */
+typedef struct kmem_large {
+  void *addr;
+  uint32_t frames;
+  struct kmem_large *next;
+} kmem_large_t;
+
+/* The cache of kmem_cache_t, which cannot come from itself */
+static kmem_cache_t kmem_cache_cache;
+
+/* The kmalloc() caches and the cache of kmem_large_t */
+static kmem_cache_t *kmem_classes[KMEM_CLASSES];
+static kmem_cache_t *kmem_large_cache;
+
+/* Whole frame allocations, hashed by frame number */
+static kmem_large_t *kmem_large[KMEM_LARGE_BUCKETS];
+static spinlock_t kmem_large_slock;
+
+/* All caches, for kmem_print_stats() */
+static kmem_cache_t *kmem_caches;
+static spinlock_t kmem_caches_slock;
+
+/* Allocates count frames. Every frame is mapped in the kernel at its
+ * physical address, see vm_init(). */
+static void *kmem_getframes(uint32_t count)
+{
+  if(count == 1)
+    return (void*)physmem_allocblock();
+  else
+    return (void*)physmem_allocblocks(count);
+}
+
+static void kmem_slab_link(kmem_slab_t **list, kmem_slab_t *slab)
+{
+  slab->prev = NULL;
+  slab->next = *list;
+  if(*list != NULL)
+    (*list)->prev = slab;
+  *list = slab;
+}
+
+static void kmem_slab_unlink(kmem_slab_t **list, kmem_slab_t *slab)
+{
+  if(slab->prev != NULL)
+    slab->prev->next = slab->next;
+  else
+    *list = slab->next;
+  if(slab->next != NULL)
+    slab->next->prev = slab->prev;
+}
+
+/* Makes a new slab for the cache, with all objects free */
+static kmem_slab_t *kmem_slab_create(kmem_cache_t *cache)
+{
+  kmem_slab_t *slab = kmem_getframes(1);
+  uint8_t *obj;
+  uint32_t i;
+
+  slab->magic = KMEM_SLAB_MAGIC;
+  slab->inuse = 0;
+  slab->cache = cache;
+  slab->free = NULL;
+
+  obj = (uint8_t*)slab + KMEM_SLAB_HEADER + (cache->per_slab - 1) * cache->size;
+  for(i = 0; i < cache->per_slab; i++, obj -= cache->size)
+    {
+      *(void**)obj = slab->free;
+      slab->free = obj;
+    }
+
+  cache->slabs++;
+  return slab;
+}
+
+static void kmem_cache_setup(kmem_cache_t *cache, const char *name,
+                             uint32_t size)
+{
+  interrupt_status_t intr_status;
+
+  if(size < sizeof(void*))
+    size = sizeof(void*);
+  size = (size + KMEM_ALIGN - 1) & ~(KMEM_ALIGN - 1);
+
+  if(size > PAGE_SIZE - KMEM_SLAB_HEADER)
+    KERNEL_PANIC("kmem_cache_create: Object size too large");
+
+  memoryset(cache, 0, sizeof(kmem_cache_t));
+  cache->name = name;
+  cache->size = size;
+  cache->per_slab = (PAGE_SIZE - KMEM_SLAB_HEADER) / size;
+  spinlock_reset(&cache->slock);
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&kmem_caches_slock);
+  cache->next = kmem_caches;
+  kmem_caches = cache;
+  spinlock_release(&kmem_caches_slock);
+  _interrupt_set_state(intr_status);
+}
+
+/**
+ * Creates a cache of objects of the given size, which must fit in a
+ * page together with the slab header.
+ *
+ * @param name Name of the cache, for statistics. Not copied.
+ * @param size Size of the objects in bytes.
+ *
+ * @return The new cache.
+ */
+kmem_cache_t *kmem_cache_create(const char *name, uint32_t size)
+{
+  kmem_cache_t *cache = kmem_cache_alloc(&kmem_cache_cache);
+
+  kmem_cache_setup(cache, name, size);
+  return cache;
+}
+
+/**
+ * Allocates an object from the given cache. The contents of the
+ * object are undefined.
+ */
+void *kmem_cache_alloc(kmem_cache_t *cache)
+{
+  kmem_slab_t *slab;
+  void *obj;
+  interrupt_status_t intr_status = _interrupt_disable();
+  spinlock_acquire(&cache->slock);
+
+  slab = cache->partial;
+  if(slab == NULL)
+    {
+      slab = cache->empty;
+      if(slab != NULL)
+        cache->empty = NULL;
+      else
+        slab = kmem_slab_create(cache);
+      kmem_slab_link(&cache->partial, slab);
+    }
+
+  obj = slab->free;
+  slab->free = *(void**)obj;
+  slab->inuse++;
+
+  if(slab->inuse == cache->per_slab)
+    {
+      kmem_slab_unlink(&cache->partial, slab);
+      kmem_slab_link(&cache->full, slab);
+    }
+
+  cache->allocs++;
+
+  spinlock_release(&cache->slock);
+  _interrupt_set_state(intr_status);
+
+  return obj;
+}
+
+/**
+ * Gives an object back to the cache it was allocated from.
+ */
+void kmem_cache_free(kmem_cache_t *cache, void *obj)
+{
+  kmem_slab_t *slab = (kmem_slab_t*)((uint64_t)obj & PAGE_SIZE_MASK);
+  kmem_slab_t *release = NULL;
+  interrupt_status_t intr_status;
+
+  if(slab->magic != KMEM_SLAB_MAGIC || slab->cache != cache)
+    KERNEL_PANIC("kmem_cache_free: Object not from this cache");
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&cache->slock);
+
+  if(slab->inuse == cache->per_slab)
+    {
+      kmem_slab_unlink(&cache->full, slab);
+      kmem_slab_link(&cache->partial, slab);
+    }
+
+  *(void**)obj = slab->free;
+  slab->free = obj;
+  slab->inuse--;
+  cache->frees++;
+
+  /* Keep one empty slab around, give the frames of the others back */
+  if(slab->inuse == 0)
+    {
+      kmem_slab_unlink(&cache->partial, slab);
+      if(cache->empty == NULL)
+        {
+          cache->empty = slab;
+        }
+      else
+        {
+          release = slab;
+          cache->slabs--;
+        }
+    }
+
+  spinlock_release(&cache->slock);
+  _interrupt_set_state(intr_status);
+
+  if(release != NULL)
+    {
+      release->magic = 0;
+      physmem_freeblock((void*)release);
+    }
+}
+
+/**
+ * Prints the counters of every cache if the "debugmem" boot argument
+ * was given.
+ */
+void kmem_print_stats(void)
+{
+  kmem_cache_t *cache;
+
+  for(cache = kmem_caches; cache != NULL; cache = cache->next)
+    DEBUG("debugmem", "Kernel heap: cache %s (%u bytes): %u allocs, "
+          "%u frees, %u slabs\n", cache->name, cache->size,
+          cache->allocs, cache->frees, cache->slabs);
+}
+
+/**
+ * Initializes the kernel heap. Called once paging is set up.
+ */
+void kmem_init(void)
+{
+  static const char *names[KMEM_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024"
+  };
+  int i;
+
+  spinlock_reset(&kmem_large_slock);
+  spinlock_reset(&kmem_caches_slock);
+  kmem_caches = NULL;
+  for(i = 0; i < KMEM_LARGE_BUCKETS; i++)
+    kmem_large[i] = NULL;
+
+  kmem_cache_setup(&kmem_cache_cache, "kmem_cache", sizeof(kmem_cache_t));
+
+  for(i = 0; i < KMEM_CLASSES; i++)
+    kmem_classes[i] = kmem_cache_create(names[i],
+                                        KMEM_MIN_CLASS << i);
+
+  kmem_large_cache = kmem_cache_create("kmalloc-large",
+                                       sizeof(kmem_large_t));
+}
+
+/**
+ * Allocates size bytes of kernel memory. Memory of more than
+ * KMEM_MAX_CLASS bytes is made of whole, physically contiguous frames
+ * and is page aligned.
+ *
+ * @return The memory, which is also its physical address.
+ */
+void* kmalloc(uint64_t size)
+{
+  kmem_large_t *large;
+  uint32_t frames, bucket;
+  int i;
+  interrupt_status_t intr_status;
+
+  if(size <= KMEM_MAX_CLASS)
+    {
+      for(i = 0; (KMEM_MIN_CLASS << i) < (int)size; i++)
+        ;
+      return kmem_cache_alloc(kmem_classes[i]);
+    }
+
+  frames = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+  large = kmem_cache_alloc(kmem_large_cache);
+  large->addr = kmem_getframes(frames);
+  large->frames = frames;
+  bucket = ((uint64_t)large->addr / PAGE_SIZE) % KMEM_LARGE_BUCKETS;
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&kmem_large_slock);
+  large->next = kmem_large[bucket];
+  kmem_large[bucket] = large;
+  spinlock_release(&kmem_large_slock);
+  _interrupt_set_state(intr_status);
+
+  return large->addr;
+}
+
+/**
+ * Frees memory allocated by kmalloc(). Does nothing for NULL.
+ */
+void kfree(void *ptr)
+{
+  kmem_large_t **prev, *large = NULL;
+  kmem_slab_t *slab;
+  uint32_t bucket;
+  interrupt_status_t intr_status;
+
+  if(ptr == NULL)
+    return;
+
+  if(((uint64_t)ptr & ~PAGE_SIZE_MASK) != 0)
+    {
+      slab = (kmem_slab_t*)((uint64_t)ptr & PAGE_SIZE_MASK);
+      if(slab->magic != KMEM_SLAB_MAGIC)
+        KERNEL_PANIC("kfree: Bad pointer");
+      kmem_cache_free(slab->cache, ptr);
+      return;
+    }
+
+  bucket = ((uint64_t)ptr / PAGE_SIZE) % KMEM_LARGE_BUCKETS;
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(&kmem_large_slock);
+  for(prev = &kmem_large[bucket]; *prev != NULL; prev = &(*prev)->next)
+    {
+      if((*prev)->addr == ptr)
+        {
+          large = *prev;
+          *prev = large->next;
+          break;
+        }
+    }
+  spinlock_release(&kmem_large_slock);
+  _interrupt_set_state(intr_status);
+
+  if(large == NULL)
+    KERNEL_PANIC("kfree: Bad pointer");
+
+  if(large->frames == 1)
+    physmem_freeblock(ptr);
+  else
+    physmem_freeblocks(ptr, large->frames);
+
+  kmem_cache_free(kmem_large_cache, large);
+}
@@ -14,8 +14,9 @@
 
 #define PMM_BLOCK_SIZE 0x1000
 
-/* Page table pool size */
-#define VM_PTP_SIZE 1024 //4mb
+/* Page tables for the kernel's own mappings, made before physical
+   memory is mapped; enough to map about 60 GB with 2 MB pages */
+#define VM_BOOT_TABLES 64
 
 /* Multiboot Memory Map Structure */
 enum memmap_types_t
@@ -34,7 +35,17 @@ typedef struct memory_region
   uint32_t type;
 } __attribute__((packed)) mem_region_t;
 
+/* Process context identifier (PCID) of an address space, see
+   vmm_cr3() */
+typedef struct {
+  uint64_t generation;  /* 0 until a PCID is assigned */
+  uint16_t pcid;
+  int16_t cpu;          /* CPU the address space last ran on */
+} vmm_pcid_t;
+
 void vmm_setcr3(uint64_t pdbr);
 pagetable_t* vmm_get_kernel_pml4();
+uint64_t vmm_cr3(pagetable_t *pml4, vmm_pcid_t *space);
+void vmm_init_cpu(void);
 
 #endif // KUDOS_VM_X86_64_MEM_H
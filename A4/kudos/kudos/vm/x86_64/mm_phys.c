@@ -10,148 +10,346 @@
 #include "kernel/spinlock.h"
 #include "kernel/interrupt.h"
 #include "kernel/panic.h"
+#include "kernel/config.h"
+#include "lib/debug.h"
+
+/* Free frames are kept by a binary buddy allocator. A free block of
+ * order n is 2^n frames long and starts at a frame that is a multiple
+ * of 2^n. Each order has a doubly linked list of free blocks; the
+ * links live in an array indexed by frame (free frames are not
+ * necessarily mapped, so they cannot hold the links themselves).
+ *
+ * Allocating splits the smallest large enough block, freeing merges
+ * the block with its buddy for as long as the buddy is free. Both take
+ * at most PMM_MAX_ORDER steps.
+ *
+ * Single frames go through a small cache (magazine) per CPU first,
+ * which is refilled from and drained to the buddy allocator in
+ * batches. A cache hit writes only the cache line of its own CPU; the
+ * lock of the cache is only ever contended when the buddy allocator
+ * runs out and every cache is drained back into it. */
 
 /* PMM Defines */
-#define PMM_BLOCKS_PER_BYTE 0x8
+#define PMM_MAX_ORDER 10
+
+/* End of a free list */
+#define PMM_NO_FRAME 0xFFFFFFFF
+
+/* Order of a frame that does not start a free block */
+#define PMM_ORDER_USED 0xFF
+
+typedef struct {
+  uint32_t next;
+  uint32_t prev;
+} pmm_link_t;
 
 /* Memory Map */
-uint64_t *_mem_bitmap;
-uint64_t bitmap_size;
 uint64_t memory_size;
 uint64_t total_blocks;
 uint64_t used_blocks;
-uint64_t highest_page;
 spinlock_t *physmem_lock;
 
-/* Memory Bitmap Helpers */
-void memmap_setbit(int64_t bit)
+/* Number of frames covered by the buddy allocator */
+static uint64_t pmm_frames;
+
+/* List links of each frame that starts a free block */
+static pmm_link_t *pmm_links;
+
+/* Order of the free block starting at each frame, PMM_ORDER_USED if
+ * no free block starts there */
+static uint8_t *pmm_order;
+
+/* First free block of each order */
+static uint32_t pmm_free_list[PMM_MAX_ORDER + 1];
+
+/* Number of users of each allocated frame besides the first one,
+ * e.g. page tables sharing it copy-on-write */
+static uint16_t *pmm_share;
+
+/* Frames moved between a per-CPU cache and the buddy allocator at once */
+#define PMM_CACHE_BATCH (CONFIG_PHYSMEM_CACHE_SIZE / 2)
+
+/* Per-CPU frame cache, used by its own CPU with interrupts disabled
+ * and drained by any CPU that runs out of frames. Aligned so that no
+ * two CPUs share a cache line. */
+typedef struct {
+  spinlock_t slock;
+  uint32_t count;
+  uint32_t frames[CONFIG_PHYSMEM_CACHE_SIZE];
+  physmem_stats_t stats;
+} __attribute__((aligned(64))) pmm_cache_t;
+
+static pmm_cache_t pmm_cache[CONFIG_MAX_CPUS];
+
+/* Buddy Helpers */
+static void pmm_list_push(uint32_t frame, int order)
 {
-  _mem_bitmap[bit / 64] |= (1 << (bit % 64));
+  uint32_t head = pmm_free_list[order];
+
+  pmm_links[frame].prev = PMM_NO_FRAME;
+  pmm_links[frame].next = head;
+  if(head != PMM_NO_FRAME)
+    pmm_links[head].prev = frame;
+  pmm_free_list[order] = frame;
+  pmm_order[frame] = (uint8_t)order;
 }
 
-void memmap_unsetbit(int64_t bit)
+static void pmm_list_remove(uint32_t frame)
 {
-  _mem_bitmap[bit / 64] &= ~(1 << (bit % 64));
+  pmm_link_t *link = &pmm_links[frame];
+
+  if(link->prev != PMM_NO_FRAME)
+    pmm_links[link->prev].next = link->next;
+  else
+    pmm_free_list[pmm_order[frame]] = link->next;
+
+  if(link->next != PMM_NO_FRAME)
+    pmm_links[link->next].prev = link->prev;
+
+  pmm_order[frame] = PMM_ORDER_USED;
 }
 
-int64_t memmap_testbit(int64_t bit)
+/* Returns the smallest order whose blocks hold count frames */
+static int pmm_order_of(uint64_t count)
 {
-  return _mem_bitmap[bit / 64] & (1 << (bit % 64));
+  int order = 0;
+
+  while((1UL << order) < count)
+    order++;
+
+  return order;
 }
 
-void physmem_freeregion(uint64_t start_address, uint64_t length)
+/* Puts the block of 2^order frames at frame back, merging it with its
+ * free buddies */
+static void pmm_free_block(uint32_t frame, int order)
 {
-  int64_t Align = (int64_t)(start_address / PMM_BLOCK_SIZE);
-  int64_t Blocks = (int64_t)(length / PMM_BLOCK_SIZE);
-  int64_t i = (int64_t)start_address;
+  uint32_t buddy;
+
+  if(pmm_order[frame] != PMM_ORDER_USED)
+    KERNEL_PANIC("Physical Manager >> Freeing a free frame");
 
-  /* Free Blocks */
-  for(; Blocks > 0; Blocks--, i += PMM_BLOCK_SIZE)
+  used_blocks -= 1UL << order;
+
+  while(order < PMM_MAX_ORDER)
     {
-      /* Free it */
-      memmap_unsetbit(Align++);
-      used_blocks--;
+      buddy = frame ^ (1U << order);
+      if(buddy >= pmm_frames || pmm_order[buddy] != order)
+        break;
 
-      if(i > highest_page)
-        highest_page = i;
+      pmm_list_remove(buddy);
+      frame &= ~(1U << order);
+      order++;
     }
 
-  /* Make sure first block is always used! */
-  /* Allocs must never be 0 */
-  memmap_setbit(0);
+  pmm_list_push(frame, order);
 }
 
-int64_t physmem_getframe()
+/* Frees count frames starting at frame, as the largest aligned blocks
+ * the range can be cut into */
+static void pmm_free_range(uint64_t frame, uint64_t count)
 {
-  uint64_t i, j;
+  int order;
 
-  /* Loop through bitmap */
-  for(i = 0; i < total_blocks; i++)
+  while(count > 0)
     {
-      if(_mem_bitmap[i] != 0xFFFFFFFFFFFFFFFF)
+      order = PMM_MAX_ORDER;
+      while((frame & ((1UL << order) - 1)) != 0 || (1UL << order) > count)
+        order--;
+
+      pmm_free_block((uint32_t)frame, order);
+      frame += 1UL << order;
+      count -= 1UL << order;
+    }
+}
+
+/* Frees count single frames */
+static void pmm_free_frames(uint32_t *frames, int count)
+{
+  int i;
+
+  for(i = 0; i < count; i++)
+    pmm_free_block(frames[i], 0);
+}
+
+/* Takes a block of 2^order frames off the free lists, splitting a
+ * larger one if needed. Returns PMM_NO_FRAME if there is none. */
+static uint32_t pmm_alloc_block(int order)
+{
+  uint32_t frame;
+  int found = order;
+
+  while(found <= PMM_MAX_ORDER && pmm_free_list[found] == PMM_NO_FRAME)
+    found++;
+
+  if(found > PMM_MAX_ORDER)
+    return PMM_NO_FRAME;
+
+  frame = pmm_free_list[found];
+  pmm_list_remove(frame);
+
+  /* Give back the upper halves until the block has the right size */
+  while(found > order)
+    {
+      found--;
+      pmm_list_push(frame + (1U << found), found);
+    }
+
+  used_blocks += 1UL << order;
+  return frame;
+}
+
+/* Takes count frames larger than the largest block off the free lists,
+ * as a run of adjacent free blocks of the largest order. These
+ * requests are rare, so the list of such blocks is simply searched.
+ * Returns PMM_NO_FRAME if there is no such run. */
+static uint32_t pmm_alloc_run(uint64_t count)
+{
+  uint64_t blocks = (count + (1UL << PMM_MAX_ORDER) - 1) >> PMM_MAX_ORDER;
+  uint64_t i;
+  uint32_t start;
+
+  for(start = pmm_free_list[PMM_MAX_ORDER]; start != PMM_NO_FRAME;
+      start = pmm_links[start].next)
+    {
+      for(i = 1; i < blocks; i++)
         {
-          for(j = 0; j < 64; j++)
-            {
-              int64_t bit = 1 << j;
+          uint64_t frame = start + (i << PMM_MAX_ORDER);
+          if(frame >= pmm_frames || pmm_order[frame] != PMM_MAX_ORDER)
+            break;
+        }
 
-              if(!(_mem_bitmap[i] & bit))
-                return (int64_t)(i * 8 * 8 + j);
-            }
+      if(i == blocks)
+        {
+          for(i = 0; i < blocks; i++)
+            pmm_list_remove(start + (uint32_t)(i << PMM_MAX_ORDER));
+          used_blocks += blocks << PMM_MAX_ORDER;
+          return start;
         }
     }
 
-  /* End of Memory */
-  return -1;
+  return PMM_NO_FRAME;
 }
 
-int64_t physmem_getframes(int64_t count)
+/* Allocates count contiguous frames, returning the unused tail of the
+ * block they came from. Returns PMM_NO_FRAME if there are none. */
+static uint32_t pmm_alloc_frames(uint64_t count)
 {
-  uint64_t i, j, k;
+  uint64_t size;
+  uint32_t frame;
+  int order = pmm_order_of(count);
 
-  /* Sanity */
-  if(count == 0)
-    return -1;
+  if(order > PMM_MAX_ORDER)
+    {
+      frame = pmm_alloc_run(count);
+      size = ((count + (1UL << PMM_MAX_ORDER) - 1) >> PMM_MAX_ORDER)
+        << PMM_MAX_ORDER;
+    }
+  else
+    {
+      frame = pmm_alloc_block(order);
+      size = 1UL << order;
+    }
+
+  if(frame != PMM_NO_FRAME && size > count)
+    pmm_free_range(frame + count, size - count);
+
+  return frame;
+}
+
+/* Refills half of a cache from the buddy allocator. The caller holds
+ * the cache lock. */
+static void pmm_cache_refill(pmm_cache_t *cache)
+{
+  uint32_t frame;
+
+  spinlock_acquire(physmem_lock);
+  while(cache->count < PMM_CACHE_BATCH)
+    {
+      frame = pmm_alloc_block(0);
+      if(frame == PMM_NO_FRAME)
+        break;
+      cache->frames[cache->count++] = frame;
+    }
+  spinlock_release(physmem_lock);
+}
 
-  if(count == 1)
-    return physmem_getframe();
+/* Gives the frames of every CPU's cache back to the buddy allocator
+ * once it has run out. The caller has interrupts disabled and holds
+ * neither a cache lock nor physmem_lock. */
+static void pmm_cache_drain_all(void)
+{
+  pmm_cache_t *cache;
+  int cpu;
 
-  /* Loop through bitmap */
-  for(i = 0; i < total_blocks; i++)
+  for(cpu = 0; cpu < CONFIG_MAX_CPUS; cpu++)
     {
-      if(_mem_bitmap[i] != 0xFFFFFFFFFFFFFFFF)
+      cache = &pmm_cache[cpu];
+      spinlock_acquire(&cache->slock);
+      if(cache->count > 0)
         {
-          for(j = 0; j < 64; j++)
-            {
-              int64_t bit = 1 << j;
-              if(!(_mem_bitmap[i] & bit))
-                {
-                  int64_t starting_bit = i * 64;
-                  int64_t free = 0;
-                  starting_bit += j;
-
-                  /* Get the free bit in qword at index i */
-                  for(k = 0; k < count; k++)
-                    {
-                      /* Test if it is free */
-                      if(memmap_testbit(starting_bit + k) == 0)
-                        free++;
-
-                      /* Did we have enough free blocks? */
-                      if(free == count)
-                        return starting_bit;
-                    }
-                }
-            }
+          cache->stats.drains++;
+          spinlock_acquire(physmem_lock);
+          pmm_free_frames(cache->frames, cache->count);
+          spinlock_release(physmem_lock);
+          cache->count = 0;
         }
+      spinlock_release(&cache->slock);
     }
-
-  /* End of Memory */
-  return -1;
 }
 
 void physmem_init(void *boot_info)
 {
   multiboot_info_t *mb_info = (multiboot_info_t*)boot_info;
   uint64_t *mem_ptr = (uint64_t*)(uint64_t)mb_info->memory_map_addr;
-  uint64_t Itr = 0, last_address = 0;
+  uint64_t Itr = 0, last_address = 0, start, end;
+  int i;
 
   /* Setup Memory Stuff */
-  highest_page = 0;
   memory_size = mb_info->memory_high;
   memory_size += mb_info->memory_low;
-  total_blocks = (memory_size * 1024) / PAGE_SIZE;
-  used_blocks = total_blocks;
-  bitmap_size = total_blocks / PMM_BLOCKS_PER_BYTE;
-  _mem_bitmap = (uint64_t*)stalloc(bitmap_size);
   physmem_lock = (spinlock_t*)stalloc(sizeof(spinlock_t));
   spinlock_reset(physmem_lock);
+  spinlock_register(physmem_lock, "physmem_lock");
 
-  /* Set all memory as used, and use memory map to set free */
-  memoryset(_mem_bitmap, 0xF, bitmap_size);
-
-  /* Physical Page Bitmap */
   kprintf("Memory size: %u Kb\n", (uint32_t)memory_size);
 
+  /* The allocator covers every frame up to the end of the highest
+     free region */
+  pmm_frames = 0;
+  for(Itr = (uint64_t)mem_ptr;
+      Itr < ((uint64_t)mem_ptr + mb_info->memory_map_length);
+      Itr += sizeof(mem_region_t))
+    {
+      mem_region_t *mem_region = (mem_region_t*)Itr;
+
+      end = (mem_region->base_address + mem_region->length) / PMM_BLOCK_SIZE;
+      if(mem_region->type == MEMTYPE_FREE && end > pmm_frames)
+        pmm_frames = end;
+    }
+
+  if(pmm_frames > PMM_NO_FRAME)
+    pmm_frames = PMM_NO_FRAME;
+
+  pmm_links = (pmm_link_t*)stalloc(pmm_frames * sizeof(pmm_link_t));
+  pmm_order = (uint8_t*)stalloc(pmm_frames);
+  memoryset(pmm_order, (char)PMM_ORDER_USED, pmm_frames);
+  pmm_share = (uint16_t*)stalloc(pmm_frames * sizeof(uint16_t));
+  memoryset(pmm_share, 0, pmm_frames * sizeof(uint16_t));
+  for(i = 0; i <= PMM_MAX_ORDER; i++)
+    pmm_free_list[i] = PMM_NO_FRAME;
+  for(i = 0; i < CONFIG_MAX_CPUS; i++)
+    spinlock_reset(&pmm_cache[i].slock);
+
+  /* Everything up to the static allocation point, which includes
+     frame 0 and the allocator itself, stays in use */
+  last_address = (physaddr_t)stalloc(1);
+  stalloc_disable();
+
+  /* Set all memory as used, and use memory map to set free */
+  total_blocks = pmm_frames;
+  used_blocks = total_blocks;
+
   /* Go through regions */
   for(Itr = (uint64_t)mem_ptr;
       Itr < ((uint64_t)mem_ptr + mb_info->memory_map_length);
@@ -164,142 +362,258 @@ void physmem_init(void *boot_info)
       //kprintf("Memory Region: Address 0x%xL, length 0x%xL, Type %u\n",
       //        mem_region->base_address, mem_region->length, mem_region->Type);
 
-      /* Is it free? */
+      /* Is it free? Only whole frames above the kernel are used */
       if(mem_region->type == MEMTYPE_FREE)
-        physmem_freeregion(mem_region->base_address,
-                           mem_region->length);
+        {
+          start = mem_region->base_address;
+          if(start < last_address)
+            start = last_address;
+          start = (start + PMM_BLOCK_SIZE - 1) / PMM_BLOCK_SIZE;
+
+          end = (mem_region->base_address + mem_region->length)
+            / PMM_BLOCK_SIZE;
+          if(end > pmm_frames)
+            end = pmm_frames;
+
+          if(start < end)
+            pmm_free_range(start, end - start);
+        }
 
       /* Advance by one structure */
       Itr += sizeof(mem_region_t);
     }
 
-  /* Mark all memory up to the static allocation point as used */
-  last_address = (physaddr_t)stalloc(1);
-  stalloc_disable();
-
-  for(Itr = physmem_allocblock(); Itr < last_address;)
-    Itr = physmem_allocblock();
-
   /* Debug*/
-  kprintf("New memory allocation starts at 0x%xl\n", Itr);
+  kprintf("New memory allocation starts at 0x%xl\n", last_address);
 }
 
 physaddr_t physmem_allocblock()
 {
-  /* Get spinlock */
-  physaddr_t addr = 0;
+  pmm_cache_t *cache;
+  uint32_t frame;
   interrupt_status_t intr_status = _interrupt_disable();
-  spinlock_acquire(physmem_lock);
 
-  /* Sanity */
-  if(used_blocks >= total_blocks)
+  cache = &pmm_cache[_interrupt_getcpu()];
+  spinlock_acquire(&cache->slock);
+
+  if(cache->count > 0)
     {
-      /* PANIC AT THE DISCO ! */
-      KERNEL_PANIC("Physical Manager >> OUT OF MEMORY");
+      cache->stats.hits++;
     }
+  else
+    {
+      cache->stats.misses++;
+      pmm_cache_refill(cache);
 
-  /* Get a frame */
-  int64_t frame = physmem_getframe();
+      if(cache->count == 0)
+        {
+          /* The other CPUs may still cache frames */
+          spinlock_release(&cache->slock);
+          pmm_cache_drain_all();
+          spinlock_acquire(&cache->slock);
+          pmm_cache_refill(cache);
+        }
 
-  if(frame == -1)
-    {
-      /* PANIC AT THE DISCO ! */
-      spinlock_release(physmem_lock);
-      KERNEL_PANIC("Physical Manager >> OUT OF MEMORY");
+      if(cache->count == 0)
+        {
+          /* PANIC AT THE DISCO ! */
+          KERNEL_PANIC("Physical Manager >> OUT OF MEMORY");
+        }
     }
 
-  /* Mark it used */
-  memmap_setbit(frame);
-
-  /* Release spinlock */
-  spinlock_release(physmem_lock);
+  frame = cache->frames[--cache->count];
+  spinlock_release(&cache->slock);
   _interrupt_set_state(intr_status);
 
-  /* Calculate Address */
-  addr = (physaddr_t)(frame * PMM_BLOCK_SIZE);
-  used_blocks++;
-
-  return addr;
+  return (physaddr_t)frame * PMM_BLOCK_SIZE;
 }
 
 void physmem_freeblock(void *ptr)
 {
-  /* Calculate frame */
-  uint64_t addr = (uint64_t)ptr;
-  int64_t frame = (int64_t)(addr / PMM_BLOCK_SIZE);
+  pmm_cache_t *cache;
+  uint64_t frame = (uint64_t)ptr / PMM_BLOCK_SIZE;
+  interrupt_status_t intr_status;
 
-  /* Get lock */
-  interrupt_status_t intr_status = _interrupt_disable();
-  spinlock_acquire(physmem_lock);
+  if(frame >= pmm_frames)
+    KERNEL_PANIC("Physical Manager >> Freeing frames out of range");
 
-  /* Free */
-  memmap_unsetbit(frame);
+  intr_status = _interrupt_disable();
+  cache = &pmm_cache[_interrupt_getcpu()];
+  spinlock_acquire(&cache->slock);
 
-  /* Release spinlock */
-  spinlock_release(physmem_lock);
-  _interrupt_set_state(intr_status);
+  if(cache->count == CONFIG_PHYSMEM_CACHE_SIZE)
+    {
+      /* Give the older half of the cache back to the buddy allocator */
+      cache->stats.drains++;
+      spinlock_acquire(physmem_lock);
+      pmm_free_frames(cache->frames, PMM_CACHE_BATCH);
+      spinlock_release(physmem_lock);
 
-  /* Stats */
-  used_blocks--;
+      cache->count -= PMM_CACHE_BATCH;
+      memcopy(cache->count * sizeof(uint32_t), cache->frames,
+              &cache->frames[PMM_CACHE_BATCH]);
+    }
+
+  cache->frames[cache->count++] = (uint32_t)frame;
+  spinlock_release(&cache->slock);
+  _interrupt_set_state(intr_status);
 }
 
 physaddr_t physmem_allocblocks(uint32_t count)
 {
   /* Get spinlock */
-  physaddr_t addr = 0, i;
+  uint32_t frame;
   interrupt_status_t intr_status = _interrupt_disable();
   spinlock_acquire(physmem_lock);
 
   /* Sanity */
-  if(used_blocks >= total_blocks)
+  if(count == 0)
     {
-      /* PANIC AT THE DISCO ! */
-      KERNEL_PANIC("Physical Manager >> OUT OF MEMORY");
+      spinlock_release(physmem_lock);
+      _interrupt_set_state(intr_status);
+      return 0;
     }
 
-  /* Get a frame */
-  int64_t frame = physmem_getframes(count);
+  /* Get the frames */
+  frame = pmm_alloc_frames(count);
+
+  if(frame == PMM_NO_FRAME)
+    {
+      /* Frames cached by the CPUs may complete a free block */
+      spinlock_release(physmem_lock);
+      pmm_cache_drain_all();
+      spinlock_acquire(physmem_lock);
+      frame = pmm_alloc_frames(count);
+    }
 
-  if(frame == -1)
+  if(frame == PMM_NO_FRAME)
     {
       /* PANIC AT THE DISCO ! */
       spinlock_release(physmem_lock);
       KERNEL_PANIC("Physical Manager >> OUT OF MEMORY");
     }
 
-  /* Mark it used */
-  for(i = 0; i < count; i++)
-    memmap_setbit(frame + i);
-
   /* Release spinlock */
   spinlock_release(physmem_lock);
   _interrupt_set_state(intr_status);
 
   /* Calculate Address */
-  addr = (uint64_t)(frame * PMM_BLOCK_SIZE);
-  used_blocks += count;
-
-  return addr;
+  return (physaddr_t)frame * PMM_BLOCK_SIZE;
 }
 
 void physmem_freeblocks(void *ptr, uint32_t size)
 {
   /* Calculate frame */
-  uint64_t addr = (uint64_t)ptr, i;
-  int64_t frame = (int64_t)(addr / PMM_BLOCK_SIZE);
+  uint64_t addr = (uint64_t)ptr;
+  uint64_t frame = addr / PMM_BLOCK_SIZE;
+
+  if(frame + size > pmm_frames)
+    KERNEL_PANIC("Physical Manager >> Freeing frames out of range");
 
   /* Get lock */
   interrupt_status_t intr_status = _interrupt_disable();
   spinlock_acquire(physmem_lock);
 
   /* Free */
-  for(i = 0; i < size; i++)
-    memmap_unsetbit(frame + i);
+  pmm_free_range(frame, size);
 
   /* Release spinlock */
   spinlock_release(physmem_lock);
   _interrupt_set_state(intr_status);
+}
+
+/**
+ * Adds a user to an allocated frame. A frame has a single user when
+ * it is allocated; every further user must be added here and dropped
+ * again with physmem_release().
+ */
+void physmem_share(physaddr_t addr)
+{
+  uint64_t frame = addr / PMM_BLOCK_SIZE;
+  interrupt_status_t intr_status;
+
+  if(frame >= pmm_frames)
+    KERNEL_PANIC("Physical Manager >> Sharing frame out of range");
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(physmem_lock);
+
+  if(pmm_share[frame] == 0xFFFF)
+    KERNEL_PANIC("Physical Manager >> Too many users of a frame");
+  pmm_share[frame]++;
+
+  spinlock_release(physmem_lock);
+  _interrupt_set_state(intr_status);
+}
+
+/**
+ * Returns the number of users of an allocated frame besides the
+ * caller, 0 if the caller is its only user.
+ */
+int physmem_shared(physaddr_t addr)
+{
+  uint64_t frame = addr / PMM_BLOCK_SIZE;
+
+  if(frame >= pmm_frames)
+    return 0;
+
+  return pmm_share[frame];
+}
+
+/**
+ * Drops a user of an allocated frame and frees the frame if that was
+ * its last user.
+ */
+void physmem_release(physaddr_t addr)
+{
+  uint64_t frame = addr / PMM_BLOCK_SIZE;
+  interrupt_status_t intr_status;
+  int last;
+
+  if(frame >= pmm_frames)
+    KERNEL_PANIC("Physical Manager >> Releasing frame out of range");
+
+  intr_status = _interrupt_disable();
+  spinlock_acquire(physmem_lock);
+
+  last = (pmm_share[frame] == 0);
+  if(!last)
+    pmm_share[frame]--;
+
+  spinlock_release(physmem_lock);
+  _interrupt_set_state(intr_status);
+
+  if(last)
+    physmem_freeblock((void*)(addr & ~(physaddr_t)(PMM_BLOCK_SIZE - 1)));
+}
+
+/**
+ * Returns the frame cache counters of the given CPU.
+ */
+void physmem_get_stats(int cpu, physmem_stats_t *stats)
+{
+  if(cpu < 0 || cpu >= CONFIG_MAX_CPUS)
+    KERNEL_PANIC("physmem_get_stats: Bad CPU");
+
+  *stats = pmm_cache[cpu].stats;
+}
+
+/**
+ * Prints the frame cache counters of every CPU, and those of the
+ * kernel heap, if the "debugmem" boot argument was given.
+ */
+void physmem_print_stats(void)
+{
+  physmem_stats_t stats;
+  int cpu;
+
+  for(cpu = 0; cpu < CONFIG_MAX_CPUS; cpu++)
+    {
+      physmem_get_stats(cpu, &stats);
+      DEBUG("debugmem", "Physical Manager: CPU %d: %u cache hits, "
+            "%u misses, %u drains, %u frames cached\n", cpu, stats.hits,
+            stats.misses, stats.drains, pmm_cache[cpu].count);
+    }
 
-  /* Stats */
-  used_blocks -= size;
+  kmem_print_stats();
 }
@@ -7,6 +7,7 @@
 #include "kernel/panic.h"
 #include "kernel/spinlock.h"
 #include "kernel/interrupt.h"
+#include "kernel/config.h"
 
 //9 bit per, 12 for page
 
@@ -25,6 +26,30 @@
 //Page mask
 #define VMM_PAGE_MASK 0xFFFFFFFFFFFFF000
 
+//Virtual address of a page from its indices, sign extended
+#define VMM_VADDR(pml4, pdp, pdir, pt)                                 \
+  ((((pml4) & 0x100) ? 0xFFFF000000000000 : 0) | ((pml4) << 39)         \
+   | ((pdp) << 30) | ((pdir) << 21) | ((pt) << 12))
+
+//Offset within a 2 MB page
+#define VMM_LARGE_PAGE_MASK 0x1FFFFF
+
+//Ranges longer than this flush the whole TLB instead of page by page
+#define VMM_FLUSH_PAGES 32
+
+//CR0 Write Protect, makes read only pages read only in ring 0 too
+#define VMM_CR0_WP 0x10000
+
+//CR4 Page Global Enable and PCID Enable
+#define VMM_CR4_PGE 0x80
+#define VMM_CR4_PCIDE 0x20000
+
+//CR3 bit that keeps the TLB entries of the new PCID
+#define VMM_CR3_NOFLUSH 0x8000000000000000
+
+//Number of PCIDs, PCID 0 is the kernel's
+#define VMM_PCIDS 4096
+
 //Heap
 #define MM_HEAP_LOCATION 0x10000000
 #define MM_HEAP_END 0x20000000
@@ -32,35 +57,30 @@
 /* Extern variables */
 extern uint64_t KERNEL_ENDS_HERE;   //physical address of kernel end
 extern physaddr_t stalloced_total;  //Total bytes stalloced
+extern uint64_t total_blocks;       //Frames of the physical memory manager
 
-/* The virtual address for the next stalloc allocation */
-virtaddr_t kmalloc_addr;
-
-/* Page table space of 4mb*/
-pagetable_t pt_pool[VM_PTP_SIZE] __attribute__ ((aligned (4096)));
-/* Bitmap of free page tables */
-uint64_t pt_bitmap[VM_PTP_SIZE/64];
-/* Extern functions to manipulate the pt bitmap */
+/* Page tables of the kernel's own mappings, used until all physical
+ * memory is mapped. Later page tables are frames of the physical
+ * memory manager. */
+static pagetable_t vmm_boot_tables[VM_BOOT_TABLES]
+  __attribute__ ((aligned (4096)));
+static uint64_t vmm_boot_used;
 
 /* Globals */
 static pagetable_t *kernel_pml4;
 static spinlock_t vm_lock;
-
-/* Page table Bitmap Helpers */
-void ptmap_setbit(int64_t bit)
-{
-  pt_bitmap[bit / 64] |= (1 << (bit % 64));
-}
-
-void ptmap_unsetbit(int64_t bit)
-{
-  pt_bitmap[bit / 64] &= ~(1 << (bit % 64));
-}
-
-int64_t ptmap_testbit(int64_t bit)
-{
-  return pt_bitmap[bit / 64] & (1 << (bit % 64));
-}
+static int vmm_direct_mapped;
+
+/* PCIDs are handed out in generations: the next free one of the
+ * current generation, and a new generation once they run out. A CPU
+ * flushes its whole TLB when it first loads a PCID of a newer
+ * generation, so a PCID never finds TLB entries of an address space
+ * it was given to before. */
+static int vmm_pcid_enabled;
+static spinlock_t vmm_pcid_lock;
+static uint64_t vmm_pcid_generation;
+static uint64_t vmm_pcid_next;
+static uint64_t vmm_cpu_generation[CONFIG_MAX_CPUS];
 
 /* Helpers */
 void vmm_cleartable(pagetable_t *p_table)
@@ -84,22 +104,31 @@ pagetable_t* vmm_get_kernel_pml4(){
   return kernel_pml4;
 }
 
+/* Returns a cleared page table. Once vm_init() has mapped every frame
+ * at its physical address, page tables are plain frames. */
 pagetable_t* vmm_new_pagetable(){
   pagetable_t* pt;
-  uint64_t i;
-    for(i = 0; i < VM_PTP_SIZE; i++){
-      if(!ptmap_testbit(i)){
-        ptmap_setbit(i);
-        pt = &pt_pool[i];
-        break;
-      }
-    }
-  if(i == VM_PTP_SIZE)
-    KERNEL_PANIC("No more pagetables");
 
+  if(vmm_direct_mapped)
+    pt = (pagetable_t*)physmem_allocblock();
+  else if(vmm_boot_used < VM_BOOT_TABLES)
+    pt = &vmm_boot_tables[vmm_boot_used++];
+  else
+    KERNEL_PANIC("No more boot pagetables");
+
+  vmm_cleartable(pt);
   return pt;
 }
 
+void vmm_free_pagetable(pagetable_t *pt)
+{
+  /* Boot page tables hold kernel mappings, which are never freed */
+  if(pt >= vmm_boot_tables && pt < vmm_boot_tables + VM_BOOT_TABLES)
+    return;
+
+  physmem_freeblock((void*)pt);
+}
+
 void vmm_install_ptable(pagetable_t *target, uint64_t pt_index,
                         uint64_t phys, uint64_t flags)
 {
@@ -129,6 +158,109 @@ void vmm_invalidatepage(uint64_t virtual_addr)
   asm volatile("invlpg (%%rax)" : : "a"(virtual_addr));
 }
 
+void vmm_enable_wp()
+{
+  /* Userland runs in ring 0, so copy-on-write pages only fault on
+   * writes with CR0.WP set */
+  asm volatile("mov %%cr0, %%rax\n\t"
+               "or %0, %%rax\n\t"
+               "mov %%rax, %%cr0" : : "i"(VMM_CR0_WP) : "rax");
+}
+
+/* Checks whether the CPU has PCIDs (CPUID.1:ECX bit 17) */
+static int vmm_pcid_present(void)
+{
+  uint32_t eax = 1, ebx, ecx = 0, edx;
+
+  asm volatile("cpuid"
+               : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+
+  return (ecx >> 17) & 1;
+}
+
+/* Flushes every TLB entry of this CPU, of all PCIDs and global ones
+ * too, by toggling CR4.PGE */
+static void vmm_flush_all(void)
+{
+  asm volatile("mov %%cr4, %%rax\n\t"
+               "xor %0, %%rax\n\t"
+               "mov %%rax, %%cr4\n\t"
+               "xor %0, %%rax\n\t"
+               "mov %%rax, %%cr4" : : "i"(VMM_CR4_PGE) : "rax", "memory");
+}
+
+/* Per-CPU paging setup. CR4.PCIDE may only be set while CR3 holds
+ * PCID 0, which the kernel page table does. */
+void vmm_init_cpu(void)
+{
+  vmm_enable_wp();
+
+  if(vmm_pcid_enabled)
+    asm volatile("mov %%cr4, %%rax\n\t"
+                 "or %0, %%rax\n\t"
+                 "mov %%rax, %%cr4" : : "i"(VMM_CR4_PCIDE) : "rax");
+
+  vmm_cpu_generation[_interrupt_getcpu()] = vmm_pcid_generation;
+}
+
+/**
+ * Returns the CR3 value that switches this CPU to the given page
+ * table, and assigns the address space a PCID if it has none of the
+ * current generation. The TLB entries of the address space are kept
+ * if it last ran on this CPU, since its mappings only change on the
+ * CPU it runs on; elsewhere they may be stale and are flushed.
+ * Loading the result therefore does not flush a changed mapping: code
+ * that changes one must invalidate it itself, as vm_map_range() and
+ * vm_unmap_range() do. Without PCIDs, this is the page table itself.
+ * Called with interrupts disabled.
+ *
+ * @param pml4 Page table to switch to
+ * @param space PCID of the address space, reset to a zero generation
+ * when the address space changes
+ *
+ * @return The value for CR3
+ */
+uint64_t vmm_cr3(pagetable_t *pml4, vmm_pcid_t *space)
+{
+  uint64_t cr3 = (uint64_t)pml4;
+  uint64_t generation;
+  int cpu;
+
+  /* The kernel page table has PCID 0 and changes no user mappings */
+  if(!vmm_pcid_enabled || pml4 == kernel_pml4)
+    return cr3;
+
+  cpu = _interrupt_getcpu();
+
+  spinlock_acquire(&vmm_pcid_lock);
+  if(space->generation != vmm_pcid_generation)
+  {
+    if(vmm_pcid_next == VMM_PCIDS)
+    {
+      vmm_pcid_generation++;
+      vmm_pcid_next = 1;
+    }
+    space->pcid = vmm_pcid_next++;
+    space->generation = vmm_pcid_generation;
+    space->cpu = -1;
+  }
+  generation = vmm_pcid_generation;
+  spinlock_release(&vmm_pcid_lock);
+
+  if(vmm_cpu_generation[cpu] != generation)
+  {
+    vmm_flush_all();
+    vmm_cpu_generation[cpu] = generation;
+  }
+
+  cr3 |= space->pcid;
+  if(space->cpu == cpu)
+    cr3 |= VMM_CR3_NOFLUSH;
+  space->cpu = cpu;
+
+  return cr3;
+}
+
 pagetable_t* vmm_getptable(pagetable_t *pdir, virtaddr_t vaddr)
 {
   /* Get PDP index */
@@ -165,141 +297,370 @@ pagetable_t* vmm_getpdp(pagetable_t *pml4, virtaddr_t vaddr)
     return 0;
 }
 
+/* Returns the page table entry of a 4 KB page, 0 if there is no page
+ * table for it. The caller holds vm_lock. */
+page_t* vmm_getpage(pagetable_t *pml4, virtaddr_t vaddr)
+{
+  pagetable_t *pdp;
+  pagetable_t *pdir;
+  pagetable_t *pt;
+
+  pdp = vmm_getpdp(pml4, vaddr);
+  if(pdp == 0)
+    return 0;
+
+  pdir = vmm_getpdir(pdp, vaddr);
+  if(pdir == 0 || (pdir->pages[VMM_INDEX_PDIR(vaddr)] & PAGE_2MB))
+    return 0;
+
+  pt = vmm_getptable(pdir, vaddr);
+  if(pt == 0)
+    return 0;
+
+  return &pt->pages[VMM_INDEX_PTABLE(vaddr)];
+}
+
 void vm_init(void){
-  uint64_t i, phys, virt;
   physaddr_t indentity_bound;
   pagetable_t *pml4;
   spinlock_reset(&vm_lock);
+  spinlock_register(&vm_lock, "vm_lock");
+  spinlock_reset(&vmm_pcid_lock);
+  spinlock_register(&vmm_pcid_lock, "vmm_pcid_lock");
 
   /* The boundary for the indentity mapping */
   indentity_bound = ((physaddr_t)&KERNEL_ENDS_HERE)+stalloced_total;
 
-  if (indentity_bound % PMM_BLOCK_SIZE > 0) {
-    indentity_bound += PMM_BLOCK_SIZE - indentity_bound % PMM_BLOCK_SIZE;
-  }
-
-  /* initialize kmalloc allocation address */
-  kmalloc_addr = indentity_bound;
-    
-  /* Clear page table bitmap */
-  for(uint64_t i = 0; i < VM_PTP_SIZE; i++)
-    ptmap_unsetbit(i);
+  /* Every frame of the physical memory manager is mapped too, so
+   * that page tables and the kernel heap can use any frame */
+  if(indentity_bound < total_blocks * PAGE_SIZE)
+    indentity_bound = total_blocks * PAGE_SIZE;
 
   /* Create kernel pml4 */
+  vmm_boot_used = 0;
+  vmm_direct_mapped = 0;
   pml4 = vmm_new_pagetable();
-  vmm_cleartable(pml4);
 
- /* Identity map from page 1 to KERNEL_ENDS_HERE */
-  for(i = 1, phys = virt = 0x1000; phys < indentity_bound;
-      i++, phys = virt += 0x1000)
-  {
-    vm_map(pml4, phys, virt, 0);
-  }
+ /* Identity map from page 1 to the end of physical memory. The first
+  * 2 MB use single pages, so that page 0 stays unmapped; the rest
+  * uses 2 MB pages up to the next 2 MB boundary. These never change,
+  * so they are global and survive CR3 reloads. */
+  vm_map_range(pml4, 0x1000, 0x1000,
+               (VMM_LARGE_PAGE_MASK + 1 - 0x1000) / PAGE_SIZE, PAGE_WRITE);
+  indentity_bound = (indentity_bound + VMM_LARGE_PAGE_MASK)
+    & ~(physaddr_t)VMM_LARGE_PAGE_MASK;
+  if(indentity_bound > VMM_LARGE_PAGE_MASK + 1)
+    vm_map_range(pml4, VMM_LARGE_PAGE_MASK + 1, VMM_LARGE_PAGE_MASK + 1,
+                 (indentity_bound - VMM_LARGE_PAGE_MASK - 1) / PAGE_SIZE,
+                 PAGE_WRITE | PAGE_CPU_GLOBAL | VM_MAP_LARGE);
 
   kernel_pml4 = pml4;
   vmm_setcr3((uint64_t) pml4);
-}
-
-void* kmalloc(uint64_t size){
-  physaddr_t frames;
-  virtaddr_t ret_addr;
-  uint64_t n_frames, i;
-  if(size+kmalloc_addr > VMM_KERNEL_SPACE)
-    KERNEL_PANIC("kmalloc: Out of virtual address space");
-
-  ret_addr = kmalloc_addr;
+  vmm_direct_mapped = 1;
 
-  n_frames = size/PMM_BLOCK_SIZE;
-  if(size%PMM_BLOCK_SIZE)
-    n_frames++;
+  vmm_pcid_enabled = vmm_pcid_present();
+  vmm_pcid_generation = 1;
+  vmm_pcid_next = 1;
+  vmm_init_cpu();
 
-  frames = physmem_getframes(n_frames);
-  for(i = 0; i < n_frames; i++){
-    vm_map(kernel_pml4, frames+(i*PMM_BLOCK_SIZE),
-        kmalloc_addr+(0x1000*i), 0);
-  }
-
-  kmalloc_addr += 0x1000*i;
-
-  return ret_addr;
+  /* The kernel heap uses frames through the identity map */
+  kmem_init();
 }
 
-void vm_map(pagetable_t *pml4,
-            physaddr_t physaddr, virtaddr_t vaddr, int flags)
+/* Returns the page directory holding the entry of vaddr, 0 if there
+ * is none. With create set, missing paging structures are allocated
+ * on the way, user accessible if flags has PAGE_USER. The caller
+ * holds vm_lock. */
+static pagetable_t *vmm_walk_pdir(pagetable_t *pml4, virtaddr_t vaddr,
+                                  int flags, int create)
 {
   /* Get current paging structure */
   pagetable_t *pdp;
   pagetable_t *pdir;
-  pagetable_t *pt;
-
-  /* Get a lock & disable ints */
-  interrupt_status_t intr_status = _interrupt_disable();
-  spinlock_acquire(&vm_lock);
+  uint64_t table_flags = PAGE_PRESENT | PAGE_WRITE | (flags & PAGE_USER);
 
   /* Get appropriate pdp */
   pdp = vmm_getpdp(pml4, vaddr);
   if(pdp == 0)
   {
+    if(!create)
+      return 0;
+
     /* Oh god, it isn't, allocate a new pdp */
     pdp = vmm_new_pagetable();
 
-    vmm_cleartable(pdp);
-
     /* Install it */
     vmm_install_ptable(pml4, VMM_INDEX_PML4(vaddr),
-        (physaddr_t)pdp, PAGE_PRESENT | PAGE_WRITE | flags);
+        (physaddr_t)pdp, table_flags);
   }
 
   /* Get appropriate pdir */
   pdir = vmm_getpdir(pdp, vaddr);
   if(pdir == 0)
   {
+    if(!create)
+      return 0;
+
     /* Oh god, it isn't, allocate a new page directory */
     pdir = vmm_new_pagetable();
-    vmm_cleartable(pdir);
 
     /* Install it */
     vmm_install_ptable(pdp, VMM_INDEX_PDP(vaddr),
-        (physaddr_t)pdir, PAGE_PRESENT | PAGE_WRITE | flags);
+        (physaddr_t)pdir, table_flags);
+  }
+
+  return pdir;
+}
+
+/* Returns the page table holding the entry of vaddr, 0 if there is
+ * none, see vmm_walk_pdir(). A 2 MB page in the way is split into a
+ * page table mapping the same frames, so that single pages of it can
+ * be changed. The caller holds vm_lock. */
+static pagetable_t *vmm_walk(pagetable_t *pml4, virtaddr_t vaddr,
+                             int flags, int create)
+{
+  pagetable_t *pdir;
+  pagetable_t *pt;
+  uint64_t entry, i;
+
+  pdir = vmm_walk_pdir(pml4, vaddr, flags, create);
+  if(pdir == 0)
+    return 0;
+
+  entry = pdir->pages[VMM_INDEX_PDIR(vaddr)];
+  if((entry & PAGE_PRESENT) && (entry & PAGE_2MB))
+  {
+    pt = vmm_new_pagetable();
+    for(i = 0; i < PAGE_TABLE_ENTRIES; i++)
+      pt->pages[i] = ((entry & PAGE_MASK) + i * PAGE_SIZE)
+        | (entry & PAGE_ATTRIBS & ~(uint64_t)PAGE_2MB);
+
+    /* Same translations as before, so no flush is needed */
+    vmm_install_ptable(pdir, VMM_INDEX_PDIR(vaddr), (physaddr_t)pt,
+        PAGE_PRESENT | PAGE_WRITE | (entry & PAGE_USER));
+    return pt;
   }
 
   /* Get appropriate page directory */
   pt = vmm_getptable(pdir, vaddr);
   if(pt == 0)
   {
+    if(!create)
+      return 0;
+
     /* Oh god, it isn't, allocate a new page table */
     pt = vmm_new_pagetable();
-    vmm_cleartable(pt);
 
     /* Install it */
     vmm_install_ptable(pdir, VMM_INDEX_PDIR(vaddr),
-        (physaddr_t)pt, PAGE_PRESENT | PAGE_WRITE | flags);
+        (physaddr_t)pt, PAGE_PRESENT | PAGE_WRITE | (flags & PAGE_USER));
+  }
+
+  return pt;
+}
+
+/* Flushes the TLB entries of a range of pages on this CPU: page by
+ * page for short ranges, all at once for long ones */
+static void vmm_flush_range(virtaddr_t vaddr, uint64_t pages)
+{
+  uint64_t i;
+
+  if(pages > VMM_FLUSH_PAGES)
+  {
+    vmm_reloadcr3();
+    return;
   }
 
-  /* NOW, FINALLY, Get the appropriate page */
-  pt->pages[VMM_INDEX_PTABLE(vaddr)] = physaddr |
-    PAGE_PRESENT | PAGE_WRITE | flags;
+  for(i = 0; i < pages; i++, vaddr += PAGE_SIZE)
+    vmm_invalidatepage(vaddr);
+}
+
+void vm_map(pagetable_t *pml4,
+            physaddr_t physaddr, virtaddr_t vaddr, int flags)
+{
+  vm_map_range(pml4, physaddr, vaddr, 1, flags);
+}
+
+void vm_unmap(pagetable_t *pml4, virtaddr_t vaddr)
+{
+  vm_unmap_range(pml4, vaddr, 1);
+}
+
+/**
+ * Maps a range of pages to consecutive frames. The page tables are
+ * walked once per page table rather than once per page, and the TLB
+ * is flushed once at the end, only if a present mapping changed;
+ * nothing is cached for pages that were not present. The flush cannot
+ * be left to the next context switch, since vmm_cr3() keeps the TLB
+ * entries of an address space that returns to the same CPU.
+ *
+ * @param pml4 Page table to map in
+ * @param physaddr Physical address of the first frame
+ * @param vaddr Virtual address of the first page
+ * @param pages Number of pages
+ * @param flags PAGE_* flags of the pages. With VM_MAP_LARGE, 2 MB
+ * pages are used wherever both addresses are 2 MB aligned and at
+ * least 2 MB remain.
+ */
+void vm_map_range(pagetable_t *pml4, physaddr_t physaddr,
+                  virtaddr_t vaddr, uint64_t pages, int flags)
+{
+  pagetable_t *pt = 0;
+  pagetable_t *pdir;
+  page_t entry, old;
+  virtaddr_t start = vaddr;
+  uint64_t i = 0;
+  int changed = 0;
+  int large = flags & VM_MAP_LARGE;
+
+  flags &= ~VM_MAP_LARGE;
+
+  /* Get a lock & disable ints */
+  interrupt_status_t intr_status = _interrupt_disable();
+  spinlock_acquire(&vm_lock);
+
+  while(i < pages)
+  {
+    if(large && pages - i >= PAGE_TABLE_ENTRIES
+       && !(vaddr & VMM_LARGE_PAGE_MASK) && !(physaddr & VMM_LARGE_PAGE_MASK))
+    {
+      pdir = vmm_walk_pdir(pml4, vaddr, flags, 1);
+      entry = physaddr | PAGE_PRESENT | PAGE_2MB | flags;
+      old = pdir->pages[VMM_INDEX_PDIR(vaddr)];
+
+      /* Pages mapped one by one here keep their page table */
+      if(!(old & PAGE_PRESENT) || (old & PAGE_2MB))
+      {
+        if((old & PAGE_PRESENT)
+           && (old & ~(uint64_t)(PAGE_ACCESSED | PAGE_DIRTY)) != entry)
+          changed = 1;
+
+        pdir->pages[VMM_INDEX_PDIR(vaddr)] = entry;
+        pt = 0;
+        i += PAGE_TABLE_ENTRIES;
+        physaddr += PAGE_TABLE_ENTRIES * PAGE_SIZE;
+        vaddr += PAGE_TABLE_ENTRIES * PAGE_SIZE;
+        continue;
+      }
+    }
+
+    /* A new page table starts every 512 pages */
+    if(pt == 0 || VMM_INDEX_PTABLE(vaddr) == 0)
+      pt = vmm_walk(pml4, vaddr, flags, 1);
+
+    entry = physaddr | PAGE_PRESENT | flags;
+    old = pt->pages[VMM_INDEX_PTABLE(vaddr)];
+    if((old & PAGE_PRESENT)
+       && (old & ~(uint64_t)(PAGE_ACCESSED | PAGE_DIRTY)) != entry)
+      changed = 1;
+
+    pt->pages[VMM_INDEX_PTABLE(vaddr)] = entry;
+
+    i++;
+    physaddr += PAGE_SIZE;
+    vaddr += PAGE_SIZE;
+  }
 
   /* Done, release lock */
   spinlock_release(&vm_lock);
   _interrupt_set_state(intr_status);
 
-  /* Invalidate page in TLB cache */
-  vmm_invalidatepage(vaddr);
-  vmm_reloadcr3();
+  if(changed)
+    vmm_flush_range(start, pages);
+}
+
+/**
+ * Unmaps a range of pages. The frames are not freed. The TLB is
+ * flushed once at the end, see vm_map_range().
+ *
+ * @param pml4 Page table to unmap in
+ * @param vaddr Virtual address of the first page
+ * @param pages Number of pages
+ */
+void vm_unmap_range(pagetable_t *pml4, virtaddr_t vaddr, uint64_t pages)
+{
+  pagetable_t *pt = 0;
+  virtaddr_t start = vaddr;
+  uint64_t i;
+  int changed = 0;
+
+  interrupt_status_t intr_status = _interrupt_disable();
+  spinlock_acquire(&vm_lock);
+
+  for(i = 0; i < pages; i++, vaddr += PAGE_SIZE)
+  {
+    if(i == 0 || VMM_INDEX_PTABLE(vaddr) == 0)
+      pt = vmm_walk(pml4, vaddr, 0, 0);
+
+    if(pt != 0 && (pt->pages[VMM_INDEX_PTABLE(vaddr)] & PAGE_PRESENT))
+    {
+      pt->pages[VMM_INDEX_PTABLE(vaddr)] = 0;
+      changed = 1;
+    }
+  }
+
+  spinlock_release(&vm_lock);
+  _interrupt_set_state(intr_status);
+
+  if(changed)
+    vmm_flush_range(start, pages);
 }
 
-void vm_unmap(pagetable_t *pagetable, virtaddr_t vaddr)
+/**
+ * Looks up the physical address a virtual address is mapped to.
+ *
+ * @param pml4 Page table to look in
+ * @param vaddr Virtual address to look up
+ *
+ * @return The physical address, including the offset within the
+ * page, or 0 if vaddr is not mapped.
+ */
+physaddr_t vm_getmap(pagetable_t *pml4, virtaddr_t vaddr)
 {
-  /* Unimplemented */
-  vaddr = vaddr;
+  pagetable_t *pdp;
+  pagetable_t *pdir;
+  pagetable_t *pt;
+  uint64_t entry;
+  physaddr_t result = 0;
+
+  interrupt_status_t intr_status = _interrupt_disable();
+  spinlock_acquire(&vm_lock);
+
+  pdp = vmm_getpdp(pml4, vaddr);
+  if (pdp != 0) {
+    pdir = vmm_getpdir(pdp, vaddr);
+    if (pdir != 0) {
+      entry = pdir->pages[VMM_INDEX_PDIR(vaddr)];
+      if ((entry & PAGE_PRESENT) && (entry & PAGE_2MB)) {
+        /* 2 MB page, no page table below it */
+        result = (entry & PAGE_MASK & ~0x1FFFFFUL) | (vaddr & 0x1FFFFF);
+      } else {
+        pt = vmm_getptable(pdir, vaddr);
+        if (pt != 0) {
+          entry = pt->pages[VMM_INDEX_PTABLE(vaddr)];
+          if (entry & PAGE_PRESENT)
+            result = (entry & PAGE_MASK) | (vaddr & ~PAGE_MASK);
+        }
+      }
+    }
+  }
+
+  spinlock_release(&vm_lock);
+  _interrupt_set_state(intr_status);
+
+  return result;
 }
 
 pagetable_t *vm_create_pagetable(uint32_t asid){
+  pagetable_t *pml4;
   asid = asid;
 
-  //Get page table from pool
-  pagetable_t *pml4 = vmm_new_pagetable();
+  //Get page table from the physical memory manager
+  interrupt_status_t intr_status = _interrupt_disable();
+  spinlock_acquire(&vm_lock);
+  pml4 = vmm_new_pagetable();
+  spinlock_release(&vm_lock);
+  _interrupt_set_state(intr_status);
 
   //copy the kernel mappings into the new page table
   memcopy(sizeof(pagetable_t), pml4, kernel_pml4);
@@ -309,33 +670,184 @@ pagetable_t *vm_create_pagetable(uint32_t asid){
 }
 
 /**
- * Destroys given pagetable. Frees the memory allocated for
- * the pagetable.
+ * Creates a copy-on-write copy of the userland half of a page table.
+ * The copy shares every userland frame: writable pages become read
+ * only and copy-on-write in both tables, and each frame gets one more
+ * user. Only the page tables are copied, never the pages themselves.
+ *
+ * @param pml4 Page table to copy, the current one
+ * @param asid Address space identifier of the copy
+ *
+ * @return The new page table
+ */
+pagetable_t *vm_fork_pagetable(pagetable_t *pml4, uint32_t asid)
+{
+  pagetable_t *copy = vm_create_pagetable(asid);
+  pagetable_t *pdp;
+  pagetable_t *pdir;
+  pagetable_t *pt;
+  pagetable_t *copy_pt;
+  uint64_t i, j, k, l;
+  page_t *page;
+
+  interrupt_status_t intr_status = _interrupt_disable();
+  spinlock_acquire(&vm_lock);
+
+  /* Userland lives above VMM_KERNEL_SPACE. The new page tables are
+     fresh, so nothing needs to be flushed for them. */
+  for(i = VMM_INDEX_PML4(VMM_KERNEL_SPACE) + 1; i < PAGE_TABLE_ENTRIES; i++)
+  {
+    if(!(pml4->pages[i] & PAGE_PRESENT))
+      continue;
+    pdp = (pagetable_t*)(pml4->pages[i] & PAGE_MASK);
+
+    for(j = 0; j < PAGE_TABLE_ENTRIES; j++)
+    {
+      if(!(pdp->pages[j] & PAGE_PRESENT))
+        continue;
+      pdir = (pagetable_t*)(pdp->pages[j] & PAGE_MASK);
+
+      for(k = 0; k < PAGE_TABLE_ENTRIES; k++)
+      {
+        if(!(pdir->pages[k] & PAGE_PRESENT) || (pdir->pages[k] & PAGE_2MB))
+          continue;
+        pt = (pagetable_t*)(pdir->pages[k] & PAGE_MASK);
+        copy_pt = 0;
+
+        for(l = 0; l < PAGE_TABLE_ENTRIES; l++)
+        {
+          page = &pt->pages[l];
+          if(!(*page & PAGE_PRESENT))
+            continue;
+
+          if(*page & PAGE_WRITE)
+            *page = (*page & ~(uint64_t)PAGE_WRITE) | PAGE_COW;
+
+          if(copy_pt == 0)
+            copy_pt = vmm_walk(copy, VMM_VADDR(i, j, k, l), PAGE_USER, 1);
+          copy_pt->pages[l] = *page & ~(uint64_t)(PAGE_ACCESSED | PAGE_DIRTY);
+          physmem_share(*page & PAGE_MASK);
+        }
+      }
+    }
+  }
+
+  spinlock_release(&vm_lock);
+  _interrupt_set_state(intr_status);
+
+  /* The pages of the original lost their write access */
+  vmm_reloadcr3();
+
+  return copy;
+}
+
+/**
+ * Resolves a write fault on a copy-on-write page. A frame that is
+ * still shared is copied to a new frame of our own; the last user
+ * simply gets write access back.
+ *
+ * @param pml4 Page table of the faulting thread
+ * @param vaddr Faulting virtual address
+ *
+ * @return 0 if the page is writable now, -1 if it is not a
+ * copy-on-write page
+ */
+int vm_handle_cow(pagetable_t *pml4, virtaddr_t vaddr)
+{
+  page_t *page;
+  physaddr_t frame, copy;
+  virtaddr_t base = vaddr & VMM_PAGE_MASK;
+
+  interrupt_status_t intr_status = _interrupt_disable();
+  spinlock_acquire(&vm_lock);
+
+  page = vmm_getpage(pml4, vaddr);
+  if(page == 0 || !(*page & PAGE_PRESENT) || !(*page & PAGE_COW))
+  {
+    spinlock_release(&vm_lock);
+    _interrupt_set_state(intr_status);
+    return -1;
+  }
+
+  frame = *page & PAGE_MASK;
+  if(physmem_shared(frame))
+  {
+    /* Both frames are mapped at their physical address */
+    copy = physmem_allocblock();
+    memcopy(PAGE_SIZE, (void*)copy, (void*)frame);
+    *page = copy | (*page & PAGE_ATTRIBS & ~(uint64_t)PAGE_COW) | PAGE_WRITE;
+    vmm_invalidatepage(base);
+
+    /* Still shared, so this only drops our use of it */
+    physmem_release(frame);
+  }
+  else
+  {
+    *page = (*page & ~(uint64_t)PAGE_COW) | PAGE_WRITE;
+    vmm_invalidatepage(base);
+  }
+
+  spinlock_release(&vm_lock);
+  _interrupt_set_state(intr_status);
+
+  return 0;
+}
+
+/**
+ * Destroys given pagetable. Every userland frame mapped in it loses a
+ * user, which frees frames no other page table or the page cache
+ * holds, and the userland paging structures and the pml4 itself are
+ * freed. The kernel half is shared with kernel_pml4 and left alone.
+ * The page table must not be in use on any CPU.
  *
  * @param pagetable Page table to destroy
  *
  */
 void vm_destroy_pagetable(pagetable_t *pagetable)
 {
-  /* Sanity check, is the pagetable pointer greater than the base
-   * of the pagetable pool?
-   *
-   * Not sure if C allows comparison of pointers, so cast them.
-   */
-  if(((virtaddr_t)pagetable) < ((virtaddr_t)pt_pool))
-    KERNEL_PANIC("vm_destroy_pagetable: Bad pointer range");
-
-  //Calculate pagetable index
-  uint64_t pt_index = pagetable - pt_pool;
-
-  /* Sanity check, is the page table index less than the
-   * number of page tables?
-   */
-  if(pt_index >= VM_PTP_SIZE)
-    KERNEL_PANIC("vm_destroy_pagetable: Bad pointer ranger");
-
-  //Unset bit in page pool bitmap
-  ptmap_unsetbit(pt_index);
+  pagetable_t *pdp;
+  pagetable_t *pdir;
+  pagetable_t *pt;
+  uint64_t i, j, k, l;
+
+  if(pagetable == kernel_pml4)
+    KERNEL_PANIC("vm_destroy_pagetable: Destroying the kernel page table");
+
+  interrupt_status_t intr_status = _interrupt_disable();
+  spinlock_acquire(&vm_lock);
+
+  for(i = VMM_INDEX_PML4(VMM_KERNEL_SPACE) + 1; i < PAGE_TABLE_ENTRIES; i++)
+  {
+    if(!(pagetable->pages[i] & PAGE_PRESENT))
+      continue;
+    pdp = (pagetable_t*)(pagetable->pages[i] & PAGE_MASK);
+
+    for(j = 0; j < PAGE_TABLE_ENTRIES; j++)
+    {
+      if(!(pdp->pages[j] & PAGE_PRESENT))
+        continue;
+      pdir = (pagetable_t*)(pdp->pages[j] & PAGE_MASK);
+
+      for(k = 0; k < PAGE_TABLE_ENTRIES; k++)
+      {
+        if(!(pdir->pages[k] & PAGE_PRESENT) || (pdir->pages[k] & PAGE_2MB))
+          continue;
+        pt = (pagetable_t*)(pdir->pages[k] & PAGE_MASK);
+
+        for(l = 0; l < PAGE_TABLE_ENTRIES; l++)
+          if(pt->pages[l] & PAGE_PRESENT)
+            physmem_release(pt->pages[l] & PAGE_MASK);
+
+        vmm_free_pagetable(pt);
+      }
+      vmm_free_pagetable(pdir);
+    }
+    vmm_free_pagetable(pdp);
+  }
+  vmm_free_pagetable(pagetable);
+
+  spinlock_release(&vm_lock);
+  _interrupt_set_state(intr_status);
 }
 
 /* Compatability Functions */
@@ -3,6 +3,6 @@
 # Set the module name
 MODULE := vm/x86_64
 
-FILES := mm_phys.c mm_virt.c
+FILES := mm_phys.c mm_virt.c kmem.c
 
 X64SRC += $(patsubst %, $(MODULE)/%, $(FILES))
@@ -27,6 +27,10 @@
 #define PAGE_2MB        0x80
 #define PAGE_CPU_GLOBAL 0x100
 #define PAGE_LV4_GLOBAL 0x200
+#define PAGE_COW        0x400   /* Ignored by the MMU, copy-on-write */
+
+/* Flags of vm_map_range(), never stored */
+#define VM_MAP_LARGE    0x1000  /* use 2 MB pages where possible */
 
 /* In x86_64, with 4 KB Pages we have 4 Level Page Directory */
 
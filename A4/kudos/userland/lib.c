@@ -67,6 +67,40 @@ void *syscall_memlimit(void *heap_end)
   return (void*)(uintptr_t)_syscall(SYSCALL_MEMLIMIT, (uintptr_t)heap_end, 0, 0);
 }
 
+/// Set the scheduling priority of every thread of process 'pid'.
+/// 0 is the highest priority. Only has an effect when the kernel runs
+/// the multi-level feedback queue scheduler. A process may only lower
+/// the priority of other processes. Returns 0 on success or a negative
+/// value on error.
+int syscall_setpriority(int pid, int priority)
+{
+  return (int)_syscall(SYSCALL_SETPRIORITY, (uintptr_t)pid,
+                       (uintptr_t)priority, 0);
+}
+
+/// Sleep for 'msec' milliseconds. The process uses no CPU time while
+/// sleeping. Returns 0 on success or a negative value on error.
+int syscall_sleep(int msec)
+{
+  return (int)_syscall(SYSCALL_SLEEP, (uintptr_t)msec, 0, 0);
+}
+
+/// Sleep on the word at 'addr' if it still holds 'expected', for at most
+/// 'msec' milliseconds (0 for no limit). Returns 0 when woken, 1 if the
+/// word held another value, or a negative value on timeout or error.
+int syscall_futex_wait(int *addr, int expected, int msec)
+{
+  return (int)_syscall(SYSCALL_FUTEX_WAIT, (uintptr_t)addr,
+                       (uintptr_t)(unsigned int)expected, (uintptr_t)msec);
+}
+
+/// Wake up to 'n' threads sleeping on the word at 'addr'. Returns the
+/// number of threads woken or a negative value on error.
+int syscall_futex_wake(int *addr, int n)
+{
+  return (int)_syscall(SYSCALL_FUTEX_WAKE, (uintptr_t)addr, (uintptr_t)n, 0);
+}
+
 /// Open a new, named semaphore.
 /// Arguments: a name for the semaphore and its initial value.
 /// Return NULL on error. For instance, if a semaphore with the given name
@@ -886,3 +920,83 @@ int atoi(const char *nptr)
 }
 
 #endif
+
+#ifdef PROVIDE_SYNCHRONIZATION
+
+/* The mutex and semaphore below keep their state in userland memory and
+   update it with atomic instructions. They only make a system call when
+   a thread has to sleep, or when a thread may be sleeping and has to be
+   woken up. */
+
+void mutex_init(mutex_t *m)
+{
+  m->state = 0;
+}
+
+/* Atomically sets *p to new_value if it is expected. Returns non-zero
+   on success. */
+static int cas(volatile int *p, int expected, int new_value)
+{
+  return __atomic_compare_exchange_n(p, &expected, new_value, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void mutex_lock(mutex_t *m)
+{
+  if (cas(&m->state, 0, 1))
+    return;
+
+  /* Contended: mark the mutex as having waiters and sleep until it is
+     released. Whoever takes it this way keeps the mark, as other
+     threads may still be sleeping. */
+  while (__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE) != 0)
+    syscall_futex_wait((int*)&m->state, 2, 0);
+}
+
+/// Returns 1 if the mutex was taken, 0 if it is held by someone else.
+int mutex_trylock(mutex_t *m)
+{
+  return cas(&m->state, 0, 1);
+}
+
+void mutex_unlock(mutex_t *m)
+{
+  if (__atomic_fetch_sub(&m->state, 1, __ATOMIC_RELEASE) != 1) {
+    /* There may be waiters */
+    __atomic_store_n(&m->state, 0, __ATOMIC_RELEASE);
+    syscall_futex_wake((int*)&m->state, 1);
+  }
+}
+
+void usem_init(usem_t *s, int value)
+{
+  s->value = value;
+  s->waiters = 0;
+}
+
+void usem_p(usem_t *s)
+{
+  int v;
+
+  for (;;) {
+    v = __atomic_load_n(&s->value, __ATOMIC_RELAXED);
+    if (v > 0) {
+      if (cas(&s->value, v, v - 1))
+        return;
+      continue;
+    }
+
+    __atomic_fetch_add(&s->waiters, 1, __ATOMIC_SEQ_CST);
+    syscall_futex_wait((int*)&s->value, v, 0);
+    __atomic_fetch_sub(&s->waiters, 1, __ATOMIC_RELAXED);
+  }
+}
+
+void usem_v(usem_t *s)
+{
+  __atomic_fetch_add(&s->value, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&s->waiters, __ATOMIC_SEQ_CST) > 0)
+    syscall_futex_wake((int*)&s->value, 1);
+}
+
+#endif
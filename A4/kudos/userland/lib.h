@@ -15,6 +15,7 @@
 #define PROVIDE_FORMATTED_OUTPUT
 #define PROVIDE_HEAP_ALLOCATOR
 #define PROVIDE_MISC
+#define PROVIDE_SYNCHRONIZATION
 
 #include "lib/types.h"
 
@@ -43,6 +44,10 @@ void syscall_halt(void);
 int syscall_spawn(const char *path, int flags);
 int syscall_join(int pid);
 void syscall_exit(int retval);
+int syscall_setpriority(int pid, int priority);
+int syscall_sleep(int msec);
+int syscall_futex_wait(int *addr, int expected, int msec);
+int syscall_futex_wake(int *addr, int n);
 
 typedef int sem_t; // TODO: Change this, or remove this TODO.
 sem_t* syscall_sem_open(const char *name, int value);
@@ -104,4 +109,26 @@ void *realloc(void *ptr, size_t size);
 int atoi(const char *nptr);
 #endif
 
+#ifdef PROVIDE_SYNCHRONIZATION
+/* A mutex: 0 is unlocked, 1 locked, 2 locked with possible waiters */
+typedef struct {
+  volatile int state;
+} mutex_t;
+
+void mutex_init(mutex_t *m);
+void mutex_lock(mutex_t *m);
+int mutex_trylock(mutex_t *m);
+void mutex_unlock(mutex_t *m);
+
+/* A counting semaphore living in userland memory */
+typedef struct {
+  volatile int value;
+  volatile int waiters;
+} usem_t;
+
+void usem_init(usem_t *s, int value);
+void usem_p(usem_t *s);
+void usem_v(usem_t *s);
+#endif
+
 #endif // KUDOS_USERLAND_LIB_H